@@ -0,0 +1,555 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+
+// 32 bytes, two nodes per cache line
+struct BvhNode
+{
+	glm::vec3 boundsMin{};
+	std::uint32_t first{};		// leaf: first slot in the item order, inner: left child (right is first + 1)
+	glm::vec3 boundsMax{};
+	std::uint32_t count{};		// items in a leaf, 0 for an inner node
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay 32 bytes");
+
+
+// Bounding volume hierarchy over a set of boxes ("items"), built top-down with
+// binned SAH splits. Nodes live in one flat array and know their parent, so a
+// moved item only refits its path to the root.
+// Items keep the index they were given to build(), queries report that index
+class Bvh
+{
+private:
+	static constexpr std::uint32_t MAX_LEAF_ITEMS{ 4 };	// one SSE test per leaf
+	static constexpr int BINS{ 12 };
+	static constexpr std::uint32_t NO_PARENT{ ~0u };
+
+	std::vector<BvhNode> m_nodes{};
+	std::atomic<std::uint32_t> m_nodeCount{};	// nodes handed out while building
+	std::vector<std::uint32_t> m_parents{};
+
+	std::vector<std::uint32_t> m_order{};		// item index of every slot, leaves own slot ranges
+	std::vector<std::uint32_t> m_slots{};		// slot of every item
+	std::vector<std::uint32_t> m_itemLeaf{};
+	std::vector<glm::vec3> m_itemMin{};
+	std::vector<glm::vec3> m_itemMax{};
+
+	// item boxes in slot order, so a leaf is tested with one vector test
+	CullingBounds m_slotBounds{};
+
+	enum class Overlap
+	{
+		Outside,
+		Partial,
+		Inside,
+	};
+
+	void computeLeafBounds(BvhNode& node) const;
+	void computeInnerBounds(BvhNode& node) const;
+
+	// split a node with the cheapest SAH plane, false if keeping it a leaf is cheaper.
+	// A node with more than MAX_LEAF_ITEMS is always split, at the median when no
+	// plane separates its items. Only touches the node, its new children and its own slot range, so different
+	// subtrees can be split on different threads
+	bool split(std::uint32_t index);
+	void buildSubtree(std::uint32_t index);
+
+	// parents, slots and leaf lookup once the tree is complete
+	void finish();
+
+	static float surfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 size{ glm::max(boundsMax - boundsMin, glm::vec3(0.0f)) };
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	static Overlap classify(const Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	// distance along the ray to the box, or a negative value on a miss
+	static float intersect(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+public:
+	Bvh() = default;
+	Bvh(const Bvh&) = delete;
+	Bvh& operator=(const Bvh&) = delete;
+
+	// build over the boxes [boundsMin[i], boundsMax[i]]. With a pool, the tree is split
+	// on the calling thread until there are enough subtrees to finish them in parallel
+	void build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax,
+		ThreadPool* pool = nullptr);
+
+	// move one item and refit the nodes above it, the tree shape stays the same.
+	// Fine for objects that move a little, rebuild after large changes
+	void updateItem(std::uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	// call visible(item) for every item at least partly inside the frustum, returns
+	// the number of nodes visited. Subtrees fully inside are not tested any further
+	template <typename F>
+	unsigned int cull(const Frustum& frustum, F&& visible) const;
+
+	// call f(item) for every item whose box overlaps [boundsMin, boundsMax]
+	template <typename F>
+	void overlap(const glm::vec3& boundsMin, const glm::vec3& boundsMax, F&& f) const;
+
+	// nearest item box hit by origin + t * direction with t in [0, distance].
+	// On a hit, distance becomes the hit t and item the item hit
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, std::uint32_t& item) const;
+
+	std::size_t itemCount() const { return m_order.size(); }
+	std::size_t nodeCount() const { return m_nodes.size(); }
+	bool empty() const { return m_nodes.empty(); }
+};
+
+
+void Bvh::computeLeafBounds(BvhNode& node) const
+{
+	node.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	node.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+	{
+		node.boundsMin = glm::min(node.boundsMin, m_itemMin[m_order[slot]]);
+		node.boundsMax = glm::max(node.boundsMax, m_itemMax[m_order[slot]]);
+	}
+}
+
+
+void Bvh::computeInnerBounds(BvhNode& node) const
+{
+	const BvhNode& left{ m_nodes[node.first] };
+	const BvhNode& right{ m_nodes[node.first + 1] };
+	node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+	node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+}
+
+
+bool Bvh::split(std::uint32_t index)
+{
+	BvhNode& node{ m_nodes[index] };
+	if (node.count <= MAX_LEAF_ITEMS)
+		return false;
+
+	auto centroid{ [this](std::uint32_t item) { return (m_itemMin[item] + m_itemMax[item]) * 0.5f; } };
+
+	glm::vec3 centroidMin{ std::numeric_limits<float>::max() };
+	glm::vec3 centroidMax{ -std::numeric_limits<float>::max() };
+	for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+	{
+		glm::vec3 center{ centroid(m_order[slot]) };
+		centroidMin = glm::min(centroidMin, center);
+		centroidMax = glm::max(centroidMax, center);
+	}
+
+	float bestCost{ std::numeric_limits<float>::max() };
+	int bestAxis{ -1 };
+	int bestBin{ 0 };
+
+	for (int axis{ 0 }; axis < 3; ++axis)
+	{
+		float extent{ centroidMax[axis] - centroidMin[axis] };
+		if (extent <= 0.0f)
+			continue;
+
+		struct Bin
+		{
+			glm::vec3 boundsMin{ std::numeric_limits<float>::max() };
+			glm::vec3 boundsMax{ -std::numeric_limits<float>::max() };
+			std::uint32_t count{};
+		};
+		Bin bins[BINS]{};
+
+		float scale{ BINS / extent };
+		for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+		{
+			std::uint32_t item{ m_order[slot] };
+			int bin{ std::min(BINS - 1, static_cast<int>((centroid(item)[axis] - centroidMin[axis]) * scale)) };
+			bins[bin].boundsMin = glm::min(bins[bin].boundsMin, m_itemMin[item]);
+			bins[bin].boundsMax = glm::max(bins[bin].boundsMax, m_itemMax[item]);
+			++bins[bin].count;
+		}
+
+		// sweep from the left and from the right, plane i sits after bin i
+		float leftArea[BINS - 1]{};
+		std::uint32_t leftCount[BINS - 1]{};
+		Bin sweep{};
+		for (int i{ 0 }; i < BINS - 1; ++i)
+		{
+			sweep.boundsMin = glm::min(sweep.boundsMin, bins[i].boundsMin);
+			sweep.boundsMax = glm::max(sweep.boundsMax, bins[i].boundsMax);
+			sweep.count += bins[i].count;
+			leftArea[i] = sweep.count ? surfaceArea(sweep.boundsMin, sweep.boundsMax) : 0.0f;
+			leftCount[i] = sweep.count;
+		}
+
+		sweep = Bin{};
+		for (int i{ BINS - 1 }; i > 0; --i)
+		{
+			sweep.boundsMin = glm::min(sweep.boundsMin, bins[i].boundsMin);
+			sweep.boundsMax = glm::max(sweep.boundsMax, bins[i].boundsMax);
+			sweep.count += bins[i].count;
+
+			float rightArea{ sweep.count ? surfaceArea(sweep.boundsMin, sweep.boundsMax) : 0.0f };
+			float cost{ leftCount[i - 1] * leftArea[i - 1] + sweep.count * rightArea };
+			if (leftCount[i - 1] && sweep.count && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+			}
+		}
+	}
+
+	// a leaf costs one test per item over the node's area
+	float leafCost{ node.count * surfaceArea(node.boundsMin, node.boundsMax) };
+	auto begin{ m_order.begin() + node.first };
+	auto end{ begin + node.count };
+	std::uint32_t leftCount{};
+	if (bestAxis >= 0 && bestCost < leafCost)
+	{
+		float scale{ BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]) };
+		auto middle{ std::partition(begin, end, [&](std::uint32_t item)
+			{
+				int bin{ std::min(BINS - 1, static_cast<int>((centroid(item)[bestAxis] - centroidMin[bestAxis]) * scale)) };
+				return bin < bestBin;
+			}) };
+		leftCount = static_cast<std::uint32_t>(middle - begin);
+	}
+
+	// too many items for a leaf but no useful plane (coincident centroids, lots of
+	// small instances): halve the node along its longest centroid axis. Leaves must
+	// fit the fixed per-leaf scratch in cull()
+	if (leftCount == 0 || leftCount == node.count)
+	{
+		glm::vec3 extent{ centroidMax - centroidMin };
+		int axis{ extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2) };
+		leftCount = node.count / 2;
+		std::nth_element(begin, begin + leftCount, end,
+			[&](std::uint32_t a, std::uint32_t b) { return centroid(a)[axis] < centroid(b)[axis]; });
+	}
+
+	std::uint32_t children{ m_nodeCount.fetch_add(2) };
+
+	BvhNode& left{ m_nodes[children] };
+	left.first = node.first;
+	left.count = leftCount;
+	computeLeafBounds(left);
+
+	BvhNode& right{ m_nodes[children + 1] };
+	right.first = node.first + leftCount;
+	right.count = node.count - leftCount;
+	computeLeafBounds(right);
+
+	node.first = children;
+	node.count = 0;
+	return true;
+}
+
+
+void Bvh::buildSubtree(std::uint32_t index)
+{
+	if (!split(index))
+		return;
+
+	std::uint32_t left{ m_nodes[index].first };
+	buildSubtree(left);
+	buildSubtree(left + 1);
+}
+
+
+void Bvh::build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax, ThreadPool* pool)
+{
+	std::size_t count{ boundsMin.size() };
+	m_itemMin = boundsMin;
+	m_itemMax = boundsMax;
+	m_order.resize(count);
+	std::iota(m_order.begin(), m_order.end(), 0u);
+
+	m_nodes.clear();
+	if (count == 0)
+	{
+		finish();
+		return;
+	}
+
+	// a binary tree with at least one item per leaf never has more nodes than
+	// this, so the array never moves while threads are writing to it
+	m_nodes.resize(2 * count - 1);
+	m_nodeCount = 1;
+
+	BvhNode& root{ m_nodes[0] };
+	root.first = 0;
+	root.count = static_cast<std::uint32_t>(count);
+	computeLeafBounds(root);
+
+	if (pool)
+	{
+		// split level by level until every worker has a couple of subtrees
+		std::vector<std::uint32_t> subtrees{ 0 };
+		while (!subtrees.empty() && subtrees.size() < 2 * static_cast<std::size_t>(pool->size() + 1))
+		{
+			std::vector<std::uint32_t> next{};
+			for (std::uint32_t index : subtrees)
+			{
+				if (split(index))
+				{
+					next.push_back(m_nodes[index].first);
+					next.push_back(m_nodes[index].first + 1);
+				}
+			}
+			subtrees.swap(next);
+		}
+
+		parallelFor(*pool, subtrees.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t)
+			{
+				for (std::size_t i{ begin }; i < end; ++i)
+					buildSubtree(subtrees[i]);
+			});
+	}
+	else
+	{
+		buildSubtree(0);
+	}
+
+	m_nodes.resize(m_nodeCount);
+	finish();
+}
+
+
+void Bvh::finish()
+{
+	m_parents.assign(m_nodes.size(), NO_PARENT);
+	m_itemLeaf.assign(m_order.size(), 0);
+	m_slots.assign(m_order.size(), 0);
+	m_slotBounds.clear();
+
+	for (std::uint32_t index{ 0 }; index < m_nodes.size(); ++index)
+	{
+		const BvhNode& node{ m_nodes[index] };
+		if (node.count == 0)
+		{
+			m_parents[node.first] = index;
+			m_parents[node.first + 1] = index;
+		}
+		else
+		{
+			assert(node.count <= MAX_LEAF_ITEMS && "split() must not leave a leaf larger than cull() handles");
+			for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+				m_itemLeaf[m_order[slot]] = index;
+		}
+	}
+
+	for (std::uint32_t slot{ 0 }; slot < m_order.size(); ++slot)
+	{
+		m_slots[m_order[slot]] = slot;
+		m_slotBounds.add(m_itemMin[m_order[slot]], m_itemMax[m_order[slot]]);
+	}
+}
+
+
+void Bvh::updateItem(std::uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	m_itemMin[item] = boundsMin;
+	m_itemMax[item] = boundsMax;
+	m_slotBounds.set(m_slots[item], boundsMin, boundsMax);
+
+	std::uint32_t index{ m_itemLeaf[item] };
+	computeLeafBounds(m_nodes[index]);
+
+	for (index = m_parents[index]; index != NO_PARENT; index = m_parents[index])
+		computeInnerBounds(m_nodes[index]);
+}
+
+
+Bvh::Overlap Bvh::classify(const Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center{ (boundsMin + boundsMax) * 0.5f };
+	glm::vec3 extent{ (boundsMax - boundsMin) * 0.5f };
+
+	Overlap result{ Overlap::Inside };
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		float distance{ glm::dot(glm::vec3(plane), center) + plane.w };
+		float radius{ glm::dot(glm::abs(glm::vec3(plane)), extent) };
+
+		if (distance + radius < 0.0f)
+			return Overlap::Outside;
+		if (distance - radius < 0.0f)
+			result = Overlap::Partial;
+	}
+	return result;
+}
+
+
+template <typename F>
+unsigned int Bvh::cull(const Frustum& frustum, F&& visible) const
+{
+	if (m_nodes.empty())
+		return 0;
+
+	// node index and whether an ancestor was already fully inside
+	std::vector<std::pair<std::uint32_t, bool>> stack{ { 0u, false } };
+	unsigned int visited{};
+	std::uint8_t leafVisible[MAX_LEAF_ITEMS]{};
+
+	while (!stack.empty())
+	{
+		auto [index, inside] { stack.back() };
+		stack.pop_back();
+		++visited;
+
+		const BvhNode& node{ m_nodes[index] };
+		if (!inside)
+		{
+			Overlap overlap{ classify(frustum, node.boundsMin, node.boundsMax) };
+			if (overlap == Overlap::Outside)
+				continue;
+			inside = overlap == Overlap::Inside;
+		}
+
+		if (node.count == 0)
+		{
+			stack.push_back({ node.first, inside });
+			stack.push_back({ node.first + 1, inside });
+			continue;
+		}
+
+		if (inside)
+		{
+			for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+				visible(m_order[slot]);
+			continue;
+		}
+
+		m_slotBounds.cull(frustum, node.first, node.first + node.count, leafVisible);
+		for (std::uint32_t i{ 0 }; i < node.count; ++i)
+		{
+			if (leafVisible[i])
+				visible(m_order[node.first + i]);
+		}
+	}
+
+	return visited;
+}
+
+
+template <typename F>
+void Bvh::overlap(const glm::vec3& boundsMin, const glm::vec3& boundsMax, F&& f) const
+{
+	if (m_nodes.empty())
+		return;
+
+	auto overlaps{ [&](const glm::vec3& otherMin, const glm::vec3& otherMax)
+		{
+			return otherMin.x <= boundsMax.x && otherMin.y <= boundsMax.y && otherMin.z <= boundsMax.z
+				&& boundsMin.x <= otherMax.x && boundsMin.y <= otherMax.y && boundsMin.z <= otherMax.z;
+		} };
+
+	std::vector<std::uint32_t> stack{ 0u };
+	while (!stack.empty())
+	{
+		const BvhNode& node{ m_nodes[stack.back()] };
+		stack.pop_back();
+
+		if (!overlaps(node.boundsMin, node.boundsMax))
+			continue;
+
+		if (node.count == 0)
+		{
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+
+		for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+		{
+			std::uint32_t item{ m_order[slot] };
+			if (overlaps(m_itemMin[item], m_itemMax[item]))
+				f(item);
+		}
+	}
+}
+
+
+float Bvh::intersect(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	// slab test, an axis parallel ray gives +-inf and drops out of min / max
+	glm::vec3 t0{ (boundsMin - origin) * inverseDirection };
+	glm::vec3 t1{ (boundsMax - origin) * inverseDirection };
+	glm::vec3 tNear{ glm::min(t0, t1) };
+	glm::vec3 tFar{ glm::max(t0, t1) };
+
+	float enter{ std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f)) };
+	float exit{ std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance)) };
+	return enter <= exit ? enter : -1.0f;
+}
+
+
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, std::uint32_t& item) const
+{
+	if (m_nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection{ 1.0f / direction };
+	bool hit{ false };
+
+	std::vector<std::uint32_t> stack{ 0u };
+	while (!stack.empty())
+	{
+		const BvhNode& node{ m_nodes[stack.back()] };
+		stack.pop_back();
+
+		if (intersect(origin, inverseDirection, distance, node.boundsMin, node.boundsMax) < 0.0f)
+			continue;
+
+		if (node.count == 0)
+		{
+			// visit the nearer child first so the far one is usually skipped
+			const BvhNode& left{ m_nodes[node.first] };
+			const BvhNode& right{ m_nodes[node.first + 1] };
+			float leftDistance{ intersect(origin, inverseDirection, distance, left.boundsMin, left.boundsMax) };
+			float rightDistance{ intersect(origin, inverseDirection, distance, right.boundsMin, right.boundsMax) };
+
+			bool leftFirst{ rightDistance < 0.0f || (leftDistance >= 0.0f && leftDistance <= rightDistance) };
+			std::uint32_t nearChild{ leftFirst ? node.first : node.first + 1 };
+			std::uint32_t farChild{ leftFirst ? node.first + 1 : node.first };
+
+			if ((leftFirst ? rightDistance : leftDistance) >= 0.0f)
+				stack.push_back(farChild);
+			if ((leftFirst ? leftDistance : rightDistance) >= 0.0f)
+				stack.push_back(nearChild);
+			continue;
+		}
+
+		for (std::uint32_t slot{ node.first }; slot < node.first + node.count; ++slot)
+		{
+			std::uint32_t candidate{ m_order[slot] };
+			float t{ intersect(origin, inverseDirection, distance, m_itemMin[candidate], m_itemMax[candidate]) };
+			if (t >= 0.0f)
+			{
+				distance = t;
+				item = candidate;
+				hit = true;
+			}
+		}
+	}
+
+	return hit;
+}
+
+#endif // !BVH_H
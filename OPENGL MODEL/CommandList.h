@@ -0,0 +1,206 @@
+#pragma once
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLState.h"
+#include "Shader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+enum class CommandType : std::uint8_t
+{
+	UseProgram,
+	BindVertexArray,
+	BindTexture,
+	SetMat4,
+	UpdateBuffer,			// followed by the new buffer contents
+	DrawElementsInstanced,
+};
+
+
+// Linear buffer of packed GL commands. Any thread may record into its own list,
+// only the GL thread may replay() it. Recording never touches GL, so everything
+// a command needs (names, locations, values) is resolved up front
+class CommandList
+{
+private:
+	struct Header
+	{
+		CommandType type{};
+		std::uint32_t size{};		// payload bytes after the header
+	};
+
+	struct BindTextureCommand
+	{
+		unsigned int unit{};
+		GLenum target{};
+		unsigned int texture{};
+	};
+
+	struct SetMat4Command
+	{
+		GLint location{};
+		glm::mat4 value{};
+	};
+
+	struct UpdateBufferCommand
+	{
+		GLenum target{};
+		unsigned int buffer{};
+	};
+
+	struct DrawElementsCommand
+	{
+		GLsizei count{};
+		GLsizei instances{};
+	};
+
+	std::vector<unsigned char> m_data{};
+	unsigned int m_count{};
+
+	// payloads are copied byte-wise, replay reads them back with memcpy so
+	// nothing depends on the alignment inside the buffer
+	void push(CommandType type, const void* payload, std::size_t size, const void* extra = nullptr,
+		std::size_t extraSize = 0)
+	{
+		Header header{ type, static_cast<std::uint32_t>(size + extraSize) };
+		std::size_t offset{ m_data.size() };
+		m_data.resize(offset + sizeof(Header) + size + extraSize);
+
+		std::memcpy(m_data.data() + offset, &header, sizeof(Header));
+		if (size)
+			std::memcpy(m_data.data() + offset + sizeof(Header), payload, size);
+		if (extraSize)
+			std::memcpy(m_data.data() + offset + sizeof(Header) + size, extra, extraSize);
+
+		++m_count;
+	}
+
+	template <typename T>
+	static T read(const unsigned char* at)
+	{
+		T value{};
+		std::memcpy(&value, at, sizeof(T));
+		return value;
+	}
+
+public:
+	// keeps the allocation, lists are reused every frame
+	void clear()
+	{
+		m_data.clear();
+		m_count = 0;
+	}
+
+	bool empty() const { return m_count == 0; }
+	unsigned int commandCount() const { return m_count; }
+	std::size_t bytes() const { return m_data.size(); }
+
+	void useProgram(unsigned int program) { push(CommandType::UseProgram, &program, sizeof(program)); }
+
+	void bindVertexArray(unsigned int vertexArray)
+	{
+		push(CommandType::BindVertexArray, &vertexArray, sizeof(vertexArray));
+	}
+
+	void bindTexture(unsigned int unit, GLenum target, unsigned int texture)
+	{
+		BindTextureCommand command{ unit, target, texture };
+		push(CommandType::BindTexture, &command, sizeof(command));
+	}
+
+	void setUniform(Uniform<glm::mat4> uniform, const glm::mat4& value)
+	{
+		SetMat4Command command{ uniform.location, value };
+		push(CommandType::SetMat4, &command, sizeof(command));
+	}
+
+	// replace the whole contents of a buffer (orphaning it), e.g. a uniform block
+	void updateBuffer(GLenum target, unsigned int buffer, const void* data, std::size_t size)
+	{
+		UpdateBufferCommand command{ target, buffer };
+		push(CommandType::UpdateBuffer, &command, sizeof(command), data, size);
+	}
+
+	void drawElementsInstanced(GLsizei count, GLsizei instances)
+	{
+		DrawElementsCommand command{ count, instances };
+		push(CommandType::DrawElementsInstanced, &command, sizeof(command));
+	}
+
+	// issue every command in recording order. State changes go through the state
+	// cache, so the redundant binds of lists recorded independently are dropped
+	void replay() const;
+};
+
+
+void CommandList::replay() const
+{
+	const unsigned char* at{ m_data.data() };
+	const unsigned char* end{ at + m_data.size() };
+
+	while (at < end)
+	{
+		Header header{ read<Header>(at) };
+		const unsigned char* payload{ at + sizeof(Header) };
+
+		switch (header.type)
+		{
+		case CommandType::UseProgram:
+			glState().useProgram(read<unsigned int>(payload));
+			break;
+
+		case CommandType::BindVertexArray:
+			glState().bindVertexArray(read<unsigned int>(payload));
+			break;
+
+		case CommandType::BindTexture:
+		{
+			BindTextureCommand command{ read<BindTextureCommand>(payload) };
+			glState().bindTexture(command.unit, command.target, command.texture);
+			break;
+		}
+
+		case CommandType::SetMat4:
+		{
+			SetMat4Command command{ read<SetMat4Command>(payload) };
+			glUniformMatrix4fv(command.location, 1, GL_FALSE, &command.value[0][0]);
+			break;
+		}
+
+		case CommandType::UpdateBuffer:
+		{
+			UpdateBufferCommand command{ read<UpdateBufferCommand>(payload) };
+			std::size_t size{ header.size - sizeof(UpdateBufferCommand) };
+			glBindBuffer(command.target, command.buffer);
+			glBufferData(command.target, size, payload + sizeof(UpdateBufferCommand), GL_DYNAMIC_DRAW);
+			glBindBuffer(command.target, 0);
+			break;
+		}
+
+		case CommandType::DrawElementsInstanced:
+		{
+			DrawElementsCommand command{ read<DrawElementsCommand>(payload) };
+			glDrawElementsInstanced(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, 0, command.instances);
+			break;
+		}
+		}
+
+		at = payload + header.size;
+	}
+}
+
+
+// replay several lists as one, in order
+inline void replayAll(const std::vector<CommandList>& lists)
+{
+	for (const CommandList& list : lists)
+		list.replay();
+}
+
+#endif // !COMMAND_LIST_H
@@ -0,0 +1,255 @@
+#pragma once
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// widest instruction set the build targets. MSVC defines __AVX__ with /arch:AVX
+// and above, SSE is always there on x64
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX 1
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE 1
+#endif
+
+
+// six planes (a, b, c, d), a point p is inside a plane when dot(abc, p) + d >= 0.
+// The planes are not normalized, only the sign of the distance is used
+struct Frustum
+{
+	glm::vec4 planes[6]{};
+
+	// planes of a projection * view (* model) matrix, in the space the matrix maps from
+	static Frustum fromMatrix(const glm::mat4& clip);
+
+	// the same frustum in the space toWorld maps from (e.g. model space)
+	Frustum transformed(const glm::mat4& toWorld) const;
+};
+
+
+// boxes tested / not culled, for the stats panel
+struct CullStats
+{
+	unsigned int tested{};
+	unsigned int visible{};
+	unsigned int nodes{};		// hierarchy nodes visited, 0 for a flat test
+	unsigned int occluded{};	// inside the frustum but hidden behind occluders
+
+	// model space box around the visible boxes, min > max when nothing is visible
+	glm::vec3 boundsMin{ std::numeric_limits<float>::max() };
+	glm::vec3 boundsMax{ -std::numeric_limits<float>::max() };
+};
+
+
+// Axis aligned boxes stored as separate center / extent arrays, so the plane
+// test loads the same component of 4 (SSE) or 8 (AVX) boxes at once
+class CullingBounds
+{
+private:
+	std::vector<float> m_centerX{};
+	std::vector<float> m_centerY{};
+	std::vector<float> m_centerZ{};
+	std::vector<float> m_extentX{};
+	std::vector<float> m_extentY{};
+	std::vector<float> m_extentZ{};
+
+public:
+	void clear();
+	void add(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+	void set(std::size_t index, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	std::size_t size() const { return m_centerX.size(); }
+
+	// visible[i] = 1 if box i is at least partly inside the frustum. Boxes that only
+	// straddle two planes outside a corner are kept, the test is conservative
+	CullStats cull(const Frustum& frustum, std::vector<std::uint8_t>& visible) const;
+
+	// the same for boxes [begin, end) only, visible[0] belongs to box begin
+	void cull(const Frustum& frustum, std::size_t begin, std::size_t end, std::uint8_t* visible) const;
+};
+
+
+// box of the eight corners of a box after a transform
+inline void transformBounds(const glm::mat4& transform, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	glm::vec3 center{ (boundsMin + boundsMax) * 0.5f };
+	glm::vec3 extent{ (boundsMax - boundsMin) * 0.5f };
+
+	glm::vec3 newCenter{ transform * glm::vec4(center, 1.0f) };
+	glm::mat3 absolute{ transform };
+	for (int column{ 0 }; column < 3; ++column)
+		absolute[column] = glm::abs(absolute[column]);
+	glm::vec3 newExtent{ absolute * extent };
+
+	boundsMin = newCenter - newExtent;
+	boundsMax = newCenter + newExtent;
+}
+
+
+Frustum Frustum::fromMatrix(const glm::mat4& clip)
+{
+	// rows of the matrix, glm stores columns
+	glm::vec4 row[4]{};
+	for (int i{ 0 }; i < 4; ++i)
+		row[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+
+	Frustum frustum{};
+	frustum.planes[0] = row[3] + row[0];	// left
+	frustum.planes[1] = row[3] - row[0];	// right
+	frustum.planes[2] = row[3] + row[1];	// bottom
+	frustum.planes[3] = row[3] - row[1];	// top
+	frustum.planes[4] = row[3] + row[2];	// near
+	frustum.planes[5] = row[3] - row[2];	// far
+	return frustum;
+}
+
+
+Frustum Frustum::transformed(const glm::mat4& toWorld) const
+{
+	// dot(plane, M * p) == dot(transpose(M) * plane, p)
+	glm::mat4 transposed{ glm::transpose(toWorld) };
+
+	Frustum frustum{};
+	for (int i{ 0 }; i < 6; ++i)
+		frustum.planes[i] = transposed * planes[i];
+	return frustum;
+}
+
+
+void CullingBounds::clear()
+{
+	m_centerX.clear();
+	m_centerY.clear();
+	m_centerZ.clear();
+	m_extentX.clear();
+	m_extentY.clear();
+	m_extentZ.clear();
+}
+
+
+void CullingBounds::add(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center{ (boundsMin + boundsMax) * 0.5f };
+	glm::vec3 extent{ (boundsMax - boundsMin) * 0.5f };
+
+	m_centerX.push_back(center.x);
+	m_centerY.push_back(center.y);
+	m_centerZ.push_back(center.z);
+	m_extentX.push_back(extent.x);
+	m_extentY.push_back(extent.y);
+	m_extentZ.push_back(extent.z);
+}
+
+
+void CullingBounds::set(std::size_t index, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center{ (boundsMin + boundsMax) * 0.5f };
+	glm::vec3 extent{ (boundsMax - boundsMin) * 0.5f };
+
+	m_centerX[index] = center.x;
+	m_centerY[index] = center.y;
+	m_centerZ[index] = center.z;
+	m_extentX[index] = extent.x;
+	m_extentY[index] = extent.y;
+	m_extentZ[index] = extent.z;
+}
+
+
+CullStats CullingBounds::cull(const Frustum& frustum, std::vector<std::uint8_t>& visible) const
+{
+	visible.resize(size());
+	cull(frustum, 0, size(), visible.data());
+
+	CullStats stats{};
+	stats.tested = static_cast<unsigned int>(size());
+	for (std::uint8_t flag : visible)
+		stats.visible += flag;
+	return stats;
+}
+
+
+void CullingBounds::cull(const Frustum& frustum, std::size_t begin, std::size_t end, std::uint8_t* visible) const
+{
+	// a box is outside when even its corner furthest along the plane normal is
+	// behind the plane: dot(n, center) + d + dot(|n|, extent) < 0
+	std::size_t i{ begin };
+
+#if defined(CULLING_AVX)
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 centerX{ _mm256_loadu_ps(&m_centerX[i]) };
+		__m256 centerY{ _mm256_loadu_ps(&m_centerY[i]) };
+		__m256 centerZ{ _mm256_loadu_ps(&m_centerZ[i]) };
+		__m256 extentX{ _mm256_loadu_ps(&m_extentX[i]) };
+		__m256 extentY{ _mm256_loadu_ps(&m_extentY[i]) };
+		__m256 extentZ{ _mm256_loadu_ps(&m_extentZ[i]) };
+		__m256 outside{ _mm256_setzero_ps() };
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m256 distance{ _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), centerX), _mm256_mul_ps(_mm256_set1_ps(plane.y), centerY)),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), centerZ), _mm256_set1_ps(plane.w))) };
+			__m256 radius{ _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), extentX),
+					_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), extentY)),
+				_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), extentZ)) };
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		int mask{ _mm256_movemask_ps(outside) };
+		for (int lane{ 0 }; lane < 8; ++lane)
+			visible[i - begin + lane] = ((mask >> lane) & 1) ? 0 : 1;
+	}
+#elif defined(CULLING_SSE)
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 centerX{ _mm_loadu_ps(&m_centerX[i]) };
+		__m128 centerY{ _mm_loadu_ps(&m_centerY[i]) };
+		__m128 centerZ{ _mm_loadu_ps(&m_centerZ[i]) };
+		__m128 extentX{ _mm_loadu_ps(&m_extentX[i]) };
+		__m128 extentY{ _mm_loadu_ps(&m_extentY[i]) };
+		__m128 extentZ{ _mm_loadu_ps(&m_extentZ[i]) };
+		__m128 outside{ _mm_setzero_ps() };
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m128 distance{ _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), centerX), _mm_mul_ps(_mm_set1_ps(plane.y), centerY)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), centerZ), _mm_set1_ps(plane.w))) };
+			__m128 radius{ _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), extentX),
+					_mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), extentY)),
+				_mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), extentZ)) };
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+
+		int mask{ _mm_movemask_ps(outside) };
+		for (int lane{ 0 }; lane < 4; ++lane)
+			visible[i - begin + lane] = ((mask >> lane) & 1) ? 0 : 1;
+	}
+#endif
+
+	// the boxes left over after the last full vector (all of them without SIMD)
+	for (; i < end; ++i)
+	{
+		bool outside{ false };
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			float distance{ plane.x * m_centerX[i] + plane.y * m_centerY[i] + plane.z * m_centerZ[i] + plane.w };
+			float radius{ std::abs(plane.x) * m_extentX[i] + std::abs(plane.y) * m_extentY[i]
+				+ std::abs(plane.z) * m_extentZ[i] };
+			outside = outside || distance + radius < 0.0f;
+		}
+		visible[i - begin] = outside ? 0 : 1;
+	}
+}
+
+#endif // !CULLING_H
@@ -0,0 +1,412 @@
+#pragma once
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "Lights.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+
+// texture units the lighting shaders read the G-buffer from, above the material
+// and shadow map units (Mesh.h)
+constexpr unsigned int GBUFFER_ALBEDO_TEXTURE_UNIT{ 8 };
+constexpr unsigned int GBUFFER_NORMAL_TEXTURE_UNIT{ 9 };
+constexpr unsigned int GBUFFER_DEPTH_TEXTURE_UNIT{ 10 };
+
+
+// the camera flashlight, drawn as a cone from position along direction
+struct SpotLightVolume
+{
+	glm::vec3 position{};
+	glm::vec3 direction{ 0.0f, 0.0f, -1.0f };
+	float range{};
+	float outerCutOff{};	// cosine of the outer cone angle
+};
+
+
+// Deferred shading: the opaque pass writes a compact G-buffer, then lighting
+// runs once per lit pixel instead of once per light and fragment.
+//  - albedo RGBA8 (a: shininess / 256), octahedral normal RG16F and a
+//    depth / stencil texture the world position is rebuilt from, 12 bytes a pixel
+//  - the directional light and its shadow in one fullscreen triangle
+//  - point lights as instanced spheres and the spot light as a cone, their back
+//    faces depth tested with GL_GEQUAL so only pixels in front of the volume's
+//    far side are shaded, added up with blending
+// The scene depth is copied to the default framebuffer for what is drawn after.
+// The three lighting shaders come in the same variants as model.fs, BLINN picks
+// the specular term. GL thread only
+class DeferredRenderer
+{
+private:
+	GLFramebuffer m_framebuffer{};
+	GLTexture m_albedo{};
+	GLTexture m_normal{};
+	GLTexture m_depth{};
+	int m_width{};
+	int m_height{};
+
+	// the fullscreen triangle comes from gl_VertexID, GL still wants a VAO bound
+	GLVertexArray m_emptyVAO{};
+
+	GLVertexArray m_sphereVAO{};
+	GLBuffer m_sphereVBO{};
+	GLBuffer m_sphereEBO{};
+	GLsizei m_sphereIndexCount{};
+
+	GLVertexArray m_coneVAO{};
+	GLBuffer m_coneVBO{};
+	GLBuffer m_coneEBO{};
+	GLsizei m_coneIndexCount{};
+
+	PointLightBuffer m_pointLights{ "deferred point lights" };
+
+	ShaderVariants& m_directionalShaders;
+	ShaderVariants& m_pointShaders;
+	ShaderVariants& m_spotShaders;
+
+	// the lighting shaders of one variant key and their uniforms. Looked up on the
+	// first shade() with the key, there are only ever a couple of them
+	struct Lighting
+	{
+		ShaderVariants::Key key{};
+		const Shader* directional{};
+		const Shader* point{};
+		const Shader* spot{};
+		Uniform<glm::mat4> directionalInverse{};
+		Uniform<glm::mat4> pointInverse{};
+		Uniform<glm::vec2> pointScreen{};
+		Uniform<glm::mat4> spotInverse{};
+		Uniform<glm::vec2> spotScreen{};
+		Uniform<glm::mat4> spotVolume{};
+	};
+
+	std::vector<Lighting> m_lighting{};
+
+	const Lighting& lighting(ShaderVariants::Key key);
+
+	void createTargets();
+
+	// vertices at location 0, triangles wound counter-clockwise seen from outside
+	static GLsizei createVolume(GLVertexArray& vao, GLBuffer& vbo, GLBuffer& ebo,
+		const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices, const char* label);
+	void createSphere();
+	void createCone();
+
+public:
+	// directional draws the fullscreen triangle (deferred.vs), point the instanced
+	// spheres (deferredPoint.vs), spot the cone (deferredSpot.vs). Their variants
+	// must be set up with bindSamplers()
+	DeferredRenderer(int width, int height, ShaderVariants& directional, ShaderVariants& point,
+		ShaderVariants& spot);
+
+	// point the G-buffer and shadow map samplers of a lighting shader at their units
+	static void bindSamplers(const Shader& shader);
+
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+	void resize(int width, int height);
+
+	// bind and clear the G-buffer, the opaque pass (gbuffer.fs) draws into it next
+	void beginGeometry();
+
+	// point lights of the next shade(), including their range
+	std::vector<GpuPointLight>& pointLights() { return m_pointLights.lights(); }
+
+	// light the G-buffer into the default framebuffer. The shadow map must be bound
+	// at SHADOW_MAP_TEXTURE_UNIT and the uniform blocks filled. The point lights'
+	// ambient terms come from the lights block. key selects the shader variants
+	void shade(const glm::mat4& view, const glm::mat4& projection, const SpotLightVolume& spot,
+		ShaderVariants::Key key);
+
+	std::size_t pointLightCount() const { return m_pointLights.size(); }
+};
+
+
+DeferredRenderer::DeferredRenderer(int width, int height, ShaderVariants& directional, ShaderVariants& point,
+	ShaderVariants& spot)
+	: m_width{ width }, m_height{ height }, m_emptyVAO{ GLVertexArray::create() },
+	m_directionalShaders{ directional }, m_pointShaders{ point }, m_spotShaders{ spot }
+{
+	createTargets();
+	createSphere();
+	createCone();
+	m_pointLights.attach(m_sphereVAO);
+	glState().bindVertexArray(0);
+}
+
+
+const DeferredRenderer::Lighting& DeferredRenderer::lighting(ShaderVariants::Key key)
+{
+	for (const Lighting& found : m_lighting)
+	{
+		if (found.key == key)
+			return found;
+	}
+
+	Lighting added{};
+	added.key = key;
+	added.directional = &m_directionalShaders.get(key).shader;
+	added.point = &m_pointShaders.get(key).shader;
+	added.spot = &m_spotShaders.get(key).shader;
+	added.directionalInverse = added.directional->uniform<glm::mat4>("inverseViewProjection");
+	added.pointInverse = added.point->uniform<glm::mat4>("inverseViewProjection");
+	added.pointScreen = added.point->uniform<glm::vec2>("screenSize");
+	added.spotInverse = added.spot->uniform<glm::mat4>("inverseViewProjection");
+	added.spotScreen = added.spot->uniform<glm::vec2>("screenSize");
+	added.spotVolume = added.spot->uniform<glm::mat4>("volume");
+	m_lighting.push_back(added);
+	return m_lighting.back();
+}
+
+
+void DeferredRenderer::bindSamplers(const Shader& shader)
+{
+	shader.use();
+	shader.set(shader.findUniform<int>("gAlbedo"), GBUFFER_ALBEDO_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("gNormal"), GBUFFER_NORMAL_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("gDepth"), GBUFFER_DEPTH_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("shadowMap"), SHADOW_MAP_TEXTURE_UNIT);
+}
+
+
+void DeferredRenderer::createTargets()
+{
+	m_framebuffer = GLFramebuffer::create();
+	m_albedo = GLTexture::create();
+	m_normal = GLTexture::create();
+	m_depth = GLTexture::create();
+
+	struct Target
+	{
+		unsigned int texture;
+		GLint internalFormat;
+		GLenum format;
+		GLenum type;
+		GLenum attachment;
+		const char* label;
+	};
+	const Target targets[]{
+		{ m_albedo, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0, "G-buffer albedo" },
+		{ m_normal, GL_RG16F, GL_RG, GL_HALF_FLOAT, GL_COLOR_ATTACHMENT1, "G-buffer normal" },
+		{ m_depth, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT,
+			"G-buffer depth" },
+	};
+
+	glState().bindFramebuffer(m_framebuffer);
+	for (const Target& target : targets)
+	{
+		glBindTexture(GL_TEXTURE_2D, target.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, target.internalFormat, m_width, m_height, 0, target.format, target.type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, target.attachment, GL_TEXTURE_2D, target.texture, 0);
+
+		// every target is 4 bytes a pixel
+		gpuMemory().track(GLObjectType::Texture, target.texture, MemoryCategory::RenderTargets, 0, target.label,
+			static_cast<std::size_t>(m_width) * m_height * 4);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	const GLenum drawBuffers[]{ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::DEFERRED::G-buffer framebuffer is not complete\n";
+	glState().bindFramebuffer(0);
+}
+
+
+void DeferredRenderer::resize(int width, int height)
+{
+	if (width == m_width && height == m_height)
+		return;
+
+	m_width = width;
+	m_height = height;
+	createTargets();
+}
+
+
+GLsizei DeferredRenderer::createVolume(GLVertexArray& vao, GLBuffer& vbo, GLBuffer& ebo,
+	const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices, const char* label)
+{
+	vao = GLVertexArray::create();
+	vbo = GLBuffer::create();
+	ebo = GLBuffer::create();
+
+	glState().bindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+	gpuMemory().track(GLObjectType::Buffer, vbo, MemoryCategory::SceneGeometry, 0, label,
+		vertices.size() * sizeof(glm::vec3));
+	gpuMemory().track(GLObjectType::Buffer, ebo, MemoryCategory::SceneGeometry, 0, label,
+		indices.size() * sizeof(unsigned int));
+	return static_cast<GLsizei>(indices.size());
+}
+
+
+void DeferredRenderer::createSphere()
+{
+	// latitude / longitude sphere pushed out so its flat faces enclose the unit sphere
+	constexpr unsigned int SLICES{ 16 };
+	constexpr unsigned int STACKS{ 8 };
+	const float pi{ 3.14159265f };
+	float scale{ 1.0f / (std::cos(pi / SLICES) * std::cos(pi / STACKS)) };
+
+	std::vector<glm::vec3> vertices{};
+	for (unsigned int stack{ 0 }; stack <= STACKS; ++stack)
+	{
+		float polar{ pi * stack / STACKS };
+		for (unsigned int slice{ 0 }; slice <= SLICES; ++slice)
+		{
+			float azimuth{ 2.0f * pi * slice / SLICES };
+			vertices.push_back(scale * glm::vec3(std::sin(polar) * std::cos(azimuth), std::cos(polar),
+				-std::sin(polar) * std::sin(azimuth)));
+		}
+	}
+
+	std::vector<unsigned int> indices{};
+	for (unsigned int stack{ 0 }; stack < STACKS; ++stack)
+	{
+		for (unsigned int slice{ 0 }; slice < SLICES; ++slice)
+		{
+			unsigned int top{ stack * (SLICES + 1) + slice };
+			unsigned int bottom{ top + SLICES + 1 };
+			indices.insert(indices.end(), { top, bottom, top + 1, top + 1, bottom, bottom + 1 });
+		}
+	}
+
+	m_sphereIndexCount = createVolume(m_sphereVAO, m_sphereVBO, m_sphereEBO, vertices, indices, "light sphere");
+}
+
+
+void DeferredRenderer::createCone()
+{
+	// apex at the origin, opening along -z to a base of radius 1 at z = -1,
+	// pushed out so the flat sides enclose the round cone
+	constexpr unsigned int SEGMENTS{ 16 };
+	const float pi{ 3.14159265f };
+	float scale{ 1.0f / std::cos(pi / SEGMENTS) };
+
+	std::vector<glm::vec3> vertices{ glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	for (unsigned int i{ 0 }; i < SEGMENTS; ++i)
+	{
+		float angle{ 2.0f * pi * i / SEGMENTS };
+		vertices.push_back(glm::vec3(scale * std::cos(angle), scale * std::sin(angle), -1.0f));
+	}
+
+	std::vector<unsigned int> indices{};
+	for (unsigned int i{ 0 }; i < SEGMENTS; ++i)
+	{
+		unsigned int current{ 2 + i };
+		unsigned int next{ 2 + (i + 1) % SEGMENTS };
+		indices.insert(indices.end(), { 0, current, next });	// side
+		indices.insert(indices.end(), { 1, next, current });	// base
+	}
+
+	m_coneIndexCount = createVolume(m_coneVAO, m_coneVBO, m_coneEBO, vertices, indices, "light cone");
+}
+
+
+void DeferredRenderer::beginGeometry()
+{
+	glState().bindFramebuffer(m_framebuffer);
+	glState().viewport(0, 0, m_width, m_height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+
+void DeferredRenderer::shade(const glm::mat4& view, const glm::mat4& projection, const SpotLightVolume& spot,
+	ShaderVariants::Key key)
+{
+	const Lighting& shaders{ lighting(key) };
+	glm::mat4 inverseViewProjection{ glm::inverse(projection * view) };
+	glm::vec2 screenSize{ static_cast<float>(m_width), static_cast<float>(m_height) };
+
+	// the scene depth goes to the default framebuffer first, the volumes test
+	// against it and whatever is drawn after the lighting needs it anyway
+	glState().bindFramebuffer(0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	glState().bindTexture(GBUFFER_ALBEDO_TEXTURE_UNIT, GL_TEXTURE_2D, m_albedo);
+	glState().bindTexture(GBUFFER_NORMAL_TEXTURE_UNIT, GL_TEXTURE_2D, m_normal);
+	glState().bindTexture(GBUFFER_DEPTH_TEXTURE_UNIT, GL_TEXTURE_2D, m_depth);
+	glState().depthMask(false);
+
+	// directional light, shadow and ambient: every covered pixel once
+	glState().enable(GL_DEPTH_TEST, false);
+	shaders.directional->use();
+	shaders.directional->set(shaders.directionalInverse, inverseViewProjection);
+	glState().bindVertexArray(m_emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// local lights add up on top. The far side of a volume works with the camera
+	// inside it too, GL_GEQUAL keeps the pixels whose surface lies in front of it
+	glState().enable(GL_DEPTH_TEST, true);
+	glState().depthFunc(GL_GEQUAL);
+	glState().enable(GL_CULL_FACE, true);
+	glState().cullFace(GL_FRONT);
+	glState().enable(GL_BLEND, true);
+	glState().blendFunc(GL_ONE, GL_ONE);
+
+	if (!m_pointLights.lights().empty())
+	{
+		m_pointLights.upload();
+		shaders.point->use();
+		shaders.point->set(shaders.pointInverse, inverseViewProjection);
+		shaders.point->set(shaders.pointScreen, screenSize);
+		glState().bindVertexArray(m_sphereVAO);
+		glDrawElementsInstanced(GL_TRIANGLES, m_sphereIndexCount, GL_UNSIGNED_INT, 0,
+			static_cast<GLsizei>(m_pointLights.size()));
+	}
+
+	if (spot.range > 0.0f && spot.outerCutOff > 0.0f)
+	{
+		// the unit cone stretched to the range and the outer angle, -z turned onto direction
+		glm::vec3 axis{ glm::normalize(-spot.direction) };
+		glm::vec3 up{ std::abs(axis.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f) };
+		glm::vec3 side{ glm::normalize(glm::cross(up, axis)) };
+		up = glm::cross(axis, side);
+
+		float radius{ spot.range * std::sqrt(1.0f - spot.outerCutOff * spot.outerCutOff) / spot.outerCutOff };
+		glm::mat4 volume{ glm::vec4(side * radius, 0.0f), glm::vec4(up * radius, 0.0f),
+			glm::vec4(axis * spot.range, 0.0f), glm::vec4(spot.position, 1.0f) };
+
+		shaders.spot->use();
+		shaders.spot->set(shaders.spotInverse, inverseViewProjection);
+		shaders.spot->set(shaders.spotScreen, screenSize);
+		shaders.spot->set(shaders.spotVolume, volume);
+		glState().bindVertexArray(m_coneVAO);
+		glDrawElements(GL_TRIANGLES, m_coneIndexCount, GL_UNSIGNED_INT, 0);
+	}
+
+	glState().enable(GL_BLEND, false);
+	glState().enable(GL_CULL_FACE, false);
+	glState().cullFace(GL_BACK);
+	glState().depthFunc(GL_LESS);
+	glState().depthMask(true);
+}
+
+#endif // !DEFERRED_RENDERER_H
@@ -0,0 +1,140 @@
+#pragma once
+#ifndef FRAGMENT_COUNTER_H
+#define FRAGMENT_COUNTER_H
+
+#include <glad/glad.h>
+#include "GLHandle.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+
+// ARB_pipeline_statistics_query, core in 4.6. glad is generated for 3.3
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+
+// Counts the fragment shader invocations of one pass per frame, to see what
+// overdraw costs. The answers are read a few frames late and never waited for.
+// Without pipeline statistics queries it falls back to GL_SAMPLES_PASSED, the
+// samples that passed the depth test: the same number as long as the driver
+// rejects hidden fragments before shading them.
+// Every measurement carries a tag (e.g. which mode the pass ran in) and the
+// latest result is kept per tag, so two modes can be compared after switching.
+// GL thread only
+class FragmentCounter
+{
+public:
+	static constexpr unsigned int TAG_COUNT{ 4 };
+
+private:
+	// queries in flight, a frame's query is usually done two or three frames later
+	static constexpr std::size_t LATENCY{ 4 };
+
+	struct Slot
+	{
+		GLQuery query{};
+		unsigned int tag{};
+		bool pending{ false };
+	};
+
+	std::array<Slot, LATENCY> m_slots{};
+	std::size_t m_next{};
+	bool m_active{ false };
+
+	GLenum m_target{ GL_SAMPLES_PASSED };
+	std::array<std::uint64_t, TAG_COUNT> m_latest{};
+	std::array<bool, TAG_COUNT> m_measured{};
+
+	void collect();
+
+public:
+	FragmentCounter();
+
+	FragmentCounter(const FragmentCounter&) = delete;
+	FragmentCounter& operator=(const FragmentCounter&) = delete;
+
+	// around the draws to count. Frames whose query slot is still busy go uncounted
+	void begin(unsigned int tag);
+	void end();
+
+	// true: fragment shader invocations, false: samples passed
+	bool invocations() const { return m_target == GL_FRAGMENT_SHADER_INVOCATIONS_ARB; }
+
+	bool measured(unsigned int tag) const { return m_measured[tag]; }
+	std::uint64_t latest(unsigned int tag) const { return m_latest[tag]; }
+};
+
+
+FragmentCounter::FragmentCounter()
+{
+	GLint major{};
+	GLint minor{};
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	bool statistics{ major > 4 || (major == 4 && minor >= 6) };
+	GLint count{};
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i{ 0 }; i < count && !statistics; ++i)
+	{
+		const char* name{ reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)) };
+		statistics = std::strcmp(name, "GL_ARB_pipeline_statistics_query") == 0;
+	}
+
+	if (statistics)
+		m_target = GL_FRAGMENT_SHADER_INVOCATIONS_ARB;
+}
+
+
+void FragmentCounter::collect()
+{
+	for (Slot& slot : m_slots)
+	{
+		if (!slot.pending)
+			continue;
+
+		GLuint available{};
+		glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		GLuint64 result{};
+		glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &result);
+		slot.pending = false;
+		m_latest[slot.tag] = result;
+		m_measured[slot.tag] = true;
+	}
+}
+
+
+void FragmentCounter::begin(unsigned int tag)
+{
+	collect();
+
+	Slot& slot{ m_slots[m_next] };
+	if (slot.pending)
+		return;
+
+	if (!slot.query)
+		slot.query = GLQuery::create();
+	slot.tag = tag % TAG_COUNT;
+	glBeginQuery(m_target, slot.query);
+	m_active = true;
+}
+
+
+void FragmentCounter::end()
+{
+	if (!m_active)
+		return;
+
+	glEndQuery(m_target);
+	m_slots[m_next].pending = true;
+	m_next = (m_next + 1) % LATENCY;
+	m_active = false;
+}
+
+#endif // !FRAGMENT_COUNTER_H
@@ -0,0 +1,225 @@
+#pragma once
+#ifndef GL_HANDLE_H
+#define GL_HANDLE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+
+enum class GLObjectType
+{
+	Buffer,
+	VertexArray,
+	Texture,
+	Framebuffer,
+	Program,
+	Query,
+	Count,
+};
+
+
+// creation / deletion functions for every GL object type
+template <GLObjectType Type>
+struct GLObjectTraits;
+
+template <>
+struct GLObjectTraits<GLObjectType::Buffer>
+{
+	static constexpr const char* name{ "buffers" };
+	static unsigned int create() { unsigned int id{}; glGenBuffers(1, &id); return id; }
+	static void destroy(unsigned int id) { glDeleteBuffers(1, &id); }
+};
+
+template <>
+struct GLObjectTraits<GLObjectType::VertexArray>
+{
+	static constexpr const char* name{ "vertex arrays" };
+	static unsigned int create() { unsigned int id{}; glGenVertexArrays(1, &id); return id; }
+	static void destroy(unsigned int id) { glDeleteVertexArrays(1, &id); }
+};
+
+template <>
+struct GLObjectTraits<GLObjectType::Texture>
+{
+	static constexpr const char* name{ "textures" };
+	static unsigned int create() { unsigned int id{}; glGenTextures(1, &id); return id; }
+	static void destroy(unsigned int id) { glDeleteTextures(1, &id); }
+};
+
+template <>
+struct GLObjectTraits<GLObjectType::Framebuffer>
+{
+	static constexpr const char* name{ "framebuffers" };
+	static unsigned int create() { unsigned int id{}; glGenFramebuffers(1, &id); return id; }
+	static void destroy(unsigned int id) { glDeleteFramebuffers(1, &id); }
+};
+
+template <>
+struct GLObjectTraits<GLObjectType::Program>
+{
+	static constexpr const char* name{ "programs" };
+	static unsigned int create() { return glCreateProgram(); }
+	static void destroy(unsigned int id) { glDeleteProgram(id); }
+};
+
+template <>
+struct GLObjectTraits<GLObjectType::Query>
+{
+	static constexpr const char* name{ "queries" };
+	static unsigned int create() { unsigned int id{}; glGenQueries(1, &id); return id; }
+	static void destroy(unsigned int id) { glDeleteQueries(1, &id); }
+};
+
+
+// Keeps track of every GL object currently owned by a GLHandle, so leaks show up
+// at shutdown instead of as slowly growing VRAM usage. GL thread only
+class GLObjectRegistry
+{
+private:
+	std::unordered_set<unsigned int> m_live[static_cast<int>(GLObjectType::Count)]{};
+
+	// called for every deleted object, lets other bookkeeping (memory ledger,
+	// state cache) follow along
+	using RemoveCallback = void (*)(GLObjectType, unsigned int);
+	std::vector<RemoveCallback> m_onRemove{};
+
+public:
+	void add(GLObjectType type, unsigned int id) { m_live[static_cast<int>(type)].insert(id); }
+
+	void remove(GLObjectType type, unsigned int id)
+	{
+		m_live[static_cast<int>(type)].erase(id);
+		for (RemoveCallback callback : m_onRemove)
+			callback(type, id);
+	}
+
+	void addRemoveCallback(RemoveCallback callback) { m_onRemove.push_back(callback); }
+
+	std::size_t liveCount(GLObjectType type) const { return m_live[static_cast<int>(type)].size(); }
+
+	std::size_t liveCount() const
+	{
+		std::size_t total{};
+		for (const auto& live : m_live)
+			total += live.size();
+		return total;
+	}
+
+	// print every object that is still alive, returns how many there were
+	std::size_t report() const;
+};
+
+
+inline GLObjectRegistry& glObjects()
+{
+	static GLObjectRegistry registry{};
+	return registry;
+}
+
+
+// Move-only owner of one GL object name. The object is deleted when the handle
+// is destroyed or reset. Converts to the raw name so it can go straight into GL calls
+template <GLObjectType Type>
+class GLHandle
+{
+private:
+	unsigned int m_id{};
+
+	explicit GLHandle(unsigned int id)
+		: m_id{ id }
+	{
+		if (m_id)
+			glObjects().add(Type, m_id);
+	}
+
+public:
+	GLHandle() = default;
+
+	// generate a new object
+	static GLHandle create() { return GLHandle{ GLObjectTraits<Type>::create() }; }
+
+	// take ownership of a name created elsewhere
+	static GLHandle adopt(unsigned int id) { return GLHandle{ id }; }
+
+	~GLHandle() { reset(); }
+
+	GLHandle(const GLHandle&) = delete;
+	GLHandle& operator=(const GLHandle&) = delete;
+
+	GLHandle(GLHandle&& other) noexcept
+		: m_id{ other.m_id }
+	{
+		other.m_id = 0;
+	}
+
+	GLHandle& operator=(GLHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			m_id = other.m_id;
+			other.m_id = 0;
+		}
+		return *this;
+	}
+
+	void reset()
+	{
+		if (m_id)
+		{
+			glObjects().remove(Type, m_id);
+			GLObjectTraits<Type>::destroy(m_id);
+			m_id = 0;
+		}
+	}
+
+	unsigned int id() const { return m_id; }
+	operator unsigned int() const { return m_id; }
+	explicit operator bool() const { return m_id != 0; }
+};
+
+using GLBuffer = GLHandle<GLObjectType::Buffer>;
+using GLVertexArray = GLHandle<GLObjectType::VertexArray>;
+using GLTexture = GLHandle<GLObjectType::Texture>;
+using GLFramebuffer = GLHandle<GLObjectType::Framebuffer>;
+using GLProgram = GLHandle<GLObjectType::Program>;
+using GLQuery = GLHandle<GLObjectType::Query>;
+
+
+std::size_t GLObjectRegistry::report() const
+{
+	const char* names[]{
+		GLObjectTraits<GLObjectType::Buffer>::name,
+		GLObjectTraits<GLObjectType::VertexArray>::name,
+		GLObjectTraits<GLObjectType::Texture>::name,
+		GLObjectTraits<GLObjectType::Framebuffer>::name,
+		GLObjectTraits<GLObjectType::Program>::name,
+		GLObjectTraits<GLObjectType::Query>::name,
+	};
+
+	std::size_t total{ liveCount() };
+	if (total == 0)
+	{
+		std::cout << "GL objects: no leaks\n";
+		return 0;
+	}
+
+	std::cout << "GL objects still alive at shutdown: " << total << '\n';
+	for (int type{ 0 }; type < static_cast<int>(GLObjectType::Count); ++type)
+	{
+		if (m_live[type].empty())
+			continue;
+
+		std::cout << "  " << m_live[type].size() << ' ' << names[type] << ':';
+		for (unsigned int id : m_live[type])
+			std::cout << ' ' << id;
+		std::cout << '\n';
+	}
+
+	return total;
+}
+
+#endif // !GL_HANDLE_H
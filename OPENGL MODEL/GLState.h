@@ -0,0 +1,295 @@
+#pragma once
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+#include "GLHandle.h"
+
+#include <unordered_map>
+
+
+// calls made through the cache in one frame
+struct GLStateStats
+{
+	unsigned int issued{};
+	unsigned int skipped{};
+};
+
+
+// Shadow copy of the GL state the renderer changes, so a call that would set a
+// value that is already current never reaches the driver. GL thread only.
+//
+// Code that changes state behind the cache's back (upload steps, ImGui) must be
+// followed by invalidate(), which forgets everything and lets the next call through
+class GLStateCache
+{
+private:
+	static constexpr unsigned int UNKNOWN{ 0xFFFFFFFFu };
+	static constexpr unsigned int TEXTURE_UNITS{ 16 };
+
+	unsigned int m_program{ UNKNOWN };
+	unsigned int m_vertexArray{ UNKNOWN };
+	unsigned int m_framebuffer{ UNKNOWN };
+	unsigned int m_activeUnit{ UNKNOWN };
+
+	// only the two targets the renderer uses are cached
+	unsigned int m_texture2D[TEXTURE_UNITS]{};
+	unsigned int m_textureCube[TEXTURE_UNITS]{};
+
+	GLenum m_cullFace{ UNKNOWN };
+	GLenum m_depthFunc{ UNKNOWN };
+	unsigned int m_depthMask{ UNKNOWN };
+	unsigned int m_colorMask{ UNKNOWN };		// bit 0 red .. bit 3 alpha
+	GLenum m_blendSource{ UNKNOWN };
+	GLenum m_blendDestination{ UNKNOWN };
+	GLint m_viewport[4]{};
+	bool m_viewportKnown{ false };
+	std::unordered_map<GLenum, bool> m_capabilities{};
+
+	GLStateStats m_frame{};
+	GLStateStats m_lastFrame{};
+
+	// returns true (and counts the call) when value changes, false when it is skipped
+	template <typename T>
+	bool change(T& cached, T value)
+	{
+		if (cached == value)
+		{
+			++m_frame.skipped;
+			return false;
+		}
+		cached = value;
+		++m_frame.issued;
+		return true;
+	}
+
+	void setActiveUnit(unsigned int unit)
+	{
+		if (change(m_activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+public:
+	// hooks into the object registry so deleted objects are forgotten
+	GLStateCache();
+
+	// forget everything, the next call of every kind goes to the driver
+	void invalidate();
+
+	// start counting a new frame, the previous one stays readable through lastFrame()
+	void beginFrame()
+	{
+		m_lastFrame = m_frame;
+		m_frame = GLStateStats{};
+	}
+
+	const GLStateStats& lastFrame() const { return m_lastFrame; }
+
+	// a deleted object is unbound by GL, keep the cache in sync so a new
+	// object reusing the name is not mistaken for the bound one
+	void forget(GLObjectType type, unsigned int id);
+
+	void useProgram(unsigned int program)
+	{
+		if (change(m_program, program))
+			glUseProgram(program);
+	}
+
+	void bindVertexArray(unsigned int vertexArray)
+	{
+		if (change(m_vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	void bindFramebuffer(unsigned int framebuffer)
+	{
+		if (change(m_framebuffer, framebuffer))
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	// bind a texture to a unit, switching the active unit only if the binding changes
+	void bindTexture(unsigned int unit, GLenum target, unsigned int texture);
+
+	void enable(GLenum capability, bool enabled);
+
+	void cullFace(GLenum mode)
+	{
+		if (change(m_cullFace, mode))
+			glCullFace(mode);
+	}
+
+	void depthFunc(GLenum func)
+	{
+		if (change(m_depthFunc, func))
+			glDepthFunc(func);
+	}
+
+	void depthMask(bool write)
+	{
+		if (change(m_depthMask, write ? 1u : 0u))
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+	}
+
+	void colorMask(bool red, bool green, bool blue, bool alpha)
+	{
+		unsigned int mask{ (red ? 1u : 0u) | (green ? 2u : 0u) | (blue ? 4u : 0u) | (alpha ? 8u : 0u) };
+		if (change(m_colorMask, mask))
+			glColorMask(red, green, blue, alpha);
+	}
+
+	void blendFunc(GLenum source, GLenum destination);
+
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+};
+
+
+inline GLStateCache& glState()
+{
+	static GLStateCache cache{};
+	return cache;
+}
+
+
+GLStateCache::GLStateCache()
+{
+	invalidate();
+	glObjects().addRemoveCallback([](GLObjectType type, unsigned int id)
+		{
+			glState().forget(type, id);
+		});
+}
+
+
+void GLStateCache::invalidate()
+{
+	m_program = UNKNOWN;
+	m_vertexArray = UNKNOWN;
+	m_framebuffer = UNKNOWN;
+	m_activeUnit = UNKNOWN;
+
+	for (unsigned int unit{ 0 }; unit < TEXTURE_UNITS; ++unit)
+	{
+		m_texture2D[unit] = UNKNOWN;
+		m_textureCube[unit] = UNKNOWN;
+	}
+
+	m_cullFace = UNKNOWN;
+	m_depthFunc = UNKNOWN;
+	m_depthMask = UNKNOWN;
+	m_colorMask = UNKNOWN;
+	m_blendSource = UNKNOWN;
+	m_blendDestination = UNKNOWN;
+	m_viewportKnown = false;
+	m_capabilities.clear();
+}
+
+
+void GLStateCache::forget(GLObjectType type, unsigned int id)
+{
+	switch (type)
+	{
+	case GLObjectType::Program:
+		if (m_program == id)
+			m_program = UNKNOWN;
+		break;
+	case GLObjectType::VertexArray:
+		if (m_vertexArray == id)
+			m_vertexArray = UNKNOWN;
+		break;
+	case GLObjectType::Framebuffer:
+		if (m_framebuffer == id)
+			m_framebuffer = UNKNOWN;
+		break;
+	case GLObjectType::Texture:
+		for (unsigned int unit{ 0 }; unit < TEXTURE_UNITS; ++unit)
+		{
+			if (m_texture2D[unit] == id)
+				m_texture2D[unit] = UNKNOWN;
+			if (m_textureCube[unit] == id)
+				m_textureCube[unit] = UNKNOWN;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+void GLStateCache::bindTexture(unsigned int unit, GLenum target, unsigned int texture)
+{
+	unsigned int* slot{ nullptr };
+	if (unit < TEXTURE_UNITS && target == GL_TEXTURE_2D)
+		slot = &m_texture2D[unit];
+	else if (unit < TEXTURE_UNITS && target == GL_TEXTURE_CUBE_MAP)
+		slot = &m_textureCube[unit];
+
+	if (slot && *slot == texture)
+	{
+		++m_frame.skipped;
+		return;
+	}
+
+	setActiveUnit(unit);
+	glBindTexture(target, texture);
+	++m_frame.issued;
+
+	if (slot)
+		*slot = texture;
+}
+
+
+void GLStateCache::enable(GLenum capability, bool enabled)
+{
+	auto it{ m_capabilities.find(capability) };
+	if (it != m_capabilities.end() && it->second == enabled)
+	{
+		++m_frame.skipped;
+		return;
+	}
+
+	m_capabilities[capability] = enabled;
+	++m_frame.issued;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination)
+{
+	if (m_blendSource == source && m_blendDestination == destination)
+	{
+		++m_frame.skipped;
+		return;
+	}
+
+	m_blendSource = source;
+	m_blendDestination = destination;
+	++m_frame.issued;
+
+	glBlendFunc(source, destination);
+}
+
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (m_viewportKnown && m_viewport[0] == x && m_viewport[1] == y
+		&& m_viewport[2] == width && m_viewport[3] == height)
+	{
+		++m_frame.skipped;
+		return;
+	}
+
+	m_viewport[0] = x;
+	m_viewport[1] = y;
+	m_viewport[2] = width;
+	m_viewport[3] = height;
+	m_viewportKnown = true;
+	++m_frame.issued;
+
+	glViewport(x, y, width, height);
+}
+
+#endif // !GL_STATE_H
@@ -0,0 +1,360 @@
+#pragma once
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+#include <glad/glad.h>
+#include "GLHandle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// not part of the 3.3 core loader, the values come from the extension specs
+#ifndef GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX 0x9047
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_VBO_FREE_MEMORY_ATI 0x87FB
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+
+// identifies the asset (model, skybox, ...) an upload or allocation belongs to so that
+// all of its pending work can be dropped when the asset goes away. Ids are never reused
+using AssetId = std::uint32_t;
+
+inline AssetId newAssetId()
+{
+	static std::atomic<AssetId> next{ 1 };
+	return next++;
+}
+
+
+enum class MemoryCategory
+{
+	MeshVertices,
+	MeshIndices,
+	MeshInstances,
+	Textures,
+	Cubemap,
+	ShadowMap,
+	RenderTargets,		// G-buffer
+	LightGrid,			// clustered light lists
+	SceneGeometry,		// light cubes, skybox box, ...
+	UniformBuffers,
+	IndirectDraws,		// indirect commands and their per-draw storage buffers
+	UploadStaging,		// PBO ring
+	Ui,					// ImGui atlas and other ImGui textures
+	Count,
+};
+
+inline const char* memoryCategoryName(MemoryCategory category)
+{
+	switch (category)
+	{
+	case MemoryCategory::MeshVertices:	return "mesh vertices";
+	case MemoryCategory::MeshIndices:	return "mesh indices";
+	case MemoryCategory::MeshInstances:	return "mesh instances";
+	case MemoryCategory::Textures:		return "textures";
+	case MemoryCategory::Cubemap:		return "cubemap";
+	case MemoryCategory::ShadowMap:		return "shadow map";
+	case MemoryCategory::RenderTargets:	return "render targets";
+	case MemoryCategory::LightGrid:		return "light grid";
+	case MemoryCategory::SceneGeometry:	return "scene geometry";
+	case MemoryCategory::UniformBuffers:	return "uniform buffers";
+	case MemoryCategory::IndirectDraws:	return "indirect draws";
+	case MemoryCategory::UploadStaging:	return "upload staging";
+	case MemoryCategory::Ui:			return "ui";
+	default:							return "other";
+	}
+}
+
+
+// bytes per texel as the driver is likely to store it. 3 channel 8-bit formats
+// and 24-bit depth are padded to 4 bytes by practically every implementation
+inline std::size_t bytesPerTexel(GLenum format)
+{
+	switch (format)
+	{
+	case GL_RED:
+	case GL_R8:
+		return 1;
+	case GL_RG:
+	case GL_RG8:
+		return 2;
+	case GL_RGBA16F:
+		return 8;
+	case GL_RGBA32F:
+		return 16;
+	default:	// GL_RGB, GL_RGBA, GL_DEPTH_COMPONENT, ...
+		return 4;
+	}
+}
+
+// size of a 2D image including its full mip chain (if any), times layers / faces
+inline std::size_t textureBytes(int width, int height, GLenum format, bool mipmapped, int layers = 1)
+{
+	std::size_t total{};
+	while (true)
+	{
+		total += static_cast<std::size_t>(width) * height * bytesPerTexel(format);
+		if (!mipmapped || (width == 1 && height == 1))
+			break;
+
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return total * layers;
+}
+
+
+struct MemoryRecord
+{
+	GLObjectType type{};
+	unsigned int id{};
+	MemoryCategory category{};
+	AssetId owner{};
+	std::string label{};
+	std::size_t bytes{};
+};
+
+
+// what the driver reports through GL_NVX_gpu_memory_info / GL_ATI_meminfo
+struct DriverMemoryInfo
+{
+	bool available{ false };
+	const char* source{ "" };
+	std::size_t totalBytes{};		// 0 if the extension does not report it
+	std::size_t freeBytes{};
+};
+
+
+// Central ledger of every buffer and texture allocation we know the size of.
+//
+// Allocations are tracked by (object type, GL name) and dropped automatically when
+// the owning GLHandle deletes the object. Bytes are estimates derived from the
+// allocation parameters, the driver may add padding and alignment on top
+class GpuMemoryLedger
+{
+private:
+	std::map<std::pair<GLObjectType, unsigned int>, MemoryRecord> m_records{};
+	std::unordered_map<AssetId, std::string> m_assetNames{};
+
+	int m_driverQuery{ -1 };	// -1 unknown, 0 none, 1 NVX, 2 ATI
+
+public:
+	// hooks into the object registry so deleting a handle also drops its record
+	GpuMemoryLedger();
+
+	// record (or replace) the allocation of a GL object
+	void track(GLObjectType type, unsigned int id, MemoryCategory category, AssetId owner,
+		const std::string& label, std::size_t bytes)
+	{
+		MemoryRecord& record{ m_records[{ type, id }] };
+		record.type = type;
+		record.id = id;
+		record.category = category;
+		record.owner = owner;
+		record.label = label;
+		record.bytes = bytes;
+	}
+
+	void release(GLObjectType type, unsigned int id) { m_records.erase({ type, id }); }
+
+	// drop every record of a category, for memory we do not own (ImGui) and re-collect
+	void clearCategory(MemoryCategory category)
+	{
+		for (auto it{ m_records.begin() }; it != m_records.end();)
+		{
+			if (it->second.category == category)
+				it = m_records.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void nameAsset(AssetId id, const std::string& name) { m_assetNames[id] = name; }
+
+	std::string assetName(AssetId id) const
+	{
+		auto it{ m_assetNames.find(id) };
+		return it != m_assetNames.end() ? it->second : std::string{ "scene" };
+	}
+
+	std::size_t totalBytes() const
+	{
+		std::size_t total{};
+		for (const auto& entry : m_records)
+			total += entry.second.bytes;
+		return total;
+	}
+
+	std::vector<std::size_t> categoryTotals() const
+	{
+		std::vector<std::size_t> totals(static_cast<int>(MemoryCategory::Count));
+		for (const auto& entry : m_records)
+			totals[static_cast<int>(entry.second.category)] += entry.second.bytes;
+		return totals;
+	}
+
+	std::vector<MemoryRecord> largest(std::size_t count) const;
+
+	DriverMemoryInfo queryDriver();
+
+	// write totals, every resource and the driver budget to a JSON file
+	bool writeJson(const std::string& path);
+};
+
+
+inline GpuMemoryLedger& gpuMemory()
+{
+	static GpuMemoryLedger ledger{};
+	return ledger;
+}
+
+
+GpuMemoryLedger::GpuMemoryLedger()
+{
+	glObjects().addRemoveCallback([](GLObjectType type, unsigned int id)
+		{
+			gpuMemory().release(type, id);
+		});
+}
+
+
+std::vector<MemoryRecord> GpuMemoryLedger::largest(std::size_t count) const
+{
+	std::vector<MemoryRecord> records{};
+	records.reserve(m_records.size());
+	for (const auto& entry : m_records)
+		records.push_back(entry.second);
+
+	count = std::min(count, records.size());
+	std::partial_sort(records.begin(), records.begin() + count, records.end(),
+		[](const MemoryRecord& a, const MemoryRecord& b) { return a.bytes > b.bytes; });
+
+	records.resize(count);
+	return records;
+}
+
+
+DriverMemoryInfo GpuMemoryLedger::queryDriver()
+{
+	if (m_driverQuery < 0)
+	{
+		m_driverQuery = 0;
+
+		GLint count{};
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i{ 0 }; i < count; ++i)
+		{
+			const char* name{ reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)) };
+			if (std::strcmp(name, "GL_NVX_gpu_memory_info") == 0)
+				m_driverQuery = 1;
+			else if (std::strcmp(name, "GL_ATI_meminfo") == 0 && m_driverQuery == 0)
+				m_driverQuery = 2;
+		}
+	}
+
+	DriverMemoryInfo info{};
+
+	// both extensions report kilobytes
+	if (m_driverQuery == 1)
+	{
+		GLint total{}, available{};
+		glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+		glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+
+		info.available = true;
+		info.source = "GL_NVX_gpu_memory_info";
+		info.totalBytes = static_cast<std::size_t>(total) * 1024;
+		info.freeBytes = static_cast<std::size_t>(available) * 1024;
+	}
+	else if (m_driverQuery == 2)
+	{
+		// [0] total free in the pool, the rest are largest block / auxiliary memory
+		GLint textureFree[4]{};
+		glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, textureFree);
+
+		info.available = true;
+		info.source = "GL_ATI_meminfo";
+		info.freeBytes = static_cast<std::size_t>(textureFree[0]) * 1024;
+	}
+
+	return info;
+}
+
+
+inline std::string jsonEscape(const std::string& text)
+{
+	std::string out{};
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+			out += ' ';
+		else
+			out += c;
+	}
+	return out;
+}
+
+
+bool GpuMemoryLedger::writeJson(const std::string& path)
+{
+	std::ofstream file{ path };
+	if (!file)
+		return false;
+
+	const char* typeNames[]{ "buffer", "vertex array", "texture", "framebuffer", "program", "query" };
+	DriverMemoryInfo driver{ queryDriver() };
+	std::vector<std::size_t> totals{ categoryTotals() };
+
+	file << "{\n";
+	file << "  \"totalBytes\": " << totalBytes() << ",\n";
+
+	file << "  \"driver\": { \"available\": " << (driver.available ? "true" : "false")
+		<< ", \"source\": \"" << driver.source << "\", \"totalBytes\": " << driver.totalBytes
+		<< ", \"freeBytes\": " << driver.freeBytes << " },\n";
+
+	file << "  \"categories\": {\n";
+	for (int i{ 0 }; i < static_cast<int>(MemoryCategory::Count); ++i)
+	{
+		file << "    \"" << memoryCategoryName(static_cast<MemoryCategory>(i)) << "\": " << totals[i]
+			<< (i + 1 < static_cast<int>(MemoryCategory::Count) ? ",\n" : "\n");
+	}
+	file << "  },\n";
+
+	file << "  \"resources\": [\n";
+	std::vector<MemoryRecord> records{ largest(m_records.size()) };
+	for (std::size_t i{ 0 }; i < records.size(); ++i)
+	{
+		const MemoryRecord& record{ records[i] };
+		file << "    { \"type\": \"" << typeNames[static_cast<int>(record.type)]
+			<< "\", \"id\": " << record.id
+			<< ", \"category\": \"" << memoryCategoryName(record.category)
+			<< "\", \"owner\": \"" << jsonEscape(assetName(record.owner))
+			<< "\", \"label\": \"" << jsonEscape(record.label)
+			<< "\", \"bytes\": " << record.bytes << " }"
+			<< (i + 1 < records.size() ? ",\n" : "\n");
+	}
+	file << "  ]\n";
+	file << "}\n";
+
+	return true;
+}
+
+#endif // !GPU_MEMORY_H
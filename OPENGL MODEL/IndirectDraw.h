@@ -0,0 +1,408 @@
+#pragma once
+#ifndef INDIRECT_DRAW_H
+#define INDIRECT_DRAW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "Mesh.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+
+// glad is generated for 3.3, the 4.3+ enums and entry points are declared here
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+
+using MultiDrawElementsIndirectProc = void (APIENTRY*)(GLenum mode, GLenum type, const void* indirect,
+	GLsizei drawCount, GLsizei stride);
+
+
+// storage buffer bindings of the indirect shaders (modelIndirect.vs, shadowDepthIndirect.vs)
+constexpr unsigned int DRAW_DATA_BINDING{ 0 };
+constexpr unsigned int TRANSFORMS_BINDING{ 1 };
+constexpr unsigned int INSTANCES_BINDING{ 2 };
+
+
+// what the context offers, filled once by loadIndirectDrawing()
+struct IndirectDrawingSupport
+{
+	bool supported{ false };
+	MultiDrawElementsIndirectProc multiDrawElementsIndirect{ nullptr };
+};
+
+inline IndirectDrawingSupport& indirectDrawing()
+{
+	static IndirectDrawingSupport support{};
+	return support;
+}
+
+// the indirect shaders index their storage buffers with gl_DrawID, which needs
+// GLSL 4.60. Anything older keeps the per-mesh path
+bool loadIndirectDrawing(GLADloadproc load);
+
+
+// layout of one record in GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	GLuint count{};
+	GLuint instanceCount{};
+	GLuint firstIndex{};
+	GLint baseVertex{};
+	GLuint baseInstance{};
+};
+
+// std430 mirror of DrawData in the indirect shaders, one per command. std430
+// packs a struct of two uints tightly, 8 bytes per element
+struct IndirectDrawData
+{
+	GLuint firstInstance{};		// first node transform of the mesh in the instance buffer
+	GLuint transform{};			// model matrix in the transform buffer
+};
+
+static_assert(sizeof(IndirectDrawData) == 8, "DrawData does not match std430");
+
+
+// where a mesh lives inside IndirectGeometry
+struct IndirectMesh
+{
+	GLuint indexCount{};
+	GLuint firstIndex{};
+	GLint baseVertex{};
+	GLuint firstInstance{};
+	GLuint instanceCount{};
+};
+
+
+// Every mesh of a model copied into one vertex, one index and one instance buffer
+// behind a single VAO, the shape multi-draw indirect needs. Built on the GPU with
+// buffer to buffer copies once all mesh uploads are done
+class IndirectGeometry
+{
+private:
+	GLVertexArray m_VAO{};
+	GLBuffer m_vertices{};
+	GLBuffer m_indices{};
+	GLBuffer m_instances{};		// node transforms, read through INSTANCES_BINDING
+	std::vector<IndirectMesh> m_meshes{};
+
+public:
+	IndirectGeometry(const std::vector<Mesh>& meshes, AssetId owner);
+
+	unsigned int vertexArray() const { return m_VAO; }
+	unsigned int instanceBuffer() const { return m_instances; }
+	const IndirectMesh& mesh(std::size_t index) const { return m_meshes[index]; }
+
+	// overwrite one node transform of a mesh, for an instance that moved
+	void setInstance(std::size_t mesh, unsigned int instance, const glm::mat4& transform);
+};
+
+
+// Turns the sorted render queue into indirect commands. Consecutive draws that
+// share program, geometry, model matrix and (outside the shadow pass) material
+// become one glMultiDrawElementsIndirect. Draws without indirect geometry fall
+// back to the per-mesh path in queue order
+class IndirectRenderer
+{
+private:
+	struct Program
+	{
+		const Shader* classic{};
+		const Shader* indirect{};
+		Uniform<int> drawOffset{};
+	};
+
+	struct Batch
+	{
+		RenderPass pass{};
+		const Program* program{};
+		const DrawItem* item{};			// first draw, supplies material and geometry
+		GLsizei firstCommand{};
+		GLsizei commandCount{};			// 0: item is drawn the old way
+	};
+
+	std::vector<Program> m_programs{};
+	std::vector<DrawElementsIndirectCommand> m_commands{};
+	std::vector<IndirectDrawData> m_drawData{};
+	std::vector<Batch> m_batches{};
+
+	GLBuffer m_commandBuffer{ GLBuffer::create() };
+	GLBuffer m_drawDataBuffer{ GLBuffer::create() };
+	GLBuffer m_transformBuffer{ GLBuffer::create() };
+
+	const RenderQueue* m_queue{};
+
+	const Program* findProgram(const Shader* classic) const;
+
+	// replace a buffer's contents, orphaning the old storage
+	static void upload(unsigned int buffer, GLenum target, const void* data, std::size_t bytes, const char* label);
+
+public:
+	// draws queued with classic are executed with indirect, which must read its
+	// per-draw data like modelIndirect.vs
+	void addProgram(const Shader& classic, const Shader& indirect);
+
+	// build the commands of every pass and upload them with the model matrices.
+	// The queue must stay unchanged until the frame's execute() calls are done
+	void prepare(const RenderQueue& queue);
+
+	void execute(RenderPass pass) const;
+
+	std::size_t batchCount() const { return m_batches.size(); }
+	std::size_t commandCount() const { return m_commands.size(); }
+};
+
+
+bool loadIndirectDrawing(GLADloadproc load)
+{
+	IndirectDrawingSupport& support{ indirectDrawing() };
+
+	GLint major{};
+	GLint minor{};
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	if (major < 4 || (major == 4 && minor < 6))
+	{
+		std::cout << "OpenGL " << major << '.' << minor << ": multi-draw indirect disabled\n";
+		return false;
+	}
+
+	support.multiDrawElementsIndirect =
+		reinterpret_cast<MultiDrawElementsIndirectProc>(load("glMultiDrawElementsIndirect"));
+	support.supported = support.multiDrawElementsIndirect != nullptr;
+
+	std::cout << "OpenGL " << major << '.' << minor << ": multi-draw indirect "
+		<< (support.supported ? "enabled\n" : "entry point missing, disabled\n");
+	return support.supported;
+}
+
+
+IndirectGeometry::IndirectGeometry(const std::vector<Mesh>& meshes, AssetId owner)
+	: m_VAO{ GLVertexArray::create() }, m_vertices{ GLBuffer::create() }, m_indices{ GLBuffer::create() },
+	m_instances{ GLBuffer::create() }
+{
+	std::size_t vertexCount{};
+	std::size_t indexCount{};
+	std::vector<glm::mat4> instances{};
+
+	m_meshes.reserve(meshes.size());
+	for (const Mesh& mesh : meshes)
+	{
+		IndirectMesh entry{};
+		entry.indexCount = static_cast<GLuint>(mesh.indices.size());
+		entry.firstIndex = static_cast<GLuint>(indexCount);
+		entry.baseVertex = static_cast<GLint>(vertexCount);
+		entry.firstInstance = static_cast<GLuint>(instances.size());
+		entry.instanceCount = mesh.instanceCount();
+		m_meshes.push_back(entry);
+
+		vertexCount += mesh.vertices.size();
+		indexCount += mesh.indices.size();
+		instances.insert(instances.end(), mesh.instanceTransforms().begin(), mesh.instanceTransforms().end());
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertices);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertexCount * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+	for (std::size_t i{ 0 }; i < meshes.size(); ++i)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, meshes[i].vertexBuffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, m_meshes[i].baseVertex * sizeof(Vertex),
+			meshes[i].vertices.size() * sizeof(Vertex));
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_indices);
+	glBufferData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+	for (std::size_t i{ 0 }; i < meshes.size(); ++i)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, meshes[i].indexBuffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+			m_meshes[i].firstIndex * sizeof(unsigned int), meshes[i].indices.size() * sizeof(unsigned int));
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instances);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	gpuMemory().track(GLObjectType::Buffer, m_vertices, MemoryCategory::MeshVertices, owner, "indirect vertices",
+		vertexCount * sizeof(Vertex));
+	gpuMemory().track(GLObjectType::Buffer, m_indices, MemoryCategory::MeshIndices, owner, "indirect indices",
+		indexCount * sizeof(unsigned int));
+	gpuMemory().track(GLObjectType::Buffer, m_instances, MemoryCategory::MeshInstances, owner, "indirect instances",
+		instances.size() * sizeof(glm::mat4));
+
+	// only positions, normals and uvs, the instances come from the storage buffer
+	glState().bindVertexArray(m_VAO);
+	Mesh::setupVertexAttributes(m_vertices, m_indices);
+}
+
+
+void IndirectGeometry::setInstance(std::size_t mesh, unsigned int instance, const glm::mat4& transform)
+{
+	GLintptr offset{ static_cast<GLintptr>((m_meshes[mesh].firstInstance + instance) * sizeof(glm::mat4)) };
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_instances);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, sizeof(glm::mat4), &transform);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+void IndirectRenderer::addProgram(const Shader& classic, const Shader& indirect)
+{
+	m_programs.push_back({ &classic, &indirect, indirect.uniform<int>("drawOffset") });
+}
+
+
+const IndirectRenderer::Program* IndirectRenderer::findProgram(const Shader* classic) const
+{
+	for (const Program& program : m_programs)
+	{
+		if (program.classic == classic)
+			return &program;
+	}
+	return nullptr;
+}
+
+
+void IndirectRenderer::prepare(const RenderQueue& queue)
+{
+	m_queue = &queue;
+	m_commands.clear();
+	m_drawData.clear();
+	m_batches.clear();
+
+	for (RenderPass pass : { RenderPass::Shadow, RenderPass::DynamicShadow, RenderPass::DepthPrepass,
+		RenderPass::Opaque })
+	{
+		// index of the batch later draws may still join
+		constexpr std::size_t NONE{ ~std::size_t{ 0 } };
+		std::size_t open{ NONE };
+
+		queue.forEach(pass, [&](const DrawItem& item)
+			{
+				const Program* program{ item.geometry ? findProgram(item.shader) : nullptr };
+				if (!program)
+				{
+					m_batches.push_back({ pass, nullptr, &item, 0, 0 });
+					open = NONE;
+					return;
+				}
+
+				// a batch binds its first item's material, depth only passes bind no
+				// textures and their batches may span materials
+				bool joins{ false };
+				if (open != NONE)
+				{
+					const DrawItem& first{ *m_batches[open].item };
+					joins = m_batches[open].program == program && first.geometry == item.geometry
+						&& first.transform == item.transform
+						&& (isDepthOnly(pass) || first.mesh->sameMaterial(*item.mesh));
+				}
+
+				if (!joins)
+				{
+					m_batches.push_back({ pass, program, &item, static_cast<GLsizei>(m_commands.size()), 0 });
+					open = m_batches.size() - 1;
+				}
+
+				const IndirectMesh& mesh{ item.geometry->mesh(item.meshIndex) };
+				m_commands.push_back({ mesh.indexCount, mesh.instanceCount, mesh.firstIndex, mesh.baseVertex, 0 });
+				m_drawData.push_back({ mesh.firstInstance, item.transform });
+				++m_batches[open].commandCount;
+			});
+	}
+
+	upload(m_commandBuffer, GL_DRAW_INDIRECT_BUFFER, m_commands.data(),
+		m_commands.size() * sizeof(DrawElementsIndirectCommand), "indirect commands");
+	upload(m_drawDataBuffer, GL_SHADER_STORAGE_BUFFER, m_drawData.data(),
+		m_drawData.size() * sizeof(IndirectDrawData), "indirect draw data");
+	upload(m_transformBuffer, GL_SHADER_STORAGE_BUFFER, queue.transforms().data(),
+		queue.transforms().size() * sizeof(glm::mat4), "indirect transforms");
+}
+
+
+void IndirectRenderer::upload(unsigned int buffer, GLenum target, const void* data, std::size_t bytes,
+	const char* label)
+{
+	glBindBuffer(target, buffer);
+	glBufferData(target, bytes, bytes ? data : nullptr, GL_STREAM_DRAW);
+	glBindBuffer(target, 0);
+
+	gpuMemory().track(GLObjectType::Buffer, buffer, MemoryCategory::IndirectDraws, 0, label, bytes);
+}
+
+
+void IndirectRenderer::execute(RenderPass pass) const
+{
+	const Shader* classicShader{ nullptr };
+	unsigned int classicTransform{ ~0u };
+	const IndirectGeometry* geometry{ nullptr };
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, m_drawDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORMS_BINDING, m_transformBuffer);
+
+	for (const Batch& batch : m_batches)
+	{
+		if (batch.pass != pass)
+			continue;
+
+		const DrawItem& item{ *batch.item };
+
+		// per-mesh fallback, same calls RenderQueue::execute() makes
+		if (batch.commandCount == 0)
+		{
+			if (item.shader != classicShader)
+			{
+				classicShader = item.shader;
+				classicShader->use();
+				classicTransform = ~0u;
+			}
+			if (item.transform != classicTransform)
+			{
+				classicTransform = item.transform;
+				classicShader->set(item.modelUniform, m_queue->transforms()[classicTransform]);
+			}
+
+			if (isDepthOnly(pass))
+				item.mesh->DrawGeometry();
+			else
+				item.mesh->Draw();
+			continue;
+		}
+
+		classicShader = nullptr;
+		batch.program->indirect->use();
+		batch.program->indirect->set(batch.program->drawOffset, batch.firstCommand);
+
+		if (item.geometry != geometry)
+		{
+			geometry = item.geometry;
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCES_BINDING, geometry->instanceBuffer());
+		}
+
+		if (!isDepthOnly(pass))
+			item.mesh->bindMaterial();
+
+		glState().bindVertexArray(geometry->vertexArray());
+		indirectDrawing().multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(const void*)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)), batch.commandCount, 0);
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+#endif // !INDIRECT_DRAW_H
@@ -0,0 +1,162 @@
+#pragma once
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// attribute locations of the per-instance data, the same slots the mesh
+// instance matrix uses so model.vs can read either
+constexpr unsigned int INSTANCE_MATRIX_LOCATION{ 3 };	// mat4, one column per location 3 - 6
+constexpr unsigned int INSTANCE_COLOR_LOCATION{ 7 };
+
+
+struct InstanceData
+{
+	glm::mat4 transform{ 1.0f };
+	glm::vec4 color{ 1.0f };
+};
+
+
+// CPU list of per-instance data mirrored into one GL buffer. attach() adds the
+// instance attributes to a VAO, after that every instance is drawn with a single
+// call no matter how many there are. Changes reach the GPU on the next upload()
+class InstanceBuffer
+{
+private:
+	GLBuffer m_buffer{};
+	std::vector<InstanceData> m_instances{};
+	std::size_t m_capacity{};		// instances the GL storage has room for
+	bool m_dirty{ false };
+
+	std::string m_label{};
+	MemoryCategory m_category{};
+
+	void allocate(std::size_t capacity);
+
+public:
+	explicit InstanceBuffer(const std::string& label, std::size_t capacity = 16,
+		MemoryCategory category = MemoryCategory::MeshInstances)
+		: m_buffer{ GLBuffer::create() }, m_label{ label }, m_category{ category }
+	{
+		allocate(std::max<std::size_t>(capacity, 1));
+	}
+
+	void clear()
+	{
+		m_instances.clear();
+		m_dirty = true;
+	}
+
+	void resize(std::size_t count)
+	{
+		m_instances.resize(count);
+		m_dirty = true;
+	}
+
+	void add(const glm::mat4& transform, const glm::vec4& color = glm::vec4(1.0f))
+	{
+		m_instances.push_back({ transform, color });
+		m_dirty = true;
+	}
+
+	// write access marks the buffer for the next upload()
+	InstanceData& operator[](std::size_t index)
+	{
+		m_dirty = true;
+		return m_instances[index];
+	}
+
+	const InstanceData& operator[](std::size_t index) const { return m_instances[index]; }
+
+	std::size_t size() const { return m_instances.size(); }
+	bool empty() const { return m_instances.empty(); }
+	unsigned int buffer() const { return m_buffer; }
+
+	// copy the instances to the GPU if anything changed. The storage doubles when
+	// it runs out and is orphaned otherwise, so a draw still reading the old data
+	// never stalls the update
+	void upload();
+
+	// add the instance attributes to vertexArray, which must not use locations 3 - 7
+	// for anything else. Leaves vertexArray bound
+	void attach(unsigned int vertexArray) const;
+
+	// draw every instance of a non indexed / indexed VAO that attach() was called on
+	void drawArrays(unsigned int vertexArray, GLenum mode, GLint first, GLsizei count) const
+	{
+		glState().bindVertexArray(vertexArray);
+		glDrawArraysInstanced(mode, first, count, static_cast<GLsizei>(m_instances.size()));
+	}
+
+	void drawElements(unsigned int vertexArray, GLsizei indexCount) const
+	{
+		glState().bindVertexArray(vertexArray);
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0,
+			static_cast<GLsizei>(m_instances.size()));
+	}
+};
+
+
+void InstanceBuffer::allocate(std::size_t capacity)
+{
+	m_capacity = capacity;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	gpuMemory().track(GLObjectType::Buffer, m_buffer, m_category, 0, m_label, m_capacity * sizeof(InstanceData));
+}
+
+
+void InstanceBuffer::upload()
+{
+	if (!m_dirty)
+		return;
+	m_dirty = false;
+
+	if (m_instances.size() > m_capacity)
+		allocate(std::max(m_instances.size(), m_capacity * 2));
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+	if (!m_instances.empty())
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m_instances.size() * sizeof(InstanceData), m_instances.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void InstanceBuffer::attach(unsigned int vertexArray) const
+{
+	glState().bindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+
+	// divisor 1 advances the attributes once per instance instead of per vertex
+	for (unsigned int i{ 0 }; i < 4; ++i)
+	{
+		unsigned int location{ INSTANCE_MATRIX_LOCATION + i };
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(offsetof(InstanceData, transform) + i * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+
+	glVertexAttribPointer(INSTANCE_COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)offsetof(InstanceData, color));
+	glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+	glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+#endif // !INSTANCE_BUFFER_H
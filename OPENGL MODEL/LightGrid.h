@@ -0,0 +1,648 @@
+#pragma once
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "Lights.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+// texture units model.fs reads the light grid from, above the G-buffer units
+// (DeferredRenderer.h)
+constexpr unsigned int POINT_LIGHT_TEXTURE_UNIT{ 11 };
+constexpr unsigned int SPOT_LIGHT_TEXTURE_UNIT{ 12 };
+constexpr unsigned int LIGHT_CLUSTER_TEXTURE_UNIT{ 13 };
+constexpr unsigned int LIGHT_INDEX_TEXTURE_UNIT{ 14 };
+
+
+// Clustered forward lighting. The view frustum is cut into TILES_X x TILES_Y
+// screen tiles and SLICES depth slices, spaced exponentially so the clusters
+// stay about as deep as they are wide. Every frame each light is tested against
+// the clusters its range reaches and model.fs only loops over the lights of its
+// own cluster, so the cost follows the lights touching a pixel rather than the
+// lights in the scene. Shading stays forward: MSAA and blending work as before.
+// 3.3 has no storage buffers, the GPU side is four texture buffers:
+//  - point lights, each GpuPointLight three RGBA32F texels
+//  - spot lights, each GpuSpotLight five RGBA32F texels
+//  - clusters, RG32UI: x first entry of the index list, y point count | spot count << 16
+//  - light indices, R32UI: per cluster its point lights, then its spot lights
+// build() runs on the calling thread and the render workers, the rest is GL thread only
+class LightGrid
+{
+public:
+	static constexpr unsigned int TILES_X{ 16 };
+	static constexpr unsigned int TILES_Y{ 9 };
+	static constexpr unsigned int SLICES{ 24 };
+	static constexpr unsigned int TILES{ TILES_X * TILES_Y };
+	static constexpr unsigned int CLUSTERS{ TILES * SLICES };
+
+	// both counts share one 32 bit texel
+	static constexpr std::uint32_t MAX_CLUSTER_LIGHTS{ 0xFFFF };
+
+private:
+	// a light in view space and the slices its range reaches, none when
+	// lastSlice < firstSlice
+	struct LightBounds
+	{
+		glm::vec3 position{};
+		float range{};
+		glm::vec3 direction{};		// spot lights only
+		float cosAngle{};			// of the outer cone
+		float sinAngle{};
+		unsigned int firstSlice{};
+		unsigned int lastSlice{};
+	};
+
+	// the lists of one slice, built by whichever worker took it and copied into
+	// the flat arrays once every slice is done
+	struct SliceLists
+	{
+		std::vector<std::uint32_t> hitTiles{};
+		std::vector<std::uint32_t> hitLights{};
+		std::array<std::uint32_t, TILES> points{};
+		std::array<std::uint32_t, TILES> spots{};
+		std::array<std::uint32_t, TILES> first{};
+		std::vector<std::uint32_t> indices{};
+	};
+
+	// a buffer and the texture that reads it as texels of one format
+	struct TextureBuffer
+	{
+		GLBuffer buffer{};
+		GLTexture texture{};
+		std::size_t capacity{};		// bytes
+		const char* label{};
+	};
+
+	// view space box and bounding sphere of every cluster, slice after slice,
+	// stored as separate arrays for the SIMD tests. They only change with the projection
+	std::vector<float> m_minX{};
+	std::vector<float> m_minY{};
+	std::vector<float> m_minZ{};
+	std::vector<float> m_maxX{};
+	std::vector<float> m_maxY{};
+	std::vector<float> m_maxZ{};
+	std::vector<float> m_sphereX{};
+	std::vector<float> m_sphereY{};
+	std::vector<float> m_sphereZ{};
+	std::vector<float> m_sphereRadius{};
+
+	glm::mat4 m_projection{ 0.0f };
+	float m_near{};
+	float m_far{};
+	float m_width{};
+	float m_height{};
+	float m_sliceScale{};
+	float m_sliceBias{};
+
+	std::vector<LightBounds> m_points{};
+	std::vector<LightBounds> m_spots{};
+	std::vector<SliceLists> m_slices{};
+
+	std::vector<std::uint32_t> m_clusters{};	// two per cluster, see above
+	std::vector<std::uint32_t> m_indices{};
+
+	TextureBuffer m_pointLights{};
+	TextureBuffer m_spotLights{};
+	TextureBuffer m_clusterLists{};
+	TextureBuffer m_lightIndices{};
+	std::size_t m_maxTexels{};			// GL_MAX_TEXTURE_BUFFER_SIZE
+
+	unsigned int m_litClusters{};
+	unsigned int m_longestList{};
+	bool m_clipped{ false };
+
+	static void create(TextureBuffer& target, GLenum format, std::size_t bytes, const char* label);
+	static void allocate(TextureBuffer& target, std::size_t bytes);
+	// orphan the old storage and copy, growing it when bytes do not fit
+	static void write(TextureBuffer& target, const void* data, std::size_t bytes);
+
+	// slices between two view depths
+	void reach(float nearest, float farthest, LightBounds& light) const;
+
+	// hit[tile] = 1 for the tiles of slice whose box the light's range reaches
+	void sphereTiles(unsigned int slice, const LightBounds& light, std::uint8_t* hit) const;
+	// the same, then clears the tiles whose bounding sphere is outside the cone
+	void coneTiles(unsigned int slice, const LightBounds& light, std::uint8_t* hit) const;
+
+	void assign(unsigned int slice);
+	void merge();
+
+public:
+	LightGrid();
+
+	LightGrid(const LightGrid&) = delete;
+	LightGrid& operator=(const LightGrid&) = delete;
+
+	// rebuild the cluster boxes when the projection or the screen size changed
+	void setProjection(const glm::mat4& projection, float nearPlane, float farPlane, float width, float height);
+
+	// how model.fs finds its cluster with the current projection
+	ClustersBlock block() const;
+
+	// assign the lights to the clusters of a camera at view
+	void build(ThreadPool& pool, const glm::mat4& view, const std::vector<GpuPointLight>& points,
+		const std::vector<GpuSpotLight>& spots);
+
+	// the lights and lists of the last build(), which must have seen the same lights
+	void upload(const std::vector<GpuPointLight>& points, const std::vector<GpuSpotLight>& spots);
+
+	// the four buffers at their texture units
+	void bind() const;
+
+	// point the light grid samplers of a model.fs shader at their units
+	static void bindSamplers(const Shader& shader);
+
+	unsigned int litClusters() const { return m_litClusters; }
+	unsigned int longestList() const { return m_longestList; }
+	std::size_t indexCount() const { return m_indices.size(); }
+
+	// lists were cut short because the index buffer hit GL_MAX_TEXTURE_BUFFER_SIZE
+	bool clipped() const { return m_clipped; }
+};
+
+
+LightGrid::LightGrid()
+{
+	GLint maxTexels{};
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	m_maxTexels = static_cast<std::size_t>(maxTexels);
+
+	for (std::vector<float>* bounds : { &m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ,
+		&m_sphereX, &m_sphereY, &m_sphereZ, &m_sphereRadius })
+		bounds->resize(CLUSTERS);
+	m_slices.resize(SLICES);
+	m_clusters.resize(CLUSTERS * 2);
+
+	create(m_pointLights, GL_RGBA32F, 64 * sizeof(GpuPointLight), "light grid point lights");
+	create(m_spotLights, GL_RGBA32F, 4 * sizeof(GpuSpotLight), "light grid spot lights");
+	create(m_clusterLists, GL_RG32UI, CLUSTERS * 2 * sizeof(std::uint32_t), "light grid clusters");
+	create(m_lightIndices, GL_R32UI, CLUSTERS * 4 * sizeof(std::uint32_t), "light grid indices");
+}
+
+
+void LightGrid::create(TextureBuffer& target, GLenum format, std::size_t bytes, const char* label)
+{
+	target.buffer = GLBuffer::create();
+	target.texture = GLTexture::create();
+	target.label = label;
+	allocate(target, bytes);
+
+	// the texture reads whatever storage the buffer has, reallocations included
+	glBindTexture(GL_TEXTURE_BUFFER, target.texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, target.buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+
+void LightGrid::allocate(TextureBuffer& target, std::size_t bytes)
+{
+	target.capacity = bytes;
+
+	glBindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+	glBufferData(GL_TEXTURE_BUFFER, target.capacity, nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	gpuMemory().track(GLObjectType::Buffer, target.buffer, MemoryCategory::LightGrid, 0, target.label,
+		target.capacity);
+}
+
+
+void LightGrid::write(TextureBuffer& target, const void* data, std::size_t bytes)
+{
+	if (bytes > target.capacity)
+		allocate(target, std::max(bytes, target.capacity * 2));
+
+	glBindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+	glBufferData(GL_TEXTURE_BUFFER, target.capacity, nullptr, GL_DYNAMIC_DRAW);
+	if (bytes)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+
+void LightGrid::setProjection(const glm::mat4& projection, float nearPlane, float farPlane, float width,
+	float height)
+{
+	if (projection == m_projection && nearPlane == m_near && farPlane == m_far && width == m_width
+		&& height == m_height)
+		return;
+
+	m_projection = projection;
+	m_near = nearPlane;
+	m_far = farPlane;
+	m_width = width;
+	m_height = height;
+
+	// slice = SLICES * log(depth / near) / log(far / near)
+	m_sliceScale = SLICES / std::log(m_far / m_near);
+	m_sliceBias = -std::log(m_near) * m_sliceScale;
+
+	for (unsigned int slice{ 0 }; slice < SLICES; ++slice)
+	{
+		float depths[2]{ m_near * std::pow(m_far / m_near, static_cast<float>(slice) / SLICES),
+			m_near * std::pow(m_far / m_near, static_cast<float>(slice + 1) / SLICES) };
+
+		for (unsigned int tile{ 0 }; tile < TILES; ++tile)
+		{
+			unsigned int x{ tile % TILES_X };
+			unsigned int y{ tile / TILES_X };
+
+			// the tile's four NDC corners at both depths. clip.w is the view depth d,
+			// so view x = d * (ndc x + P[2][0]) / P[0][0], the same for y
+			glm::vec3 boxMin{ std::numeric_limits<float>::max() };
+			glm::vec3 boxMax{ -std::numeric_limits<float>::max() };
+			for (float depth : depths)
+			{
+				for (unsigned int corner{ 0 }; corner < 4; ++corner)
+				{
+					float ndcX{ -1.0f + 2.0f * static_cast<float>(x + (corner & 1)) / TILES_X };
+					float ndcY{ -1.0f + 2.0f * static_cast<float>(y + (corner >> 1)) / TILES_Y };
+					glm::vec3 point{ depth * (ndcX + m_projection[2][0]) / m_projection[0][0],
+						depth * (ndcY + m_projection[2][1]) / m_projection[1][1], -depth };
+					boxMin = glm::min(boxMin, point);
+					boxMax = glm::max(boxMax, point);
+				}
+			}
+
+			std::size_t cluster{ slice * TILES + tile };
+			m_minX[cluster] = boxMin.x;
+			m_minY[cluster] = boxMin.y;
+			m_minZ[cluster] = boxMin.z;
+			m_maxX[cluster] = boxMax.x;
+			m_maxY[cluster] = boxMax.y;
+			m_maxZ[cluster] = boxMax.z;
+
+			glm::vec3 center{ (boxMin + boxMax) * 0.5f };
+			m_sphereX[cluster] = center.x;
+			m_sphereY[cluster] = center.y;
+			m_sphereZ[cluster] = center.z;
+			m_sphereRadius[cluster] = glm::length(boxMax - boxMin) * 0.5f;
+		}
+	}
+}
+
+
+ClustersBlock LightGrid::block() const
+{
+	ClustersBlock block{};
+	block.count = glm::uvec4(TILES_X, TILES_Y, SLICES, 0);
+	block.scale = glm::vec4(m_sliceScale, m_sliceBias, TILES_X / m_width, TILES_Y / m_height);
+	return block;
+}
+
+
+void LightGrid::reach(float nearest, float farthest, LightBounds& light) const
+{
+	light.firstSlice = 1;
+	light.lastSlice = 0;
+	if (farthest < m_near || nearest > m_far)
+		return;
+
+	auto slice{ [this](float depth)
+		{
+			float index{ std::log(std::max(depth, m_near)) * m_sliceScale + m_sliceBias };
+			return static_cast<unsigned int>(std::min(std::max(index, 0.0f), SLICES - 1.0f));
+		} };
+	light.firstSlice = slice(nearest);
+	light.lastSlice = slice(farthest);
+}
+
+
+void LightGrid::build(ThreadPool& pool, const glm::mat4& view, const std::vector<GpuPointLight>& points,
+	const std::vector<GpuSpotLight>& spots)
+{
+	// lights past the longest texture buffer are left out
+	m_points.resize(std::min(points.size(), m_maxTexels / 3));
+	for (std::size_t i{ 0 }; i < m_points.size(); ++i)
+	{
+		LightBounds& light{ m_points[i] };
+		light.position = glm::vec3(view * glm::vec4(glm::vec3(points[i].positionRange), 1.0f));
+		light.range = points[i].positionRange.w;
+		reach(-light.position.z - light.range, -light.position.z + light.range, light);
+	}
+
+	m_spots.resize(std::min(spots.size(), m_maxTexels / 5));
+	for (std::size_t i{ 0 }; i < m_spots.size(); ++i)
+	{
+		LightBounds& light{ m_spots[i] };
+		light.position = glm::vec3(view * glm::vec4(glm::vec3(spots[i].positionRange), 1.0f));
+		light.range = spots[i].positionRange.w;
+		light.direction = glm::normalize(glm::mat3(view) * glm::vec3(spots[i].directionCutOff));
+		light.cosAngle = spots[i].ambientOuterCutOff.w;
+		light.sinAngle = std::sqrt(std::max(0.0f, 1.0f - light.cosAngle * light.cosAngle));
+		reach(-light.position.z - light.range, -light.position.z + light.range, light);
+	}
+
+	// every worker owns whole slices, nothing is shared until merge()
+	parallelFor(pool, SLICES, 1, [this](std::size_t begin, std::size_t end, std::size_t)
+		{
+			for (std::size_t slice{ begin }; slice < end; ++slice)
+				assign(static_cast<unsigned int>(slice));
+		});
+	merge();
+}
+
+
+void LightGrid::sphereTiles(unsigned int slice, const LightBounds& light, std::uint8_t* hit) const
+{
+	// squared distance from the light to the closest point of each box:
+	// per axis max(min - p, p - max, 0)
+	std::size_t begin{ static_cast<std::size_t>(slice) * TILES };
+	std::size_t end{ begin + TILES };
+	std::size_t i{ begin };
+	float rangeSquared{ light.range * light.range };
+
+#if defined(CULLING_AVX)
+	__m256 positionX{ _mm256_set1_ps(light.position.x) };
+	__m256 positionY{ _mm256_set1_ps(light.position.y) };
+	__m256 positionZ{ _mm256_set1_ps(light.position.z) };
+	__m256 range{ _mm256_set1_ps(rangeSquared) };
+	__m256 zero{ _mm256_setzero_ps() };
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 dx{ _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_minX[i]), positionX),
+			_mm256_sub_ps(positionX, _mm256_loadu_ps(&m_maxX[i]))), zero) };
+		__m256 dy{ _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_minY[i]), positionY),
+			_mm256_sub_ps(positionY, _mm256_loadu_ps(&m_maxY[i]))), zero) };
+		__m256 dz{ _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_minZ[i]), positionZ),
+			_mm256_sub_ps(positionZ, _mm256_loadu_ps(&m_maxZ[i]))), zero) };
+		__m256 distance{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+			_mm256_mul_ps(dz, dz)) };
+
+		int mask{ _mm256_movemask_ps(_mm256_cmp_ps(distance, range, _CMP_LE_OQ)) };
+		for (int lane{ 0 }; lane < 8; ++lane)
+			hit[i - begin + lane] = static_cast<std::uint8_t>((mask >> lane) & 1);
+	}
+#elif defined(CULLING_SSE)
+	__m128 positionX{ _mm_set1_ps(light.position.x) };
+	__m128 positionY{ _mm_set1_ps(light.position.y) };
+	__m128 positionZ{ _mm_set1_ps(light.position.z) };
+	__m128 range{ _mm_set1_ps(rangeSquared) };
+	__m128 zero{ _mm_setzero_ps() };
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 dx{ _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minX[i]), positionX),
+			_mm_sub_ps(positionX, _mm_loadu_ps(&m_maxX[i]))), zero) };
+		__m128 dy{ _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minY[i]), positionY),
+			_mm_sub_ps(positionY, _mm_loadu_ps(&m_maxY[i]))), zero) };
+		__m128 dz{ _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minZ[i]), positionZ),
+			_mm_sub_ps(positionZ, _mm_loadu_ps(&m_maxZ[i]))), zero) };
+		__m128 distance{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)) };
+
+		int mask{ _mm_movemask_ps(_mm_cmple_ps(distance, range)) };
+		for (int lane{ 0 }; lane < 4; ++lane)
+			hit[i - begin + lane] = static_cast<std::uint8_t>((mask >> lane) & 1);
+	}
+#endif
+
+	// the boxes left over after the last full vector (all of them without SIMD)
+	for (; i < end; ++i)
+	{
+		float dx{ std::max(std::max(m_minX[i] - light.position.x, light.position.x - m_maxX[i]), 0.0f) };
+		float dy{ std::max(std::max(m_minY[i] - light.position.y, light.position.y - m_maxY[i]), 0.0f) };
+		float dz{ std::max(std::max(m_minZ[i] - light.position.z, light.position.z - m_maxZ[i]), 0.0f) };
+		hit[i - begin] = dx * dx + dy * dy + dz * dz <= rangeSquared ? 1 : 0;
+	}
+}
+
+
+void LightGrid::coneTiles(unsigned int slice, const LightBounds& light, std::uint8_t* hit) const
+{
+	sphereTiles(slice, light, hit);
+
+	// a cluster's bounding sphere is outside the cone when it lies beyond the
+	// cone's side, past its range or behind its apex. With v = center - apex and
+	// along = dot(v, direction), the side distance is
+	// cos * sqrt(|v|^2 - along^2) - sin * along
+	std::size_t begin{ static_cast<std::size_t>(slice) * TILES };
+	std::size_t end{ begin + TILES };
+	std::size_t i{ begin };
+
+#if defined(CULLING_AVX)
+	__m256 positionX{ _mm256_set1_ps(light.position.x) };
+	__m256 positionY{ _mm256_set1_ps(light.position.y) };
+	__m256 positionZ{ _mm256_set1_ps(light.position.z) };
+	__m256 directionX{ _mm256_set1_ps(light.direction.x) };
+	__m256 directionY{ _mm256_set1_ps(light.direction.y) };
+	__m256 directionZ{ _mm256_set1_ps(light.direction.z) };
+	__m256 cosAngle{ _mm256_set1_ps(light.cosAngle) };
+	__m256 sinAngle{ _mm256_set1_ps(light.sinAngle) };
+	__m256 range{ _mm256_set1_ps(light.range) };
+	__m256 zero{ _mm256_setzero_ps() };
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 vx{ _mm256_sub_ps(_mm256_loadu_ps(&m_sphereX[i]), positionX) };
+		__m256 vy{ _mm256_sub_ps(_mm256_loadu_ps(&m_sphereY[i]), positionY) };
+		__m256 vz{ _mm256_sub_ps(_mm256_loadu_ps(&m_sphereZ[i]), positionZ) };
+		__m256 radius{ _mm256_loadu_ps(&m_sphereRadius[i]) };
+
+		__m256 lengthSquared{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)),
+			_mm256_mul_ps(vz, vz)) };
+		__m256 along{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, directionX), _mm256_mul_ps(vy, directionY)),
+			_mm256_mul_ps(vz, directionZ)) };
+		__m256 across{ _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(lengthSquared, _mm256_mul_ps(along, along)), zero)) };
+		__m256 side{ _mm256_sub_ps(_mm256_mul_ps(cosAngle, across), _mm256_mul_ps(sinAngle, along)) };
+
+		__m256 outside{ _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(side, radius, _CMP_GT_OQ),
+			_mm256_cmp_ps(along, _mm256_add_ps(radius, range), _CMP_GT_OQ)),
+			_mm256_cmp_ps(along, _mm256_sub_ps(zero, radius), _CMP_LT_OQ)) };
+
+		int mask{ _mm256_movemask_ps(outside) };
+		for (int lane{ 0 }; lane < 8; ++lane)
+			hit[i - begin + lane] &= static_cast<std::uint8_t>(((mask >> lane) & 1) ^ 1);
+	}
+#elif defined(CULLING_SSE)
+	__m128 positionX{ _mm_set1_ps(light.position.x) };
+	__m128 positionY{ _mm_set1_ps(light.position.y) };
+	__m128 positionZ{ _mm_set1_ps(light.position.z) };
+	__m128 directionX{ _mm_set1_ps(light.direction.x) };
+	__m128 directionY{ _mm_set1_ps(light.direction.y) };
+	__m128 directionZ{ _mm_set1_ps(light.direction.z) };
+	__m128 cosAngle{ _mm_set1_ps(light.cosAngle) };
+	__m128 sinAngle{ _mm_set1_ps(light.sinAngle) };
+	__m128 range{ _mm_set1_ps(light.range) };
+	__m128 zero{ _mm_setzero_ps() };
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 vx{ _mm_sub_ps(_mm_loadu_ps(&m_sphereX[i]), positionX) };
+		__m128 vy{ _mm_sub_ps(_mm_loadu_ps(&m_sphereY[i]), positionY) };
+		__m128 vz{ _mm_sub_ps(_mm_loadu_ps(&m_sphereZ[i]), positionZ) };
+		__m128 radius{ _mm_loadu_ps(&m_sphereRadius[i]) };
+
+		__m128 lengthSquared{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)) };
+		__m128 along{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, directionX), _mm_mul_ps(vy, directionY)),
+			_mm_mul_ps(vz, directionZ)) };
+		__m128 across{ _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSquared, _mm_mul_ps(along, along)), zero)) };
+		__m128 side{ _mm_sub_ps(_mm_mul_ps(cosAngle, across), _mm_mul_ps(sinAngle, along)) };
+
+		__m128 outside{ _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(side, radius),
+			_mm_cmpgt_ps(along, _mm_add_ps(radius, range))), _mm_cmplt_ps(along, _mm_sub_ps(zero, radius))) };
+
+		int mask{ _mm_movemask_ps(outside) };
+		for (int lane{ 0 }; lane < 4; ++lane)
+			hit[i - begin + lane] &= static_cast<std::uint8_t>(((mask >> lane) & 1) ^ 1);
+	}
+#endif
+
+	for (; i < end; ++i)
+	{
+		glm::vec3 v{ m_sphereX[i] - light.position.x, m_sphereY[i] - light.position.y,
+			m_sphereZ[i] - light.position.z };
+		float along{ glm::dot(v, light.direction) };
+		float across{ std::sqrt(std::max(glm::dot(v, v) - along * along, 0.0f)) };
+		float side{ light.cosAngle * across - light.sinAngle * along };
+		float radius{ m_sphereRadius[i] };
+		if (side > radius || along > radius + light.range || along < -radius)
+			hit[i - begin] = 0;
+	}
+}
+
+
+void LightGrid::assign(unsigned int slice)
+{
+	SliceLists& lists{ m_slices[slice] };
+	lists.hitTiles.clear();
+	lists.hitLights.clear();
+	lists.points.fill(0);
+	lists.spots.fill(0);
+
+	std::array<std::uint8_t, TILES> hit{};
+	for (std::size_t light{ 0 }; light < m_points.size(); ++light)
+	{
+		if (slice < m_points[light].firstSlice || slice > m_points[light].lastSlice)
+			continue;
+
+		sphereTiles(slice, m_points[light], hit.data());
+		for (unsigned int tile{ 0 }; tile < TILES; ++tile)
+		{
+			if (!hit[tile])
+				continue;
+			lists.hitTiles.push_back(tile);
+			lists.hitLights.push_back(static_cast<std::uint32_t>(light));
+			++lists.points[tile];
+		}
+	}
+	std::size_t pointHits{ lists.hitTiles.size() };
+
+	for (std::size_t light{ 0 }; light < m_spots.size(); ++light)
+	{
+		if (slice < m_spots[light].firstSlice || slice > m_spots[light].lastSlice)
+			continue;
+
+		coneTiles(slice, m_spots[light], hit.data());
+		for (unsigned int tile{ 0 }; tile < TILES; ++tile)
+		{
+			if (!hit[tile])
+				continue;
+			lists.hitTiles.push_back(tile);
+			lists.hitLights.push_back(static_cast<std::uint32_t>(light));
+			++lists.spots[tile];
+		}
+	}
+
+	// counting sort by tile, each tile's point lights ahead of its spot lights
+	std::array<std::uint32_t, TILES> pointCursor{};
+	std::array<std::uint32_t, TILES> spotCursor{};
+	std::uint32_t next{ 0 };
+	for (unsigned int tile{ 0 }; tile < TILES; ++tile)
+	{
+		lists.first[tile] = next;
+		pointCursor[tile] = next;
+		spotCursor[tile] = next + lists.points[tile];
+		next += lists.points[tile] + lists.spots[tile];
+	}
+
+	lists.indices.resize(next);
+	for (std::size_t i{ 0 }; i < lists.hitTiles.size(); ++i)
+	{
+		std::uint32_t tile{ lists.hitTiles[i] };
+		std::uint32_t& cursor{ i < pointHits ? pointCursor[tile] : spotCursor[tile] };
+		lists.indices[cursor++] = lists.hitLights[i];
+	}
+}
+
+
+void LightGrid::merge()
+{
+	m_indices.clear();
+	m_litClusters = 0;
+	m_longestList = 0;
+	m_clipped = false;
+
+	for (unsigned int slice{ 0 }; slice < SLICES; ++slice)
+	{
+		const SliceLists& lists{ m_slices[slice] };
+		for (unsigned int tile{ 0 }; tile < TILES; ++tile)
+		{
+			std::uint32_t points{ std::min(lists.points[tile], MAX_CLUSTER_LIGHTS) };
+			std::uint32_t spots{ std::min(lists.spots[tile], MAX_CLUSTER_LIGHTS) };
+
+			// the index buffer cannot hold more than GL_MAX_TEXTURE_BUFFER_SIZE texels
+			std::size_t room{ m_maxTexels - m_indices.size() };
+			if (points + spots > room)
+			{
+				points = static_cast<std::uint32_t>(std::min<std::size_t>(points, room));
+				spots = static_cast<std::uint32_t>(room - points);
+				m_clipped = true;
+			}
+
+			std::size_t cluster{ slice * TILES + tile };
+			m_clusters[cluster * 2] = static_cast<std::uint32_t>(m_indices.size());
+			m_clusters[cluster * 2 + 1] = points | (spots << 16);
+
+			const std::uint32_t* first{ lists.indices.data() + lists.first[tile] };
+			m_indices.insert(m_indices.end(), first, first + points);
+			first += lists.points[tile];
+			m_indices.insert(m_indices.end(), first, first + spots);
+
+			m_litClusters += points + spots > 0 ? 1 : 0;
+			m_longestList = std::max(m_longestList, points + spots);
+		}
+	}
+}
+
+
+void LightGrid::upload(const std::vector<GpuPointLight>& points, const std::vector<GpuSpotLight>& spots)
+{
+	write(m_pointLights, points.data(), m_points.size() * sizeof(GpuPointLight));
+	write(m_spotLights, spots.data(), m_spots.size() * sizeof(GpuSpotLight));
+	write(m_clusterLists, m_clusters.data(), m_clusters.size() * sizeof(std::uint32_t));
+	write(m_lightIndices, m_indices.data(), m_indices.size() * sizeof(std::uint32_t));
+}
+
+
+void LightGrid::bind() const
+{
+	glState().bindTexture(POINT_LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, m_pointLights.texture);
+	glState().bindTexture(SPOT_LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, m_spotLights.texture);
+	glState().bindTexture(LIGHT_CLUSTER_TEXTURE_UNIT, GL_TEXTURE_BUFFER, m_clusterLists.texture);
+	glState().bindTexture(LIGHT_INDEX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, m_lightIndices.texture);
+}
+
+
+void LightGrid::bindSamplers(const Shader& shader)
+{
+	shader.use();
+	shader.set(shader.findUniform<int>("pointLightBuffer"), POINT_LIGHT_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("spotLightBuffer"), SPOT_LIGHT_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("clusterBuffer"), LIGHT_CLUSTER_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("lightIndexBuffer"), LIGHT_INDEX_TEXTURE_UNIT);
+}
+
+#endif // !LIGHT_GRID_H
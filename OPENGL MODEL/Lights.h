@@ -0,0 +1,200 @@
+#pragma once
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+// attribute locations of the per-light data when lights are drawn as instanced
+// volumes, see deferredPoint.vs
+constexpr unsigned int LIGHT_POSITION_RANGE_LOCATION{ 3 };
+constexpr unsigned int LIGHT_DIFFUSE_LINEAR_LOCATION{ 4 };
+constexpr unsigned int LIGHT_SPECULAR_QUADRATIC_LOCATION{ 5 };
+
+
+// one point light as the light shaders read it. Three vec4s, so the same layout
+// works as instance attributes and as std140 / std430 array elements.
+// The constant attenuation term is always 1
+struct GpuPointLight
+{
+	glm::vec4 positionRange{};		// xyz world position, w distance beyond which it adds nothing
+	glm::vec4 diffuseLinear{};		// rgb diffuse, w linear attenuation
+	glm::vec4 specularQuadratic{};	// rgb specular, w quadratic attenuation
+};
+
+static_assert(sizeof(GpuPointLight) == 48, "GpuPointLight must stay three tightly packed vec4s");
+
+
+// distance at which constant + linear * d + quadratic * d^2 reaches 256 * brightest,
+// i.e. where the light drops below one 8 bit step of its brightest channel
+inline float attenuationRange(float constant, float linear, float quadratic, float brightest)
+{
+	float c{ constant - 256.0f * brightest };
+	if (c >= 0.0f)
+		return 0.0f;
+	if (quadratic <= 0.0f)
+		return linear > 0.0f ? -c / linear : std::numeric_limits<float>::max();
+
+	return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+}
+
+inline GpuPointLight makePointLight(const glm::vec3& position, const glm::vec3& diffuse, const glm::vec3& specular,
+	float linear, float quadratic)
+{
+	float brightest{ std::max(diffuse.r, std::max(diffuse.g, diffuse.b)) };
+	float range{ attenuationRange(1.0f, linear, quadratic, brightest) };
+	return { glm::vec4(position, range), glm::vec4(diffuse, linear), glm::vec4(specular, quadratic) };
+}
+
+
+// one spot light as the light grid stores it, five vec4s. Unlike the point
+// lights its ambient term only reaches inside the cone, so it is kept per light
+struct GpuSpotLight
+{
+	glm::vec4 positionRange{};		// xyz world position, w distance beyond which it adds nothing
+	glm::vec4 directionCutOff{};		// xyz normalized direction, w cosine of the inner cone angle
+	glm::vec4 diffuseLinear{};		// rgb diffuse, w linear attenuation
+	glm::vec4 specularQuadratic{};	// rgb specular, w quadratic attenuation
+	glm::vec4 ambientOuterCutOff{};	// rgb ambient, w cosine of the outer cone angle
+};
+
+static_assert(sizeof(GpuSpotLight) == 80, "GpuSpotLight must stay five tightly packed vec4s");
+
+
+// cutOff and outerCutOff are the cosines of the cone angles
+inline GpuSpotLight makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float cutOff,
+	float outerCutOff, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
+	float linear, float quadratic)
+{
+	glm::vec3 brightest{ glm::max(ambient, diffuse) };
+	float range{ attenuationRange(1.0f, linear, quadratic, std::max(brightest.r, std::max(brightest.g, brightest.b))) };
+	return { glm::vec4(position, range), glm::vec4(glm::normalize(direction), cutOff), glm::vec4(diffuse, linear),
+		glm::vec4(specular, quadratic), glm::vec4(ambient, outerCutOff) };
+}
+
+
+// count lights of random hue spread over a box, the same ones for the same seed.
+// Attenuation comes from (linear, quadratic), brightness scales the colours
+void scatterPointLights(std::vector<GpuPointLight>& lights, std::size_t count, const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax, float linear, float quadratic, float brightness, std::uint32_t seed = 1);
+
+
+// CPU list of point lights mirrored into one GL buffer, like InstanceBuffer.
+// The buffer can feed instance attributes (attach()) or be read as an array
+class PointLightBuffer
+{
+private:
+	GLBuffer m_buffer{};
+	std::vector<GpuPointLight> m_lights{};
+	std::size_t m_capacity{};
+	std::string m_label{};
+
+	void allocate(std::size_t capacity);
+
+public:
+	explicit PointLightBuffer(const std::string& label, std::size_t capacity = 64)
+		: m_buffer{ GLBuffer::create() }, m_label{ label }
+	{
+		allocate(std::max<std::size_t>(capacity, 1));
+	}
+
+	std::vector<GpuPointLight>& lights() { return m_lights; }
+	const std::vector<GpuPointLight>& lights() const { return m_lights; }
+	std::size_t size() const { return m_lights.size(); }
+	unsigned int buffer() const { return m_buffer; }
+
+	// copy the lights to the GPU, growing or orphaning the storage
+	void upload();
+
+	// per-light attributes at the LIGHT_*_LOCATIONs of vertexArray, one per
+	// instance. Leaves vertexArray bound
+	void attach(unsigned int vertexArray) const;
+};
+
+
+void scatterPointLights(std::vector<GpuPointLight>& lights, std::size_t count, const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax, float linear, float quadratic, float brightness, std::uint32_t seed)
+{
+	// xorshift, the same sequence on every platform unlike <random>'s distributions
+	std::uint32_t state{ seed ? seed : 1u };
+	auto next{ [&state]()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state >> 8) * (1.0f / 16777216.0f);
+		} };
+
+	for (std::size_t i{ 0 }; i < count; ++i)
+	{
+		glm::vec3 position{ boundsMin.x + next() * (boundsMax.x - boundsMin.x),
+			boundsMin.y + next() * (boundsMax.y - boundsMin.y),
+			boundsMin.z + next() * (boundsMax.z - boundsMin.z) };
+
+		// fully saturated hue
+		float hue{ next() * 6.0f };
+		glm::vec3 color{ std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f), 2.0f - std::abs(hue - 4.0f) };
+		color = glm::min(glm::max(color, glm::vec3(0.0f)), glm::vec3(1.0f));
+
+		lights.push_back(makePointLight(position, color * brightness, color * brightness, linear, quadratic));
+	}
+}
+
+
+void PointLightBuffer::allocate(std::size_t capacity)
+{
+	m_capacity = capacity;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(GpuPointLight), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	gpuMemory().track(GLObjectType::Buffer, m_buffer, MemoryCategory::SceneGeometry, 0, m_label,
+		m_capacity * sizeof(GpuPointLight));
+}
+
+
+void PointLightBuffer::upload()
+{
+	if (m_lights.size() > m_capacity)
+		allocate(std::max(m_lights.size(), m_capacity * 2));
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(GpuPointLight), nullptr, GL_DYNAMIC_DRAW);
+	if (!m_lights.empty())
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m_lights.size() * sizeof(GpuPointLight), m_lights.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void PointLightBuffer::attach(unsigned int vertexArray) const
+{
+	glState().bindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+
+	const unsigned int locations[]{ LIGHT_POSITION_RANGE_LOCATION, LIGHT_DIFFUSE_LINEAR_LOCATION,
+		LIGHT_SPECULAR_QUADRATIC_LOCATION };
+	for (unsigned int i{ 0 }; i < 3; ++i)
+	{
+		glVertexAttribPointer(locations[i], 4, GL_FLOAT, GL_FALSE, sizeof(GpuPointLight),
+			(void*)(i * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(locations[i]);
+		glVertexAttribDivisor(locations[i], 1);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+#endif // !LIGHTS_H
@@ -4,13 +4,24 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "CommandList.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "InstanceBuffer.h"
 #include "Shader.h"
+#include "UploadQueue.h"
 #include <glad/glad.h>
 
 
 #include <string>
 #include <vector>
 #include <cstddef>  // for offsetof
+#include <memory>
+#include <map>
+#include <cassert>
+#include <cstdint>
+#include <limits>
 
 
 // Minimal data required for a mesh
@@ -22,7 +33,7 @@ struct Vertex
 
 };
 
-// Texture data
+// Texture data. The GL texture itself is owned by the Model that loaded it
 struct Texture
 {
 	unsigned int id{};		
@@ -32,15 +43,112 @@ struct Texture
 };
 
 
+// Fixed texture units of the material samplers in model.fs. bindMaterialSamplers()
+// points the sampler uniforms at them once after linking, so drawing a mesh only
+// has to bind its textures
+constexpr unsigned int MATERIAL_TEXTURES_PER_TYPE{ 3 };		// texture_diffuse1-3, texture_specular1-3
+constexpr unsigned int DIFFUSE_TEXTURE_UNIT{ 0 };			// units 0 - 2
+constexpr unsigned int SPECULAR_TEXTURE_UNIT{ 3 };			// units 3 - 5
+constexpr unsigned int EMISSION_TEXTURE_UNIT{ 6 };
+constexpr unsigned int SHADOW_MAP_TEXTURE_UNIT{ 7 };
+
+// one material texture, resolved to the unit its sampler reads from
+struct TextureBinding
+{
+	unsigned int unit{};
+	unsigned int texture{};
+
+	bool operator==(const TextureBinding& other) const { return unit == other.unit && texture == other.texture; }
+};
+
+inline void bindMaterialSamplers(const Shader& shader)
+{
+	shader.use();
+
+	for (unsigned int i{ 0 }; i < MATERIAL_TEXTURES_PER_TYPE; ++i)
+	{
+		std::string number{ std::to_string(i + 1) };
+		shader.set(shader.findUniform<int>("material.texture_diffuse" + number), DIFFUSE_TEXTURE_UNIT + i);
+		shader.set(shader.findUniform<int>("material.texture_specular" + number), SPECULAR_TEXTURE_UNIT + i);
+	}
+
+	shader.set(shader.findUniform<int>("material.emission"), EMISSION_TEXTURE_UNIT);
+	shader.set(shader.findUniform<int>("shadowMap"), SHADOW_MAP_TEXTURE_UNIT);
+}
+
+
+// as wide as the material field of a RenderQueue sort key
+using MaterialId = std::uint16_t;
+
+// Small ids for the distinct sets of material textures of one model, so its draws
+// can be sorted by material. Meshes with the same textures get the same id. The
+// table lives and dies with the model (and its textures), a reload starts from
+// id 0 again. Sets past the last id all share it, which only costs sorting,
+// batches compare the bindings themselves. GL thread only
+class MaterialTable
+{
+private:
+	static constexpr MaterialId LAST_ID{ std::numeric_limits<MaterialId>::max() };
+
+	std::map<std::vector<std::uint64_t>, MaterialId> m_materials{};
+
+public:
+	// the id of bindings, a new one when this set was not seen before
+	MaterialId intern(const std::vector<TextureBinding>& bindings);
+};
+
+
+MaterialId MaterialTable::intern(const std::vector<TextureBinding>& bindings)
+{
+	std::vector<std::uint64_t> key{};
+	for (const TextureBinding& binding : bindings)
+		key.push_back((static_cast<std::uint64_t>(binding.unit) << 32) | binding.texture);
+
+	auto it{ m_materials.find(key) };
+	if (it != m_materials.end())
+		return it->second;
+
+	assert(m_materials.size() < LAST_ID && "out of material ids");
+	if (m_materials.size() >= LAST_ID)
+		return LAST_ID;
+
+	MaterialId id{ static_cast<MaterialId>(m_materials.size()) };
+	m_materials.emplace(std::move(key), id);
+	return id;
+}
+
+
 class Mesh
 {
 private:
-	// render data
-	unsigned int m_VAO{};
-	unsigned int m_VBO{};
-	unsigned int m_EBO{};
-	
-	void setupMesh();
+	// render data, deleted together with the mesh
+	GLVertexArray m_VAO{};
+	GLBuffer m_VBO{};
+	GLBuffer m_EBO{};
+
+	// positions alone, for depth only passes: a third of the vertex fetch of m_VBO
+	GLVertexArray m_depthVAO{};
+	GLBuffer m_positionVBO{};
+
+	// per-instance model matrices (one entry per node that references this mesh)
+	GLBuffer m_instanceVBO{};
+	unsigned int m_instanceCount{ 1 };
+
+	// vertex / index data still waiting in the upload queue. Shared with the
+	// queued job so the mesh can move while the upload finishes
+	std::shared_ptr<unsigned int> m_pendingUploads{ std::make_shared<unsigned int>(0) };
+	AssetId m_owner{};
+
+	// texture unit + GL name of every material texture, resolved once
+	std::vector<TextureBinding> m_bindings{};
+	MaterialId m_materialId{};
+
+	// object space bounds and a CPU copy of the instance transforms, for sorting
+	glm::vec3 m_boundsMin{};
+	glm::vec3 m_boundsMax{};
+	std::vector<glm::mat4> m_instanceTransforms{};
+
+	void setupMesh(MaterialTable& materials);
 
 public:
 	// mesh data
@@ -49,35 +157,178 @@ public:
 	std::vector<Texture> textures{};
 
 	// constructor
-	Mesh(const std::vector<Vertex>& vertice, std::vector<unsigned int> indice, std::vector<Texture> texture)
+	// materials hands out the material id, owner tags the buffer uploads so they
+	// can be cancelled with the model
+	Mesh(const std::vector<Vertex>& vertice, std::vector<unsigned int> indice, std::vector<Texture> texture,
+		MaterialTable& materials, AssetId owner = 0)
 	{
 		vertices = vertice;
 		indices = indice;
 		textures = texture;
+		m_owner = owner;
 
-		setupMesh();
+		setupMesh(materials);
 	}
 
+	// a mesh owns its GL objects, so it can be moved but not copied
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&&) = default;
+	Mesh& operator=(Mesh&&) = default;
+
+	// upload the world transform of every node referencing this mesh.
+	// the matrices are read by the vertex shader at location 3 - 6 (one column each)
+	void setInstances(const std::vector<glm::mat4>& transforms);
+
+	// overwrite one instance's transform, the buffer keeps its size
+	void setInstance(unsigned int index, const glm::mat4& transform);
+
+	unsigned int instanceCount() const { return m_instanceCount; }
+	const std::vector<glm::mat4>& instanceTransforms() const { return m_instanceTransforms; }
+
+	// point locations 0 - 2 of the bound VAO at a buffer of Vertex and bind the index buffer
+	static void setupVertexAttributes(unsigned int vertexBuffer, unsigned int indexBuffer);
+
+	// a second VAO over this mesh's geometry that takes its instances from an
+	// InstanceBuffer, for drawing the mesh many times with instances.drawElements()
+	GLVertexArray createVertexArray(const InstanceBuffer& instances) const;
+
+	unsigned int vertexArray() const { return m_VAO; }
+	unsigned int vertexBuffer() const { return m_VBO; }
+	unsigned int indexBuffer() const { return m_EBO; }
+	GLsizei indexCount() const { return static_cast<GLsizei>(indices.size()); }
+	MaterialId materialId() const { return m_materialId; }
+
+	glm::vec3 boundsMin() const { return m_boundsMin; }
+	glm::vec3 boundsMax() const { return m_boundsMax; }
+	glm::vec3 boundsCenter() const { return (m_boundsMin + m_boundsMax) * 0.5f; }
+
+	// false while the vertex or index data is still streaming in
+	bool isReady() const { return *m_pendingUploads == 0; }
 
-	void Draw(Shader& shader) const;
+	// bind the material textures to their units
+	void bindMaterial() const;
+
+	// true when bindMaterial() binds exactly what other's does
+	bool sameMaterial(const Mesh& other) const;
+
+	// bind the material textures and draw every instance
+	void Draw() const;
+
+	// draw positions only without touching textures, for depth only passes.
+	// The shader may only read location 0 and the instance matrix
+	void DrawGeometry() const;
+
+	// record the same calls into a command list, Draw() when withMaterial is set,
+	// DrawGeometry() otherwise. Does not touch GL, safe on a worker thread
+	void record(CommandList& list, bool withMaterial) const;
 
 };
 
 
-void Mesh::setupMesh()
+void Mesh::setupMesh(MaterialTable& materials)
 {
-	glGenBuffers(1, &m_VBO);
-	glGenVertexArrays(1, &m_VAO);
-	glGenBuffers(1, &m_EBO);
+	// texture_diffuseN samples unit DIFFUSE_TEXTURE_UNIT + N - 1, same for specular
+	unsigned int diffuseN{ 0 };
+	unsigned int specularN{ 0 };
+
+	for (const Texture& texture : textures)
+	{
+		TextureBinding binding{};
+		binding.texture = texture.id;
+
+		if (texture.type == "texture_diffuse" && diffuseN < MATERIAL_TEXTURES_PER_TYPE)
+			binding.unit = DIFFUSE_TEXTURE_UNIT + diffuseN++;
+
+		else if (texture.type == "texture_specular" && specularN < MATERIAL_TEXTURES_PER_TYPE)
+			binding.unit = SPECULAR_TEXTURE_UNIT + specularN++;
+
+		else
+			continue;	// no sampler for it in the shader
+
+		m_bindings.push_back(binding);
+	}
+	m_materialId = materials.intern(m_bindings);
+
+	if (!vertices.empty())
+	{
+		m_boundsMin = m_boundsMax = vertices[0].Position;
+		for (const Vertex& vertex : vertices)
+		{
+			m_boundsMin = glm::min(m_boundsMin, vertex.Position);
+			m_boundsMax = glm::max(m_boundsMax, vertex.Position);
+		}
+	}
 
-	glBindVertexArray(m_VAO);
+	m_VBO = GLBuffer::create();
+	m_VAO = GLVertexArray::create();
+	m_EBO = GLBuffer::create();
+	m_positionVBO = GLBuffer::create();
+	m_depthVAO = GLVertexArray::create();
+
+	std::vector<glm::vec3> positions(vertices.size());
+	for (std::size_t i{ 0 }; i < vertices.size(); ++i)
+		positions[i] = vertices[i].Position;
+
+	// with an upload queue only the storage is allocated here, the data follows
+	// in bounded steps so a big mesh cannot stall a frame
+	bool deferred{ activeUploadQueue != nullptr };
+
+	glState().bindVertexArray(m_VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(),
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), deferred ? nullptr : vertices.data(),
 		GL_STATIC_DRAW);
+	gpuMemory().track(GLObjectType::Buffer, m_VBO, MemoryCategory::MeshVertices, m_owner, "vertices",
+		vertices.size() * sizeof(Vertex));
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(),
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+		deferred ? nullptr : indices.data(), GL_STATIC_DRAW);
+	gpuMemory().track(GLObjectType::Buffer, m_EBO, MemoryCategory::MeshIndices, m_owner, "indices",
+		indices.size() * sizeof(unsigned int));
+
+	setupVertexAttributes(m_VBO, m_EBO);
+
+	glState().bindVertexArray(m_depthVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), deferred ? nullptr : positions.data(),
 		GL_STATIC_DRAW);
+	gpuMemory().track(GLObjectType::Buffer, m_positionVBO, MemoryCategory::MeshVertices, m_owner, "positions",
+		positions.size() * sizeof(glm::vec3));
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// default to a single instance with identity transform until the model
+	// hands us the node transforms
+	setInstances({ glm::mat4(1.0f) });
+
+	if (deferred)
+	{
+		UploadJob job{};
+		job.owner = m_owner;
+		job.name = "mesh";
+
+		std::size_t maxStep{ activeUploadQueue->maxStepBytes() };
+		appendBufferSteps(job, m_VBO, std::make_shared<const std::vector<Vertex>>(vertices), maxStep);
+		appendBufferSteps(job, m_EBO, std::make_shared<const std::vector<unsigned int>>(indices), maxStep);
+		appendBufferSteps(job, m_positionVBO, std::make_shared<const std::vector<glm::vec3>>(std::move(positions)),
+			maxStep);
+
+		std::shared_ptr<unsigned int> pending{ m_pendingUploads };
+		*pending = 1;
+		job.onComplete = [pending]() { *pending = 0; };
+
+		activeUploadQueue->enqueue(std::move(job));
+	}
+}
+
+
+void Mesh::setupVertexAttributes(unsigned int vertexBuffer, unsigned int indexBuffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 
 	// vertex position
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -92,41 +343,118 @@ void Mesh::setupMesh()
 	// vertex texture coordinates
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 	glEnableVertexAttribArray(2);
+}
+
 
+GLVertexArray Mesh::createVertexArray(const InstanceBuffer& instances) const
+{
+	GLVertexArray vertexArray{ GLVertexArray::create() };
+
+	glState().bindVertexArray(vertexArray);
+	setupVertexAttributes(m_VBO, m_EBO);
+	instances.attach(vertexArray);
 
+	return vertexArray;
 }
 
 
-void Mesh::Draw(Shader& shader) const
+void Mesh::setInstances(const std::vector<glm::mat4>& transforms)
 {
-	// define N number of texture and specular textures
-	unsigned int diffuseN{ 1 };
-	unsigned int specularN{ 1 };
+	if (!m_instanceVBO)
+		m_instanceVBO = GLBuffer::create();
 
-	for (unsigned int i{ 0 }; i < textures.size(); ++i)
+	m_instanceCount = static_cast<unsigned int>(transforms.size());
+	m_instanceTransforms = transforms;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(),
+		GL_STATIC_DRAW);
+	gpuMemory().track(GLObjectType::Buffer, m_instanceVBO, MemoryCategory::MeshInstances, m_owner,
+		"instances", transforms.size() * sizeof(glm::mat4));
+
+	// both VAOs read the same instance buffer. The VAO binds go through the state
+	// cache, setInstances() may run mid-frame when an instance moves
+	for (unsigned int vertexArray : { m_VAO.id(), m_depthVAO.id() })
 	{
-		// Activate the corresponding texture unit before binding
-		glActiveTexture(GL_TEXTURE0 + i);
-		// retrieve texture number
-		std::string number{};
-		std::string name{ textures[i].type };	
+		glState().bindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+
+		// a mat4 attribute takes 4 consecutive locations, one vec4 per column.
+		// divisor 1 advances the attribute once per instance instead of per vertex
+		for (unsigned int i{ 0 }; i < 4; ++i)
+		{
+			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+				(void*)(i * sizeof(glm::vec4)));
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribDivisor(3 + i, 1);
+		}
+	}
+
+	glState().bindVertexArray(0);
+}
 
-		if (name == "texture_diffuse")
-			number = std::to_string(diffuseN++);	// assign first, then increment
 
-		else if (name == "texture_specular")
-			number = std::to_string(specularN++);
+void Mesh::setInstance(unsigned int index, const glm::mat4& transform)
+{
+	m_instanceTransforms[index] = transform;
 
-		shader.setInt(("material." + name + number).c_str(), i);
-		glBindTexture(GL_TEXTURE_2D, textures[i].id);
-	}
+	// GL_COPY_WRITE_BUFFER touches no VAO state
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_instanceVBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, index * sizeof(glm::mat4), sizeof(glm::mat4), &transform);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+void Mesh::bindMaterial() const
+{
+	// meshes sharing a material skip the binds entirely
+	for (const TextureBinding& binding : m_bindings)
+		glState().bindTexture(binding.unit, GL_TEXTURE_2D, binding.texture);
+}
+
+
+bool Mesh::sameMaterial(const Mesh& other) const
+{
+	// different ids are always different materials, equal ones may share the last id
+	return m_materialId == other.m_materialId && m_bindings == other.m_bindings;
+}
+
+
+void Mesh::Draw() const
+{
+	if (!isReady())
+		return;
+
+	bindMaterial();
+
+	// the VAO stays bound, the next draw binds its own anyway
+	glState().bindVertexArray(m_VAO);
+	glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, m_instanceCount);
+}
+
+
+void Mesh::DrawGeometry() const
+{
+	if (!isReady())
+		return;
 
-	// draw mesh
-	glBindVertexArray(m_VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	glState().bindVertexArray(m_depthVAO);
+	glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, m_instanceCount);
+}
+
+
+void Mesh::record(CommandList& list, bool withMaterial) const
+{
+	if (!isReady())
+		return;
+
+	if (withMaterial)
+	{
+		for (const TextureBinding& binding : m_bindings)
+			list.bindTexture(binding.unit, GL_TEXTURE_2D, binding.texture);
+	}
 
-	// set everything back to default once configured
-	glActiveTexture(GL_TEXTURE0);
+	list.bindVertexArray(withMaterial ? m_VAO : m_depthVAO);
+	list.drawElementsInstanced(static_cast<GLsizei>(indices.size()), static_cast<GLsizei>(m_instanceCount));
 }
 #endif // !MESH_H
@@ -1,29 +1,139 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <cmath>
+#include <memory>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "stb_image.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "IndirectDraw.h"
+#include "InstanceBuffer.h"
+#include "LightGrid.h"
+#include "Lights.h"
 #include "Shader.h"
 #include "Camera.h"
+#include "CommandList.h"
+#include "Culling.h"
+#include "DeferredRenderer.h"
+#include "FragmentCounter.h"
 #include "Mesh.h"
 #include "Model.h"
+#include "OcclusionBuffer.h"
+#include "OcclusionQueries.h"
+#include "RenderQueue.h"
+#include "ShaderVariants.h"
+#include "ShadowCache.h"
+#include "ThreadPool.h"
+#include "TextureUploader.h"
+#include "UniformBlocks.h"
+#include "UploadQueue.h"
 
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
-static constexpr int numCubeLight{ 4 };
-
 // for model loading 
-Model* currentModel = nullptr;
+std::unique_ptr<Model> currentModel{};
 std::string modelPath = "resources/models/Sponza-master/sponza.obj";
 float modelScale = 0.01f;
 
+void run(GLFWwindow* window);
 void modelLoading();
+void uploadStatistics(UploadQueue& uploadQueue, const TextureUploader& textureUploader);
+void gpuMemoryStatistics();
+void renderStatistics(const RenderQueue& renderQueue, const std::vector<CommandList>& shadowCommands,
+    const std::vector<CommandList>& dynamicShadowCommands, const std::vector<CommandList>& opaqueCommands,
+    const IndirectRenderer* indirectRenderer, const CullStats& shadowCulling, const CullStats& opaqueCulling,
+    const OcclusionQueries& occlusionQueries, const ShadowCache& shadowCache, const FragmentCounter& shadedFragments,
+    const DeferredRenderer& deferredRenderer, const LightGrid& lightGrid);
+void shaderVariantOptions(const ShaderVariants& forwardShaders, const ShaderVariants& gbufferShaders);
+void sceneQueries();
+
+// skip meshes outside the camera frustum (main pass) and the light frustum (shadow pass)
+bool frustumCulling{ true };
+
+// shadow pass: skip casters that cannot shadow anything the camera sees
+bool shadowCasterCulling{ true };
+
+// keep the static casters' shadow map while the light and the model stay put,
+// only moved meshes are drawn every frame
+bool shadowCaching{ true };
+
+// bob one instance up and down, it is drawn as a dynamic shadow caster on top of
+// the cached static ones. The amplitude is a fraction of the model's height
+bool moveInstance{ false };
+int movingInstance{ 0 };
+float movingAmplitude{ 0.05f };
+
+// move the selected instance for this frame, and put it back where it was when
+// another one is selected or moving is switched off
+void updateMovingInstance(float time);
+
+// how main pass meshes hidden behind others are skipped, on top of frustum culling
+enum class OcclusionMode
+{
+    Off,
+    Software,       // CPU depth buffer of the model's large occluders
+    Queries,        // GPU occlusion queries on mesh boxes, answers a frame late
+};
+
+OcclusionMode occlusionMode{ OcclusionMode::Software };
+
+// lay down the camera depth first, then shade with GL_EQUAL so every pixel runs
+// model.fs once instead of once per overlapping surface
+bool depthPrepass{ false };
+
+// forward shades the lights of each fragment's light grid cluster in model.fs,
+// deferred writes a G-buffer and draws the local lights as volumes over it
+enum class ShadingPath
+{
+    Forward,
+    Deferred,
+};
+
+ShadingPath shadingPath{ ShadingPath::Forward };
+
+// compile-time switches of model.fs and gbuffer.fs, one bit of a ShaderVariants
+// key each. shaderFeatures names their #defines in bit order
+enum ShaderFeature : ShaderVariants::Key
+{
+    FEATURE_BLINN = 1u << 0,
+    FEATURE_SHADOWS = 1u << 1,
+    FEATURE_LOCAL_LIGHTS = 1u << 2,
+    FEATURE_ALPHA_TEST = 1u << 3,
+};
+
+const std::vector<std::string> shaderFeatures{ "BLINN", "SHADOWS", "LOCAL_LIGHTS", "ALPHA_TEST" };
+
+// the directional light's shadow, off skips the shadow pass as well. The deferred
+// path always draws it
+bool shadows{ true };
+
+// the light grid's point and spot lights on the forward path
+bool localLights{ true };
+
+// discard texels below the alpha cut-off, for foliage and other cut-outs. The
+// depth prepass is skipped meanwhile, it would fill the holes with depth
+bool alphaTest{ false };
+
+// the variant the toggles select, blinn among them
+ShaderVariants::Key shaderVariantKey();
+
+// extra point lights spread over the model to load the light passes, with the
+// attenuation of one of the presets
+int scatteredLightCount{ 0 };
+int scatteredLightPreset{ 0 };
+constexpr float SCATTERED_LIGHT_BRIGHTNESS{ 0.5f };
+
+// draw the model with one glMultiDrawElementsIndirect per batch when the context can
+bool multiDrawIndirect{ true };
 
 // screen color
 glm::vec4 screenColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -41,6 +151,7 @@ DirLight dirLightData{};
 
 struct PointLight
 {
+    glm::vec3 position{};
     glm::vec3 ambient = glm::vec3(0.05f, 0.05f, 0.05f);
     glm::vec3 diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
     glm::vec3 specular = glm::vec3(1.0f, 1.0f, 1.0f);
@@ -49,9 +160,24 @@ struct PointLight
     float constant{ 1.0f };
     float linear{ 0.09f };
     float quadratic{ 0.032f };
+    int preset{ 4 };        // attenuationPreset index, 50 units
+};
+
+// the editor's point lights, as many as the UI adds
+std::vector<PointLight> pointLightData{
+    { glm::vec3(0.7f,  0.2f,  2.0f) },
+    { glm::vec3(2.3f, -3.3f, -4.0f) },
+    { glm::vec3(-4.0f,  2.0f, -12.0f) },
+    { glm::vec3(0.0f,  0.0f, -3.0f) },
 };
 
-PointLight pointLightData[numCubeLight];
+// distance at which a point light's attenuation takes its brightest diffuse
+// channel below one 8 bit step, nothing further away is lit by it
+float pointLightRange(const PointLight& light);
+
+// the editor's and the scattered point lights for the light grid and the deferred
+// light volumes. ambient receives the editor lights' ambient terms, which reach everywhere
+void fillPointLights(std::vector<GpuPointLight>& lights, glm::vec3& ambient, const glm::mat4& model);
 
 
 struct SpotLight
@@ -72,6 +198,13 @@ struct SpotLight
 SpotLight spotLightData{};
 
 
+// copy the ImGui light settings into the std140 lights block, once per frame
+void fillLightsBlock(LightsBlock& lights, const Camera& camera, const glm::vec3& pointAmbient);
+
+// the flashlight, the only spot light so far
+void fillSpotLights(std::vector<GpuSpotLight>& lights, const Camera& camera);
+
+
 void directionalLightChange();
 void pointLightChange();
 void spotLightChange();
@@ -99,14 +232,14 @@ static AttenuationPreset attenuationPreset[]{
 
 static const int numPreset = IM_ARRAYSIZE(attenuationPreset);
 
-// track which preset is being selected with each light
-static int selectedPresetIndex[4] = { 4,4,4,4 };    // default to 50 units
+// track which preset is being selected for the spotlight, point lights keep their own
 static int selectSpotlightIndex = 4;
 
 // check blinn phong model
 bool blinn = false;
 bool blinnKeyPress = false;
 
+// framebuffer size, kept up to date by framebuffer_size_callback
 float SCR_WIDTH{ 1920.0f };
 float SCR_HEIGHT{ 1080.0f };
 
@@ -162,7 +295,13 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    // a minimized window reports 0 x 0, keep the last size until it comes back
+    if (width <= 0 || height <= 0)
+        return;
+
+    SCR_WIDTH = static_cast<float>(width);
+    SCR_HEIGHT = static_cast<float>(height);
+    glState().viewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window)
@@ -221,27 +360,26 @@ void processInput(GLFWwindow* window)
 }
 
 // load cube map
-unsigned int loadCubeMap(const std::vector<std::string>& faces);
-
-glm::vec3 pointLightPositions[] = {
-glm::vec3(0.7f,  0.2f,  2.0f),
-glm::vec3(2.3f, -3.3f, -4.0f),
-glm::vec3(-4.0f,  2.0f, -12.0f),
-glm::vec3(0.0f,  0.0f, -3.0f)
-};
-
-
+GLTexture loadCubeMap(const std::vector<std::string>& faces);
 
 int main()
 {
 
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    // first create a window
-    GLFWwindow* window{ glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Lighting", NULL, NULL) };
+    // first create a window. 4.6 enables the multi-draw indirect path, everything
+    // else runs on 3.3
+    const int contextVersions[][2]{ { 4, 6 }, { 3, 3 } };
+    GLFWwindow* window{ nullptr };
+    for (const auto& version : contextVersions)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Lighting", NULL, NULL);
+        if (window)
+            break;
+    }
 
 
     if (window == nullptr)
@@ -259,6 +397,10 @@ int main()
         return -1;
     }
 
+    loadIndirectDrawing((GLADloadproc)glfwGetProcAddress);
+    programCache().open((GLADloadproc)glfwGetProcAddress, "shadercache");
+    loadParallelShaderCompile((GLADloadproc)glfwGetProcAddress);
+
     // set this before cursor callback
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -285,10 +427,58 @@ int main()
     //stbi_set_flip_vertically_on_load(true);
 
     // Enable Depth test (Z-buffer) to correctly render cube
-    glEnable(GL_DEPTH_TEST);
+    glState().enable(GL_DEPTH_TEST, true);
+
+    // everything that owns GL objects lives in run(), so all of it is released
+    // while the context is still current
+    run(window);
+
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+
+    // anything reported here was created through a GLHandle and never deleted
+    glObjects().report();
+
+    glfwTerminate();
+    return 0;
+}
+
+
+
+
+
+// set up the scene and run the render loop until the window closes
+void run(GLFWwindow* window)
+{
+    // worker threads decode textures and feed the upload queue, the render loop
+    // drains it within a per-frame time budget
+    ThreadPool threadPool{};
+
+    // frame preparation (sort keys, block packing, command recording) gets its own
+    // workers, a frame must never wait behind a queue of texture decodes
+    ThreadPool renderPool{};
+    UploadQueue uploadQueue{};
+    TextureUploader textureUploader{ threadPool, uploadQueue };
+    activeUploadQueue = &uploadQueue;
+    activeTextureUploader = &textureUploader;
+    activeRenderPool = &renderPool;
 
     // Initialize our shader
-    Shader shader("resources/shader/model.vs", "resources/shader/model.fs");
+    // the constructors only issue the compiles, the driver works through them
+    // while the model loads. Each program is finished when it is first used
+    double shaderStart{ glfwGetTime() };
+
+    // model.fs and gbuffer.fs come in variants, see shaderFeatures. Both get every
+    // feature define and the same setup, the G-buffer simply has no light grid
+    auto setupModelShader{ [](const Shader& variant, ShaderVariants::Key)
+        {
+            // sampler -> texture unit assignments never change, set them once
+            bindMaterialSamplers(variant);
+            LightGrid::bindSamplers(variant);
+            variant.setFloat("material.shininess", 32.0f); // Typical range: 8.0 to 256.0
+            bindUniformBlocks(variant);
+        } };
 
     Shader lightCubeShader{ "resources/shader/lightVertex.vs",  "resources/shader/lightFragment.fs" };
 
@@ -296,8 +486,92 @@ int main()
 
     Shader simpleDepthShader("resources/shader/shadowDepth.vs", "resources/shader/shadowDepth.fs");
 
+    Shader occlusionBoxShader{ "resources/shader/occlusionBox.vs", "resources/shader/occlusionBox.fs" };
+
+    Shader prepassShader{ "resources/shader/depthPrepass.vs", "resources/shader/shadowDepth.fs" };
+
+    // deferred path: G-buffer fill, then the lights. Only BLINN changes the lighting
+    // shaders, the frame loop masks the key down to it
+    auto setupDeferredShader{ [](const Shader& variant, ShaderVariants::Key)
+        {
+            DeferredRenderer::bindSamplers(variant);
+            bindUniformBlocks(variant);
+        } };
+    ShaderVariants deferredDirectionalShaders{ "resources/shader/deferred.vs",
+        "resources/shader/deferredDirectional.fs", shaderFeatures, setupDeferredShader };
+    ShaderVariants deferredPointShaders{ "resources/shader/deferredPoint.vs", "resources/shader/deferredPoint.fs",
+        shaderFeatures, setupDeferredShader };
+    ShaderVariants deferredSpotShaders{ "resources/shader/deferredSpot.vs", "resources/shader/deferredSpot.fs",
+        shaderFeatures, setupDeferredShader };
+
+    // GLSL 4.60 versions of the model and depth vertex shaders, only on a 4.6 context
+    std::unique_ptr<ShaderVariants> indirectForwardShaders{};
+    std::unique_ptr<Shader> indirectDepthShader{};
+    std::unique_ptr<Shader> indirectPrepassShader{};
+    std::unique_ptr<ShaderVariants> indirectGbufferShaders{};
+    std::unique_ptr<IndirectRenderer> indirectRenderer{};
+    if (indirectDrawing().supported)
+    {
+        indirectForwardShaders = std::make_unique<ShaderVariants>("resources/shader/modelIndirect.vs",
+            "resources/shader/model.fs", shaderFeatures, setupModelShader);
+        indirectDepthShader = std::make_unique<Shader>("resources/shader/shadowDepthIndirect.vs",
+            "resources/shader/shadowDepth.fs");
+        indirectPrepassShader = std::make_unique<Shader>("resources/shader/depthPrepassIndirect.vs",
+            "resources/shader/shadowDepth.fs");
+        indirectGbufferShaders = std::make_unique<ShaderVariants>("resources/shader/modelIndirect.vs",
+            "resources/shader/gbuffer.fs", shaderFeatures, setupModelShader);
+        indirectRenderer = std::make_unique<IndirectRenderer>();
+    }
+
+    // a new variant brings its indirect twin along
+    ShaderVariants forwardShaders{ "resources/shader/model.vs", "resources/shader/model.fs", shaderFeatures,
+        [&](const Shader& variant, ShaderVariants::Key key)
+        {
+            setupModelShader(variant, key);
+            if (indirectRenderer)
+                indirectRenderer->addProgram(variant, indirectForwardShaders->get(key).shader);
+        } };
+    ShaderVariants gbufferShaders{ "resources/shader/model.vs", "resources/shader/gbuffer.fs", shaderFeatures,
+        [&](const Shader& variant, ShaderVariants::Key key)
+        {
+            setupModelShader(variant, key);
+            if (indirectRenderer)
+                indirectRenderer->addProgram(variant, indirectGbufferShaders->get(key).shader);
+        } };
+
+    // the first frame needs the selected variant anyway
+    forwardShaders.prepare(shaderVariantKey());
+    if (indirectForwardShaders)
+        indirectForwardShaders->prepare(shaderVariantKey());
+    for (ShaderVariants* lighting : { &deferredDirectionalShaders, &deferredPointShaders, &deferredSpotShaders })
+        lighting->prepare(shaderVariantKey() & FEATURE_BLINN);
+    double shaderIssue{ glfwGetTime() - shaderStart };
+
     // load models
-    currentModel = new Model(modelPath);
+    currentModel = std::make_unique<Model>(modelPath);
+
+    // wait for whatever the driver has not finished yet. Near zero on a warm
+    // start, every program comes from the cache
+    double shaderWait{ glfwGetTime() };
+    ShaderBatch startupShaders{ &lightCubeShader, &cubeMapShader, &simpleDepthShader, &occlusionBoxShader,
+        &prepassShader };
+    if (indirectRenderer)
+    {
+        startupShaders.add(*indirectDepthShader);
+        startupShaders.add(*indirectPrepassShader);
+    }
+    std::size_t stillCompiling{ startupShaders.compilingCount() };
+    startupShaders.finish();
+    forwardShaders.get(shaderVariantKey());
+    std::cout << "Shaders: " << shaderIssue * 1000.0 << " ms to issue, " << (glfwGetTime() - shaderWait) * 1000.0
+        << " ms waited after loading the model (" << stillCompiling << " still compiling), "
+        << programCache().loadedCount() << " cached, " << programCache().compiledCount() << " compiled\n";
+
+    if (indirectRenderer)
+    {
+        indirectRenderer->addProgram(simpleDepthShader, *indirectDepthShader);
+        indirectRenderer->addProgram(prepassShader, *indirectPrepassShader);
+    }
 
     // cube vertices data
   // this time with Normal vector as the 2nd attribue
@@ -404,44 +678,50 @@ int main()
         "resources/textures/skybox/front.jpg",
     };
 
-    unsigned int skyboxTexture{ loadCubeMap(faces) };
+    GLTexture skyboxTexture{ loadCubeMap(faces) };
 
     // flip back to load model correctly
     stbi_set_flip_vertically_on_load(true);
     // cube map box
-    unsigned int skyboxVAO, skyboxVBO;
-    glGenBuffers(1, &skyboxVBO);
-    glGenVertexArrays(1, &skyboxVAO);
+    GLBuffer skyboxVBO{ GLBuffer::create() };
+    GLVertexArray skyboxVAO{ GLVertexArray::create() };
     glBindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    gpuMemory().track(GLObjectType::Buffer, skyboxVBO, MemoryCategory::SceneGeometry, 0, "skybox box",
+        sizeof(skyboxVertices));
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    unsigned int lightVAO{}, VBO{};
-    glGenVertexArrays(1, &lightVAO);
-    glGenBuffers(1, &VBO);
+    GLVertexArray lightVAO{ GLVertexArray::create() };
+    GLBuffer VBO{ GLBuffer::create() };
     glBindVertexArray(lightVAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    gpuMemory().track(GLObjectType::Buffer, VBO, MemoryCategory::SceneGeometry, 0, "light cube",
+        sizeof(vertices));
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
+    // every light cube is one instance, drawn together in a single call
+    InstanceBuffer lightCubeInstances{ "light cube instances", pointLightData.size() };
+    lightCubeInstances.attach(lightVAO);
+
     // framebuffer for depth map
-    unsigned int depthMapFBO{};
-    glGenFramebuffers(1, &depthMapFBO);
+    GLFramebuffer depthMapFBO{ GLFramebuffer::create() };
 
     // depth map resolution
     unsigned int SHADOW_WIDTH = 1024;
     unsigned int SHADOW_HEIGHT = 1024;
 
-    unsigned int depthMap{};
-    glGenTextures(1, &depthMap);
+    GLTexture depthMap{ GLTexture::create() };
     glBindTexture(GL_TEXTURE_2D, depthMap);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT,
         0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    gpuMemory().track(GLObjectType::Texture, depthMap, MemoryCategory::ShadowMap, 0, "directional shadow map",
+        textureBytes(SHADOW_WIDTH, SHADOW_HEIGHT, GL_DEPTH_COMPONENT, false));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -456,13 +736,69 @@ int main()
     glDrawBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    ShadowCache shadowCache{ (int)SHADOW_WIDTH, (int)SHADOW_HEIGHT };
+    // the depth map holds exactly the cached static casters, nothing to draw
+    bool shadowMapStatic{ false };
 
-    shader.use();
-    shader.setInt("shadowMap", 1);
 
     cubeMapShader.use();
     cubeMapShader.setInt("skybox", 0);
 
+    // camera, frame and light data live in uniform buffers shared by every shader
+    UniformBlockBuffer<CameraBlock> cameraBlock{ CAMERA_BLOCK_BINDING, "camera block" };
+    UniformBlockBuffer<FrameBlock> frameBlock{ FRAME_BLOCK_BINDING, "frame block" };
+    UniformBlockBuffer<LightsBlock> lightsBlock{ LIGHTS_BLOCK_BINDING, "lights block" };
+    UniformBlockBuffer<ClustersBlock> clustersBlock{ CLUSTERS_BLOCK_BINDING, "clusters block" };
+
+    bindUniformBlocks(lightCubeShader);
+    bindUniformBlocks(cubeMapShader);
+    bindUniformBlocks(simpleDepthShader);
+    bindUniformBlocks(occlusionBoxShader);
+    bindUniformBlocks(prepassShader);
+    if (indirectRenderer)
+    {
+        bindUniformBlocks(*indirectDepthShader);
+        bindUniformBlocks(*indirectPrepassShader);
+    }
+
+    // the few uniforms the render loop still sets one by one
+    Uniform<glm::mat4> depthModel{ simpleDepthShader.uniform<glm::mat4>("model") };
+    Uniform<glm::mat4> prepassModel{ prepassShader.uniform<glm::mat4>("model") };
+
+    FrameBlock frameData{};
+    CameraBlock cameraData{};
+    LightsBlock lightsData{};
+
+    // every model draw of both passes goes through here, sorted by state and depth
+    RenderQueue renderQueue{};
+
+    // recorded on the render workers, replayed here. Kept across frames so the
+    // command buffers stop allocating after the first few frames
+    CommandList frameCommands{};
+    std::vector<CommandList> shadowCommands{};
+    std::vector<CommandList> dynamicShadowCommands{};
+    std::vector<CommandList> prepassCommands{};
+    std::vector<CommandList> opaqueCommands{};
+    constexpr std::size_t MIN_DRAWS_PER_LIST{ 128 };
+
+    CullStats shadowCulling{};
+    CullStats opaqueCulling{};
+
+    // a few thousand tiles is plenty to find what the walls and pillars hide
+    OcclusionBuffer occlusionBuffer{ 320, 180 };
+    OcclusionQueries occlusionQueries{ occlusionBoxShader };
+
+    // fragments the main pass shades, tagged with whether the prepass was on
+    FragmentCounter shadedFragments{};
+
+    DeferredRenderer deferredRenderer{ (int)SCR_WIDTH, (int)SCR_HEIGHT, deferredDirectionalShaders,
+        deferredPointShaders, deferredSpotShaders };
+
+    // the forward path's lights, sorted into view space clusters every frame
+    LightGrid lightGrid{};
+    std::vector<GpuPointLight> pointLights{};
+    std::vector<GpuSpotLight> spotLights{};
+
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 
@@ -476,6 +812,14 @@ int main()
         ImGui::NewFrame();
 
         processInput(window);
+        glState().beginFrame();
+
+        // stream pending buffer / texture data without going over the frame budget
+        uploadQueue.drain();
+
+        // ImGui, the upload steps and model loading bind state directly. Forget what
+        // the cache knows, the first call of each kind this frame goes to the driver
+        glState().invalidate();
 
         // clear buffer color and set the windows color
         glClearColor(screenColor.r, screenColor.g, screenColor.b, screenColor.a);
@@ -490,7 +834,6 @@ int main()
         // Shadow mapping
         // first pass: render the depth map
        
-        simpleDepthShader.use();
         glm::mat4 model = glm::mat4(1.0f);
 
         // 2. Use lightPos as the first argument
@@ -501,139 +844,304 @@ int main()
 
         float near_plane = 1.0f;
         float far_plane = 25.0f;
-        glm::mat4 lightProjection = glm::ortho(-25.0f, 25.0f, -25.0f, 25.0f, near_plane, far_plane);
+        float shadowHalfSize = 25.0f;
+        glm::mat4 lightProjection = glm::ortho(-shadowHalfSize, shadowHalfSize, -shadowHalfSize, shadowHalfSize,
+            near_plane, far_plane);
         glm::mat4 lightSpaceMatrix = lightProjection * lightView;
 
-        glCullFace(GL_FRONT);
-        simpleDepthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-    
-        // render the loaded model
+        // the G-buffer follows the window, does nothing while the size stays the same
+        deferredRenderer.resize((int)SCR_WIDTH, (int)SCR_HEIGHT);
+
+        // transformation
+        glm::mat4 view{ camera.GetViewMatrix() };
+        glm::mat4 projection{ glm::perspective((45.0f), SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f) };
+        lightGrid.setProjection(projection, 0.1f, 100.0f, SCR_WIDTH, SCR_HEIGHT);
+
+        // queue the model for both passes and sort once
+        bool indirect{ indirectRenderer && multiDrawIndirect };
+        Frustum lightFrustum{ Frustum::fromMatrix(lightSpaceMatrix) };
+        Frustum cameraFrustum{ Frustum::fromMatrix(projection * view) };
+
+        renderQueue.clear();
+        shadowCulling = CullStats{};
+        opaqueCulling = CullStats{};
+
+        // the opaque pass fills the G-buffer instead of shading on the deferred path
+        // the variant the toggles select is compiled here the first time
+        bool deferred{ shadingPath == ShadingPath::Deferred };
+        ShaderVariants::Key variantKey{ shaderVariantKey() };
+        ShaderVariants::Program opaqueProgram{ deferred ? gbufferShaders.get(variantKey & FEATURE_ALPHA_TEST)
+            : forwardShaders.get(variantKey) };
+        const Shader& opaqueShader{ opaqueProgram.shader };
+        Uniform<glm::mat4> opaqueModel{ opaqueProgram.model };
+
+        // deferredDirectional.fs always reads the shadow map. The prepass shader
+        // cannot discard, alpha tested surfaces would leave holes
+        bool castShadows{ shadows || deferred };
+        bool prepass{ depthPrepass && !alphaTest };
+
+        // static casters are drawn into the cache only when it is out of date, the
+        // depth map is rebuilt from it only when something changed or moves
+        bool caching{ shadowCaching && currentModel && castShadows };
+        bool cacheValid{ false };
+        bool drawDynamic{ false };
+        ShadowCacheKey shadowKey{};
+
+        updateMovingInstance(currentFrame);
         if (currentModel)
         {
+            if (indirectRenderer)
+                currentModel->prepareIndirect();
+
             model = glm::mat4(1.0f);
             model = glm::scale(model, glm::vec3(modelScale));
-            simpleDepthShader.setMat4("model", model);
-            currentModel->Draw(simpleDepthShader);
-        }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glCullFace(GL_BACK);
+            if (caching)
+            {
+                shadowKey = { lightSpaceMatrix, model, currentModel->assetId(), currentModel->casterVersion(),
+                    currentModel->readyMeshCount() };
+                cacheValid = shadowCache.lookup(shadowKey);
+                drawDynamic = currentModel->dynamicMeshCount() > 0;
+            }
 
+            // occlusion is tested on the instances the frustum keeps, and only from the camera
+            const OcclusionBuffer* occluders{ nullptr };
+            const std::vector<std::uint8_t>* hiddenMeshes{ nullptr };
+            if (frustumCulling && occlusionMode == OcclusionMode::Software)
+            {
+                currentModel->rasterizeOccluders(occlusionBuffer, renderPool, projection * view, model);
+                occluders = &occlusionBuffer;
+            }
+            else if (frustumCulling && occlusionMode == OcclusionMode::Queries)
+            {
+                occlusionQueries.collect(*currentModel);
+                hiddenMeshes = &occlusionQueries.hidden();
+            }
 
-        // second render pass: draw as normal with depth map
-        // ----------------------------------
-        // reset viewport
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+            opaqueCulling = currentModel->submit(renderQueue, renderPool, RenderPass::Opaque, opaqueShader, opaqueModel,
+                model, view, 100.0f, frustumCulling ? &cameraFrustum : nullptr, occluders, hiddenMeshes,
+                prepass ? &prepassShader : nullptr, prepassModel);
 
-        //glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            // only casters that can shadow a visible receiver matter: shrink the light's
+            // box to the receivers in light space, keeping everything from the light's
+            // near plane up to the farthest receiver
+            Frustum casterFrustum{ lightFrustum };
+            bool anyCasters{ true };
+            if (frustumCulling && shadowCasterCulling)
+            {
+                glm::vec3 receiversMin{ opaqueCulling.boundsMin };
+                glm::vec3 receiversMax{ opaqueCulling.boundsMax };
+                anyCasters = receiversMin.x <= receiversMax.x;
+                if (anyCasters)
+                {
+                    transformBounds(lightView * model, receiversMin, receiversMax);
+                    float left{ std::max(-shadowHalfSize, receiversMin.x) };
+                    float right{ std::min(shadowHalfSize, receiversMax.x) };
+                    float bottom{ std::max(-shadowHalfSize, receiversMin.y) };
+                    float top{ std::min(shadowHalfSize, receiversMax.y) };
+                    float farthest{ std::min(far_plane, -receiversMin.z) };
+
+                    anyCasters = left < right && bottom < top && farthest > near_plane;
+                    if (anyCasters)
+                        casterFrustum = Frustum::fromMatrix(
+                            glm::ortho(left, right, bottom, top, near_plane, farthest) * lightView);
+                }
+            }
 
-        shader.use();
+            // a cache being redrawn has to hold every static caster the light sees, wherever
+            // the camera is. A valid one only leaves the dynamic casters, culled as usual
+            if (caching && !cacheValid)
+            {
+                shadowCulling = currentModel->submit(renderQueue, renderPool, RenderPass::Shadow, simpleDepthShader,
+                    depthModel, model, lightView, far_plane, frustumCulling ? &lightFrustum : nullptr);
+            }
+            else if (castShadows && anyCasters && (!caching || drawDynamic))
+            {
+                shadowCulling = currentModel->submit(renderQueue, renderPool, RenderPass::Shadow, simpleDepthShader,
+                    depthModel, model, lightView, far_plane, frustumCulling ? &casterFrustum : nullptr);
+            }
+        }
+        renderQueue.sort();
+        bool drawShadows{ castShadows && (!caching || !cacheValid || drawDynamic || !shadowMapStatic) };
 
-        // transformation
-        model = glm::mat4(1.0f) ;         // set to identity matrix
-        glm::mat4 view{ glm::mat4(1.0f) };          // set to identity matrix
-        glm::mat4 projection{ glm::mat4(1.0f) };    // set to identity matrix
+        // both shading paths light the scene with the same point lights
+        glm::vec3 pointAmbient{};
+        fillPointLights(pointLights, pointAmbient, model);
+        fillSpotLights(spotLights, camera);
 
+        // pack the uniform blocks on one worker while the others record both passes.
+        // Nothing below touches GL until every list is complete
+        std::future<void> packing{ renderPool.submit([&]()
+            {
+                frameCommands.clear();
+
+                frameData.lightSpaceMatrix = lightSpaceMatrix;
+                frameData.time = currentFrame;
+                frameData.deltaTime = deltaTime;
+                frameBlock.record(frameCommands, frameData);
+
+                cameraData.view = view;
+                cameraData.projection = projection;
+                cameraData.viewPos = glm::vec4(camera.Position, 1.0f);
+                cameraBlock.record(frameCommands, cameraData);
+
+                fillLightsBlock(lightsData, camera, pointAmbient);
+                lightsBlock.record(frameCommands, lightsData);
+                clustersBlock.record(frameCommands, lightGrid.block());
+            }) };
+
+        // the indirect path builds its commands below instead
+        // static casters of a valid cache are queued but never drawn
+        if (indirect || (caching && cacheValid))
+            shadowCommands.clear();
+        else
+            renderQueue.record(renderPool, RenderPass::Shadow, shadowCommands, MIN_DRAWS_PER_LIST);
 
-        view = camera.GetViewMatrix();
-        projection = glm::perspective((45.0f), SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
-        shader.setFloat("material.shininess", 32.0f); // Typical range: 8.0 to 256.0
+        if (indirect)
+        {
+            dynamicShadowCommands.clear();
+            prepassCommands.clear();
+            opaqueCommands.clear();
+        }
+        else
+        {
+            renderQueue.record(renderPool, RenderPass::DynamicShadow, dynamicShadowCommands, MIN_DRAWS_PER_LIST);
+            renderQueue.record(renderPool, RenderPass::DepthPrepass, prepassCommands, MIN_DRAWS_PER_LIST);
+            renderQueue.record(renderPool, RenderPass::Opaque, opaqueCommands, MIN_DRAWS_PER_LIST);
+        }
 
+        // the deferred path draws light volumes instead
+        bool useLightGrid{ !deferred && localLights };
+        if (useLightGrid)
+            lightGrid.build(renderPool, view, pointLights, spotLights);
+        packing.get();
 
-        shader.setVec3("viewPos", camera.Position);
+        // blocks first, the depth pass reads lightSpaceMatrix from the frame block
+        frameCommands.replay();
+        if (indirect)
+            indirectRenderer->prepare(renderQueue);
 
-        shader.setMat4("view", view);
-        shader.setMat4("projection", projection);
-        shader.setBool("blinn", blinn);
+        if (drawShadows)
+        {
+            glState().cullFace(GL_FRONT);
+            glState().viewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 
+            // render the loaded model, static casters into the cache when caching
+            if (!caching || !cacheValid)
+            {
+                glState().bindFramebuffer(caching ? shadowCache.framebuffer() : (unsigned int)depthMapFBO);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                if (indirect)
+                    indirectRenderer->execute(RenderPass::Shadow);
+                else
+                    replayAll(shadowCommands);
+
+                if (caching)
+                    shadowCache.store(shadowKey);
+            }
 
-        // for directional lights
-        shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-        shader.setVec3("dirLight.direction", dirLightData.direction);
-        shader.setVec3("dirLight.ambient", dirLightData.ambient);
-        shader.setVec3("dirLight.diffuse", dirLightData.diffuse);
-        shader.setVec3("dirLight.specular", dirLightData.specular);
+            // moved casters on top of a copy of the static ones
+            if (caching)
+                shadowCache.copyTo(depthMapFBO);
+            if (indirect)
+                indirectRenderer->execute(RenderPass::DynamicShadow);
+            else
+                replayAll(dynamicShadowCommands);
+
+            shadowMapStatic = caching && !drawDynamic;
+            glState().bindFramebuffer(0);
+            glState().cullFace(GL_BACK);
+        }
 
-        // for point lights
-        for (int i{ 0 }; i < 4; ++i)
-        {
-            shader.setVec3("pointLights[" + std::to_string(i) + "].position",
-                pointLightPositions[i]);
-            shader.setVec3("pointLights[" + std::to_string(i) + "].ambient",
-                pointLightData[i].ambient);
-            shader.setVec3("pointLights[" + std::to_string(i) + "].diffuse",
-                pointLightData[i].diffuse);
-            shader.setVec3("pointLights[" + std::to_string(i) + "].specular",
-                pointLightData[i].specular);
-            shader.setFloat("pointLights[" + std::to_string(i) + "].constant",
-                1.0f);
-            shader.setFloat("pointLights[" + std::to_string(i) + "].linear",
-                pointLightData[i].linear);
-            shader.setFloat("pointLights[" + std::to_string(i) + "].quadratic",
-                pointLightData[i].quadratic);
 
-        }
+        // second render pass: draw as normal with depth map
+        // ----------------------------------
+        // reset viewport
+        glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
-        // for spotlight - flashlight
-        shader.setVec3("spotLight.position", camera.Position);
-        shader.setVec3("spotLight.direction", camera.Front);
-        shader.setFloat("spotLight.cutOff", cos(glm::radians(spotLightData.cutOff)));
-        shader.setFloat("spotLight.outerCutOff", cos(glm::radians(spotLightData.outerCutOff)));
+        //glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (deferred)
+            deferredRenderer.beginGeometry();
 
-        shader.setVec3("spotLight.ambient", spotLightData.ambient);
-        shader.setVec3("spotLight.diffuse", spotLightData.diffuse);
-        shader.setVec3("spotLight.specular", spotLightData.specular);
+        glState().bindTexture(SHADOW_MAP_TEXTURE_UNIT, GL_TEXTURE_2D, depthMap);
+        if (useLightGrid)
+        {
+            lightGrid.upload(pointLights, spotLights);
+            lightGrid.bind();
+        }
 
-        shader.setFloat("spotLight.constant", 1.0f);
-        shader.setFloat("spotLight.linear", spotLightData.linear);
-        shader.setFloat("spotLight.quadratic", spotLightData.quadratic);
+        // depth only, then only the nearest surface of each pixel passes GL_EQUAL.
+        // depthPrepass.vs positions vertices exactly like model.vs (invariant)
+        if (prepass)
+        {
+            glState().colorMask(false, false, false, false);
+            if (indirect)
+                indirectRenderer->execute(RenderPass::DepthPrepass);
+            else
+                replayAll(prepassCommands);
+            glState().colorMask(true, true, true, true);
+
+            glState().depthFunc(GL_EQUAL);
+            glState().depthMask(false);
+        }
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
+        shadedFragments.begin(prepass ? 1 : 0);
+        if (indirect)
+            indirectRenderer->execute(RenderPass::Opaque);
+        else
+            replayAll(opaqueCommands);
+        shadedFragments.end();
 
-        if (currentModel)
+        if (prepass)
         {
-            model = glm::mat4(1.0f);
-            model = glm::scale(model, glm::vec3(modelScale));
-            shader.setMat4("model", model);
-            currentModel->Draw(shader);
+            glState().depthFunc(GL_LESS);
+            glState().depthMask(true);
         }
 
+        // query against the finished depth, hidden meshes are drawn conditionally
+        if (currentModel && frustumCulling && occlusionMode == OcclusionMode::Queries)
+            occlusionQueries.issue(*currentModel, model, cameraFrustum, camera.Position, opaqueShader, opaqueModel);
 
-        lightCubeShader.use();
-        lightCubeShader.setMat4("view", view);
-        lightCubeShader.setMat4("projection", projection);
+        // light the G-buffer into the default framebuffer, which gets its depth
+        if (deferred)
+        {
+            deferredRenderer.pointLights() = pointLights;
+
+            SpotLightVolume spot{};
+            spot.position = camera.Position;
+            spot.direction = camera.Front;
+            spot.range = attenuationRange(1.0f, spotLightData.linear, spotLightData.quadratic,
+                std::max(spotLightData.diffuse.r, std::max(spotLightData.diffuse.g, spotLightData.diffuse.b)));
+            spot.outerCutOff = cos(glm::radians(spotLightData.outerCutOff));
+
+            deferredRenderer.shade(view, projection, spot, variantKey & FEATURE_BLINN);
+        }
 
-        glBindVertexArray(lightVAO);
 
-        for (int i{ 0 }; i < numCubeLight; ++i)
+        // positions and colours can change in the editor, refresh the instances
+        lightCubeInstances.resize(pointLightData.size());
+        for (std::size_t i{ 0 }; i < pointLightData.size(); ++i)
         {
             model = glm::mat4(1.0f);
-            model = glm::translate(model, pointLightPositions[i]);
+            model = glm::translate(model, pointLightData[i].position);
             model = glm::scale(model, glm::vec3(0.5f));
-            lightCubeShader.setMat4("model", model);
-
-            lightCubeShader.setVec3("lightColor", pointLightData[i].diffuse);
-
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+            lightCubeInstances[i] = { model, glm::vec4(pointLightData[i].diffuse, 1.0f) };
         }
+        lightCubeInstances.upload();
+
+        lightCubeShader.use();
+        lightCubeInstances.drawArrays(lightVAO, GL_TRIANGLES, 0, 36);
 
         // draw the skybox last to save performance
         //
-        glDepthFunc(GL_LEQUAL);
+        glState().depthFunc(GL_LEQUAL);
+        // view and projection come from the camera block, cubemap.vs drops the translation
         cubeMapShader.use();
-        // remove translation
-        glm::mat4 skyboxView = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-        cubeMapShader.setMat4("view", skyboxView);
-        cubeMapShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+        glState().bindVertexArray(skyboxVAO);
+        glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthFunc(GL_LESS);
+        glState().depthFunc(GL_LESS);
 
 
         // call every time resizing a window
@@ -655,6 +1163,13 @@ int main()
             directionalLightChange();
             pointLightChange();
             spotLightChange();
+            uploadStatistics(uploadQueue, textureUploader);
+            gpuMemoryStatistics();
+            renderStatistics(renderQueue, shadowCommands, dynamicShadowCommands, opaqueCommands,
+                indirectRenderer.get(), shadowCulling, opaqueCulling, occlusionQueries, shadowCache, shadedFragments,
+                deferredRenderer, lightGrid);
+            shaderVariantOptions(forwardShaders, gbufferShaders);
+            sceneQueries();
 
 
             ImGui::End();
@@ -669,19 +1184,18 @@ int main()
         glfwPollEvents();
     }
 
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    // workers must be done with the queue before it goes away
+    activeRenderPool = nullptr;
+    activeTextureUploader = nullptr;
+    activeUploadQueue = nullptr;
+    textureUploader.waitForDecodes();
+    uploadQueue.release();
 
-
-    glfwTerminate();
-    return 0;
+    currentModel.reset();
 }
 
 
 
-
-
 void modelLoading()
 {
 
@@ -703,16 +1217,18 @@ void modelLoading()
 
 
 
+    // should return to the same value after every reload
+    ImGui::Text("Live GL objects: %d", (int)glObjects().liveCount());
+
     if (ImGui::Button("Load Model"))
     {
-        // delete old model if exist
-        delete currentModel;
-        currentModel = nullptr;
+        // delete old model if exist, this releases all of its GL objects
+        currentModel.reset();
 
         // else try to load new model
         try
         {
-            currentModel = new Model(modelPath);
+            currentModel = std::make_unique<Model>(modelPath);
         }
         catch (...)
         {
@@ -766,125 +1282,52 @@ void pointLightChange()
 {
     if (ImGui::TreeNode("Point Lighting"))
     {
-        if (ImGui::TreeNode("position"))
+        // the light grid takes any number of them, new ones start in front of the camera
+        if (ImGui::Button("Add point light"))
         {
-            ImGui::SliderFloat3("light 1 position", glm::value_ptr(pointLightPositions[0]),
-                -10.0f, 10.0f);
-            ImGui::SliderFloat3("light 2 position", glm::value_ptr(pointLightPositions[1]),
-                -10.0f, 10.0f);
-            ImGui::SliderFloat3("light 3 position", glm::value_ptr(pointLightPositions[2]),
-                -10.0f, 10.0f);
-            ImGui::SliderFloat3("light 4 position", glm::value_ptr(pointLightPositions[3]),
-                -10.0f, 10.0f);
-            // display the list 
-            ImGui::TreePop();
+            PointLight light{};
+            light.position = camera.Position + camera.Front * 2.0f;
+            pointLightData.push_back(light);
         }
 
-        if (ImGui::TreeNode("lighting"))
+        int removed{ -1 };
+        for (std::size_t i{ 0 }; i < pointLightData.size(); ++i)
         {
-            if (ImGui::TreeNode("Point light 1"))
+            PointLight& light{ pointLightData[i] };
+            std::string label = "Point light " + std::to_string(i + 1);
+            if (ImGui::TreeNode(label.c_str()))
             {
-                ImGui::ColorEdit3("Ambient", glm::value_ptr(pointLightData[0].ambient));
-                ImGui::ColorEdit3("Diffuse", glm::value_ptr(pointLightData[0].diffuse));
-                ImGui::ColorEdit3("Specular", glm::value_ptr(pointLightData[0].specular));
+                ImGui::SliderFloat3("position", glm::value_ptr(light.position), -10.0f, 10.0f);
+                ImGui::ColorEdit3("Ambient", glm::value_ptr(light.ambient));
+                ImGui::ColorEdit3("Diffuse", glm::value_ptr(light.diffuse));
+                ImGui::ColorEdit3("Specular", glm::value_ptr(light.specular));
 
                 // display box
-                std::string comboLabel = "Distance##combo" + std::to_string(0);
-                if (ImGui::Combo(comboLabel.c_str(), &selectedPresetIndex[0],
+                std::string comboLabel = "Distance##combo" + std::to_string(i);
+                if (ImGui::Combo(comboLabel.c_str(), &light.preset,
                     [](void* data, int index, const char** out_text) {
                         AttenuationPreset* preset = (AttenuationPreset*)data;
                         *out_text = preset[index].name;
                         return true;
                     }, attenuationPreset, numPreset))
 
-                    pointLightData[0].linear = attenuationPreset[selectedPresetIndex[0]].linear;
-                pointLightData[0].quadratic = attenuationPreset[selectedPresetIndex[0]].quadratic;
+                    light.linear = attenuationPreset[light.preset].linear;
+                light.quadratic = attenuationPreset[light.preset].quadratic;
 
-                ImGui::Text("Linear: %.3f", pointLightData[0].linear);
-                ImGui::Text("Quadratic: %.3f", pointLightData[0].quadratic);
+                ImGui::Text("Linear: %.3f", light.linear);
+                ImGui::Text("Quadratic: %.3f", light.quadratic);
+                ImGui::Text("Range: %.1f", pointLightRange(light));
 
+                if (ImGui::Button("Remove"))
+                    removed = (int)i;
 
                 ImGui::TreePop();
             }
-
-            if (ImGui::TreeNode("Point light 2"))
-            {
-                ImGui::ColorEdit3("Ambient", glm::value_ptr(pointLightData[1].ambient));
-                ImGui::ColorEdit3("Diffuse", glm::value_ptr(pointLightData[1].diffuse));
-                ImGui::ColorEdit3("Specular", glm::value_ptr(pointLightData[1].specular));
-
-                // display box
-                std::string comboLabel = "Distance##combo" + std::to_string(1);
-                if (ImGui::Combo(comboLabel.c_str(), &selectedPresetIndex[1],
-                    [](void* data, int index, const char** out_text) {
-                        AttenuationPreset* preset = (AttenuationPreset*)data;
-                        *out_text = preset[index].name;
-                        return true;
-                    }, attenuationPreset, numPreset))
-
-                    pointLightData[1].linear = attenuationPreset[selectedPresetIndex[1]].linear;
-                pointLightData[1].quadratic = attenuationPreset[selectedPresetIndex[1]].quadratic;
-
-                ImGui::Text("Linear: %.3f", pointLightData[1].linear);
-                ImGui::Text("Quadratic: %.3f", pointLightData[1].quadratic);
-
-
-                ImGui::TreePop();
-            }
-
-            if (ImGui::TreeNode("Point light 3"))
-            {
-                ImGui::ColorEdit3("Ambient", glm::value_ptr(pointLightData[2].ambient));
-                ImGui::ColorEdit3("Diffuse", glm::value_ptr(pointLightData[2].diffuse));
-                ImGui::ColorEdit3("Specular", glm::value_ptr(pointLightData[2].specular));
-
-
-                // display box
-                std::string comboLabel = "Distance##combo" + std::to_string(2);
-                if (ImGui::Combo(comboLabel.c_str(), &selectedPresetIndex[2],
-                    [](void* data, int index, const char** out_text) {
-                        AttenuationPreset* preset = (AttenuationPreset*)data;
-                        *out_text = preset[index].name;
-                        return true;
-                    }, attenuationPreset, numPreset))
-
-                    pointLightData[2].linear = attenuationPreset[selectedPresetIndex[2]].linear;
-                pointLightData[2].quadratic = attenuationPreset[selectedPresetIndex[2]].quadratic;
-
-                ImGui::Text("Linear: %.3f", pointLightData[2].linear);
-                ImGui::Text("Quadratic: %.3f", pointLightData[2].quadratic);
-
-
-                ImGui::TreePop();
-            }
-
-            if (ImGui::TreeNode("Point light 4"))
-            {
-                ImGui::ColorEdit3("Ambient", glm::value_ptr(pointLightData[3].ambient));
-                ImGui::ColorEdit3("Diffuse", glm::value_ptr(pointLightData[3].diffuse));
-                ImGui::ColorEdit3("Specular", glm::value_ptr(pointLightData[3].specular));
-
-                // display box
-                std::string comboLabel = "Distance##combo" + std::to_string(3);
-                if (ImGui::Combo(comboLabel.c_str(), &selectedPresetIndex[3],
-                    [](void* data, int index, const char** out_text) {
-                        AttenuationPreset* preset = (AttenuationPreset*)data;
-                        *out_text = preset[index].name;
-                        return true;
-                    }, attenuationPreset, numPreset))
-
-                    pointLightData[3].linear = attenuationPreset[selectedPresetIndex[3]].linear;
-                pointLightData[3].quadratic = attenuationPreset[selectedPresetIndex[3]].quadratic;
-
-                ImGui::Text("Linear: %.3f", pointLightData[3].linear);
-                ImGui::Text("Quadratic: %.3f", pointLightData[3].quadratic);
-
-                ImGui::TreePop();
-            }
-
-            ImGui::TreePop();
         }
 
+        if (removed >= 0)
+            pointLightData.erase(pointLightData.begin() + removed);
+
         ImGui::TreePop();
 
     }
@@ -923,13 +1366,394 @@ void spotLightChange()
 }
 
 
+void uploadStatistics(UploadQueue& uploadQueue, const TextureUploader& textureUploader)
+{
+    if (ImGui::TreeNode("Streaming"))
+    {
+        const UploadStats& stats{ uploadQueue.stats() };
+
+        ImGui::SliderFloat("Upload budget (ms)", &uploadQueue.budgetMs(), 0.25f, 16.0f, "%.2f");
+
+        ImGui::Text("Decoding: %d", textureUploader.decodingCount());
+        ImGui::Text("Queue depth: %d jobs, %d steps, %.2f MB",
+            (int)stats.jobsQueued, (int)stats.stepsQueued, stats.bytesQueued / (1024.0 * 1024.0));
+        ImGui::Text("This frame: %d steps, %.1f KB in %.3f ms",
+            (int)stats.stepsThisFrame, stats.bytesThisFrame / 1024.0, stats.msThisFrame);
+        ImGui::Text("Total uploaded: %.2f MB", stats.totalBytes / (1024.0 * 1024.0));
+
+        ImGui::TreePop();
+    }
+}
+
+
+void gpuMemoryStatistics()
+{
+    GpuMemoryLedger& ledger{ gpuMemory() };
+
+    // ImGui owns its font atlas (and any other texture it creates), re-collect them every frame
+    ledger.clearCategory(MemoryCategory::Ui);
+    for (ImTextureData* texture : ImGui::GetPlatformIO().Textures)
+    {
+        if (texture->Status != ImTextureStatus_Destroyed && texture->TexID != ImTextureID_Invalid)
+            ledger.track(GLObjectType::Texture, static_cast<unsigned int>(texture->TexID), MemoryCategory::Ui,
+                0, "imgui texture", texture->GetSizeInBytes());
+    }
+
+    if (ImGui::TreeNode("GPU memory"))
+    {
+        static int topCount{ 10 };
+        static float fallbackBudgetMB{ 2048.0f };
+        static std::string dumpStatus{};
+
+        const double MB{ 1024.0 * 1024.0 };
+        std::size_t tracked{ ledger.totalBytes() };
+        DriverMemoryInfo driver{ ledger.queryDriver() };
+
+        ImGui::Text("Tracked: %.2f MB", tracked / MB);
+
+        // budget is what the driver says we have, or a manual value when it cannot tell us
+        double budget{ fallbackBudgetMB * MB };
+        if (driver.available)
+        {
+            ImGui::Text("%s: %.0f MB free of %.0f MB", driver.source, driver.freeBytes / MB,
+                driver.totalBytes / MB);
+            budget = driver.totalBytes ? static_cast<double>(driver.totalBytes)
+                : static_cast<double>(driver.freeBytes + tracked);
+        }
+        else
+        {
+            ImGui::Text("No driver memory info (GL_NVX_gpu_memory_info / GL_ATI_meminfo)");
+            ImGui::SliderFloat("Budget (MB)", &fallbackBudgetMB, 256.0f, 16384.0f, "%.0f");
+        }
+
+        ImGui::ProgressBar(static_cast<float>(tracked / budget), ImVec2(-1.0f, 0.0f),
+            (std::to_string(static_cast<int>(tracked / MB)) + " / "
+                + std::to_string(static_cast<int>(budget / MB)) + " MB").c_str());
+
+        std::vector<std::size_t> totals{ ledger.categoryTotals() };
+        for (int i{ 0 }; i < static_cast<int>(MemoryCategory::Count); ++i)
+            ImGui::Text("  %-16s %9.2f MB", memoryCategoryName(static_cast<MemoryCategory>(i)), totals[i] / MB);
+
+        ImGui::SliderInt("Top resources", &topCount, 1, 50);
+        for (const MemoryRecord& record : ledger.largest(topCount))
+        {
+            ImGui::Text("  %8.2f MB  %s  %s (%s)", record.bytes / MB, memoryCategoryName(record.category),
+                record.label.c_str(), ledger.assetName(record.owner).c_str());
+        }
+
+        if (ImGui::Button("Dump to gpu_memory.json"))
+            dumpStatus = ledger.writeJson("gpu_memory.json") ? "written" : "could not write file";
+        if (!dumpStatus.empty())
+        {
+            ImGui::SameLine();
+            ImGui::Text("%s", dumpStatus.c_str());
+        }
+
+        ImGui::TreePop();
+    }
+}
+
+
+void fillLightsBlock(LightsBlock& lights, const Camera& camera, const glm::vec3& pointAmbient)
+{
+    lights.dirLight.direction = dirLightData.direction;
+    lights.dirLight.ambient = dirLightData.ambient;
+    lights.dirLight.diffuse = dirLightData.diffuse;
+    lights.dirLight.specular = dirLightData.specular;
+    lights.pointAmbient = pointAmbient;
+
+    // spotlight - flashlight
+    SpotLightStd140& spotLight{ lights.spotLight };
+    spotLight.position = camera.Position;
+    spotLight.direction = camera.Front;
+    spotLight.cutOff = cos(glm::radians(spotLightData.cutOff));
+    spotLight.outerCutOff = cos(glm::radians(spotLightData.outerCutOff));
+    spotLight.ambient = spotLightData.ambient;
+    spotLight.diffuse = spotLightData.diffuse;
+    spotLight.specular = spotLightData.specular;
+    spotLight.constant = 1.0f;
+    spotLight.linear = spotLightData.linear;
+    spotLight.quadratic = spotLightData.quadratic;
+}
+
+
+void fillSpotLights(std::vector<GpuSpotLight>& lights, const Camera& camera)
+{
+    lights.clear();
+    lights.push_back(makeSpotLight(camera.Position, camera.Front, cos(glm::radians(spotLightData.cutOff)),
+        cos(glm::radians(spotLightData.outerCutOff)), spotLightData.ambient, spotLightData.diffuse,
+        spotLightData.specular, spotLightData.linear, spotLightData.quadratic));
+}
+
+
+void renderStatistics(const RenderQueue& renderQueue, const std::vector<CommandList>& shadowCommands,
+    const std::vector<CommandList>& dynamicShadowCommands, const std::vector<CommandList>& opaqueCommands,
+    const IndirectRenderer* indirectRenderer, const CullStats& shadowCulling, const CullStats& opaqueCulling,
+    const OcclusionQueries& occlusionQueries, const ShadowCache& shadowCache, const FragmentCounter& shadedFragments,
+    const DeferredRenderer& deferredRenderer, const LightGrid& lightGrid)
+{
+    if (ImGui::TreeNode("Render stats"))
+    {
+        ImGui::Text("Queued draws: %d", (int)renderQueue.size());
+
+        ImGui::Checkbox("Frustum culling", &frustumCulling);
+        ImGui::Checkbox("Shadow caster culling", &shadowCasterCulling);
+        ImGui::Text("Shadow pass: %d of %d instances cast, %d BVH nodes", (int)shadowCulling.visible,
+            (int)shadowCulling.tested, (int)shadowCulling.nodes);
+        ImGui::Checkbox("Shadow map caching", &shadowCaching);
+        if (shadowCaching && currentModel)
+            ImGui::Text("Shadow cache: %d reuses, %d redraws, %d dynamic casters", (int)shadowCache.reuseCount(),
+                (int)shadowCache.redrawCount(), (int)currentModel->dynamicMeshCount());
+        ImGui::Text("Main pass: %d of %d instances visible, %d BVH nodes", (int)opaqueCulling.visible,
+            (int)opaqueCulling.tested, (int)opaqueCulling.nodes);
+
+        const char* occlusionModes[]{ "Off", "CPU occluders", "GPU queries" };
+        int mode{ static_cast<int>(occlusionMode) };
+        if (ImGui::Combo("Occlusion culling", &mode, occlusionModes, IM_ARRAYSIZE(occlusionModes)))
+            occlusionMode = static_cast<OcclusionMode>(mode);
+
+        if (currentModel && frustumCulling && occlusionMode == OcclusionMode::Software)
+            ImGui::Text("Occluded: %d instances, %d occluders (%d triangles)", (int)opaqueCulling.occluded,
+                (int)currentModel->occluderCount(), (int)currentModel->occluderTriangles());
+        else if (currentModel && frustumCulling && occlusionMode == OcclusionMode::Queries)
+            ImGui::Text("Occluded: %d instances, %d meshes hidden, %d queries, %d conditional draws",
+                (int)opaqueCulling.occluded, (int)occlusionQueries.hiddenCount(),
+                (int)occlusionQueries.issuedCount(), (int)occlusionQueries.conditionalCount());
+
+        const char* shadingPaths[]{ "Forward", "Deferred" };
+        int path{ static_cast<int>(shadingPath) };
+        if (ImGui::Combo("Shading", &path, shadingPaths, IM_ARRAYSIZE(shadingPaths)))
+            shadingPath = static_cast<ShadingPath>(path);
+        ImGui::SliderInt("Scattered point lights", &scatteredLightCount, 0, 1024);
+        ImGui::Combo("Scattered light reach", &scatteredLightPreset,
+            [](void*, int index, const char** name) { *name = attenuationPreset[index].name; return true; },
+            nullptr, numPreset);
+        if (shadingPath == ShadingPath::Deferred)
+            ImGui::Text("Deferred: %d point light volumes, 1 spot light volume",
+                (int)deferredRenderer.pointLightCount());
+        else
+            ImGui::Text("Forward: %d of %d clusters lit, longest list %d lights, %d indices%s",
+                (int)lightGrid.litClusters(), (int)LightGrid::CLUSTERS, (int)lightGrid.longestList(),
+                (int)lightGrid.indexCount(), lightGrid.clipped() ? " (clipped)" : "");
+
+        // the counts lag a few frames behind, each mode keeps its last one
+        ImGui::Checkbox("Depth prepass", &depthPrepass);
+        const char* counted{ shadedFragments.invocations() ? "fragment shader invocations" : "samples passed" };
+        double pixels{ static_cast<double>(SCR_WIDTH) * SCR_HEIGHT };
+        for (unsigned int prepass : { 0u, 1u })
+        {
+            if (shadedFragments.measured(prepass))
+                ImGui::Text("Main pass %s prepass: %.2fM %s (%.2f per pixel)", prepass ? "with" : "without",
+                    shadedFragments.latest(prepass) / 1e6, counted, shadedFragments.latest(prepass) / pixels);
+        }
+        if (shadedFragments.measured(0) && shadedFragments.measured(1) && shadedFragments.latest(0) > 0)
+        {
+            double without{ static_cast<double>(shadedFragments.latest(0)) };
+            double with{ static_cast<double>(shadedFragments.latest(1)) };
+            ImGui::Text("Prepass saves %.2fM fragments (%.0f%%)", (without - with) / 1e6,
+                100.0 * (without - with) / without);
+        }
+
+        if (indirectRenderer)
+        {
+            ImGui::Checkbox("Multi-draw indirect", &multiDrawIndirect);
+            if (multiDrawIndirect)
+                ImGui::Text("Indirect: %d commands in %d batches", (int)indirectRenderer->commandCount(),
+                    (int)indirectRenderer->batchCount());
+        }
+        else
+        {
+            ImGui::Text("Multi-draw indirect: needs an OpenGL 4.6 context");
+        }
+
+        unsigned int commands{};
+        std::size_t bytes{};
+        for (const std::vector<CommandList>* lists : { &shadowCommands, &dynamicShadowCommands, &opaqueCommands })
+        {
+            for (const CommandList& list : *lists)
+            {
+                commands += list.commandCount();
+                bytes += list.bytes();
+            }
+        }
+        ImGui::Text("Command lists: %d shadow, %d dynamic shadow, %d opaque", (int)shadowCommands.size(),
+            (int)dynamicShadowCommands.size(), (int)opaqueCommands.size());
+        ImGui::Text("Recorded commands: %d (%.1f KB)", (int)commands, bytes / 1024.0);
+        const GLStateStats& state{ glState().lastFrame() };
+        ImGui::Text("GL state calls: %d issued, %d skipped", (int)state.issued, (int)state.skipped);
+
+        ImGui::TreePop();
+    }
+}
+
+
+void shaderVariantOptions(const ShaderVariants& forwardShaders, const ShaderVariants& gbufferShaders)
+{
+    if (ImGui::TreeNode("Shader variants"))
+    {
+        // each switch picks another compiled variant, nothing is branched on in the shaders
+        ImGui::Checkbox("Blinn-Phong (B)", &blinn);
+        ImGui::Checkbox("Shadows", &shadows);
+        ImGui::Checkbox("Point and spot lights (forward)", &localLights);
+        ImGui::Checkbox("Alpha test", &alphaTest);
+        if (alphaTest && depthPrepass)
+            ImGui::Text("Depth prepass is skipped while alpha testing");
+
+        ImGui::Text("Compiled: %d forward, %d G-buffer variants", (int)forwardShaders.compiledCount(),
+            (int)gbufferShaders.compiledCount());
+
+        const ProgramCache& cache{ programCache() };
+        if (cache.enabled())
+            ImGui::Text("Program cache: %d loaded, %d compiled, %d rejected", (int)cache.loadedCount(),
+                (int)cache.compiledCount(), (int)cache.rejectedCount());
+        else
+            ImGui::Text("Program cache: needs program binary support");
+
+        ImGui::TreePop();
+    }
+}
+
+
+ShaderVariants::Key shaderVariantKey()
+{
+    return (blinn ? FEATURE_BLINN : 0u) | (shadows ? FEATURE_SHADOWS : 0u)
+        | (localLights ? FEATURE_LOCAL_LIGHTS : 0u) | (alphaTest ? FEATURE_ALPHA_TEST : 0u);
+}
+
+
+float pointLightRange(const PointLight& light)
+{
+    float brightest{ std::max(light.diffuse.r, std::max(light.diffuse.g, light.diffuse.b)) };
+    return attenuationRange(light.constant, light.linear, light.quadratic, brightest);
+}
+
+
+void fillPointLights(std::vector<GpuPointLight>& lights, glm::vec3& ambient, const glm::mat4& model)
+{
+    lights.clear();
+    ambient = glm::vec3(0.0f);
+    for (const PointLight& light : pointLightData)
+    {
+        lights.push_back(makePointLight(light.position, light.diffuse, light.specular, light.linear,
+            light.quadratic));
+        ambient += light.ambient;
+    }
+
+    // a fixed seed puts them in the same places every frame
+    if (currentModel && scatteredLightCount > 0)
+    {
+        glm::vec3 boundsMin{};
+        glm::vec3 boundsMax{};
+        currentModel->bounds(boundsMin, boundsMax);
+        transformBounds(model, boundsMin, boundsMax);
+
+        const AttenuationPreset& preset{ attenuationPreset[scatteredLightPreset] };
+        scatterPointLights(lights, static_cast<std::size_t>(scatteredLightCount), boundsMin, boundsMax,
+            preset.linear, preset.quadratic, SCATTERED_LIGHT_BRIGHTNESS);
+    }
+}
+
+
+void updateMovingInstance(float time)
+{
+    // the instance being moved, where it was and how tall its model was then
+    static AssetId movedAsset{};
+    static int moved{ -1 };
+    static glm::mat4 rest{ 1.0f };
+    static float modelHeight{};
+
+    // a reloaded model starts out unmoved
+    AssetId asset{ currentModel ? currentModel->assetId() : AssetId{} };
+    if (asset != movedAsset)
+    {
+        movedAsset = asset;
+        moved = -1;
+    }
+    if (!currentModel)
+        return;
+
+    int count{ static_cast<int>(currentModel->instanceCount()) };
+    int wanted{ moveInstance && count > 0 ? std::clamp(movingInstance, 0, count - 1) : -1 };
+    if (wanted != moved)
+    {
+        if (moved >= 0)
+        {
+            currentModel->setInstanceTransform(moved, rest);
+            currentModel->setInstanceStatic(moved);
+        }
+        moved = wanted;
+        if (moved < 0)
+            return;
+
+        // the model's bounds grow with the moving instance, measure them before it moves
+        rest = currentModel->instanceTransform(moved);
+        glm::vec3 boundsMin{};
+        glm::vec3 boundsMax{};
+        currentModel->bounds(boundsMin, boundsMax);
+        modelHeight = boundsMax.y - boundsMin.y;
+    }
+    if (moved < 0)
+        return;
+
+    float height{ modelHeight * movingAmplitude * std::sin(time) };
+    currentModel->setInstanceTransform(moved, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, height, 0.0f)) * rest);
+}
+
+
+// queries against the model's instance BVH: which meshes each point light
+// reaches, and what the camera is looking at. The moving instance is picked here
+void sceneQueries()
+{
+    if (!currentModel || !ImGui::TreeNode("Scene queries"))
+        return;
+
+    const Bvh& bvh{ currentModel->bvh() };
+    ImGui::Text("BVH: %d nodes over %d instances", (int)bvh.nodeCount(), (int)bvh.itemCount());
+
+    glm::mat4 model{ glm::scale(glm::mat4(1.0f), glm::vec3(modelScale)) };
+    std::vector<std::uint8_t> reached(currentModel->meshCount());
+    for (std::size_t i{ 0 }; i < pointLightData.size(); ++i)
+    {
+        std::fill(reached.begin(), reached.end(), std::uint8_t{ 0 });
+        unsigned int meshes{};
+        float range{ pointLightRange(pointLightData[i]) };
+        currentModel->overlapSphere(model, pointLightData[i].position, range, [&](unsigned int mesh, unsigned int)
+            {
+                meshes += reached[mesh] ? 0 : 1;
+                reached[mesh] = 1;
+            });
+        ImGui::Text("Point light %d: range %.1f, reaches %d meshes", (int)i + 1, range, (int)meshes);
+    }
+
+    float distance{ 100.0f };
+    unsigned int mesh{};
+    if (currentModel->raycast(model, camera.Position, camera.Front, distance, mesh))
+        ImGui::Text("Looking at mesh %d, %.2f away", (int)mesh, distance);
+    else
+        ImGui::Text("Looking at nothing");
+
+    ImGui::Checkbox("move an instance", &moveInstance);
+    ImGui::SliderInt("moving instance", &movingInstance, 0, std::max(0, (int)currentModel->instanceCount() - 1));
+    ImGui::SliderFloat("moving amplitude", &movingAmplitude, 0.0f, 0.5f);
+
+    ImGui::TreePop();
+}
+
+
 // load cubemap texture
-unsigned int loadCubeMap(const std::vector<std::string>& faces)
+GLTexture loadCubeMap(const std::vector<std::string>& faces)
 {
-    unsigned int textureID{};
-    glGenTextures(1, &textureID);
+    AssetId skybox{ newAssetId() };
+    gpuMemory().nameAsset(skybox, "skybox");
+
+    // stream the faces in through the upload queue when it is running
+    if (activeTextureUploader)
+        return activeTextureUploader->requestCubeMap(faces, skybox);
+
+    GLTexture textureID{ GLTexture::create() };
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
+    std::size_t bytes{};
     int width, height, nrChannels;
     for (unsigned int i{ 0 }; i < faces.size(); ++i)
     {
@@ -938,6 +1762,7 @@ unsigned int loadCubeMap(const std::vector<std::string>& faces)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0,
                 GL_RGB, GL_UNSIGNED_BYTE, data);
+            bytes += textureBytes(width, height, GL_RGB, false);
             stbi_image_free(data);
         }
         else
@@ -953,5 +1778,7 @@ unsigned int loadCubeMap(const std::vector<std::string>& faces)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+    gpuMemory().track(GLObjectType::Texture, textureID, MemoryCategory::Cubemap, skybox, "cubemap", bytes);
+
     return textureID;
 }
\ No newline at end of file
@@ -2,8 +2,15 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include "Bvh.h"
+#include "Culling.h"
+#include "IndirectDraw.h"
 #include "Mesh.h"
+#include "OcclusionBuffer.h"
+#include "RenderQueue.h"
 #include "Shader.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
 #include "stb_image.h"
 
 
@@ -11,23 +18,82 @@
 #include <assimp/scene.h>           // The C-style data structures (scene, mesh, material)
 #include <assimp/postprocess.h>   // Post-processing flags
 
+#include <limits>
+#include <memory>
+
+
+// one node reference to a mesh: which mesh and where it is placed in the model
+struct MeshInstance
+{
+	unsigned int meshIndex{};
+	unsigned int meshInstance{};	// position in the mesh's instance buffer
+	glm::mat4 transform{ 1.0f };
+};
+
 
 class Model
 {
 private:
 	// modal data
-	std::vector<Mesh> m_meshes{};
+	std::vector<Mesh> m_meshes{};			// one entry per referenced aiMesh
+	std::vector<MeshInstance> m_instances{};	// one entry per node->mMeshes[i]
 	std::string m_directory{};
+	AssetId m_assetId{ newAssetId() };		// tags this model's streaming uploads
 
 	std::vector<Texture> texture_loaded{};	// store loaded textures
+	std::vector<GLTexture> m_textureObjects{};	// owns the GL textures texture_loaded refers to
+	MaterialTable m_materials{};			// material ids of the meshes, keyed by their textures
+
+	// aiMesh index -> index into m_meshes (-1 if not processed yet)
+	std::vector<int> m_meshLookup{};
+
+	// all meshes in shared buffers for multi-draw indirect, built by prepareIndirect()
+	std::unique_ptr<IndirectGeometry> m_indirect{};
+
+	// model space bounds of every instance, item i is m_instances[i]
+	Bvh m_bvh{};
+
+	// model space box around every instance
+	glm::vec3 m_boundsMin{};
+	glm::vec3 m_boundsMax{};
+
+	// instances that are moving, and per mesh how many of its instances are.
+	// Meshes with any go into RenderPass::DynamicShadow so the static shadow
+	// map can stay cached
+	std::vector<std::uint8_t> m_dynamicInstances{};
+	std::vector<unsigned int> m_dynamicMeshes{};
+	unsigned int m_dynamicMeshCount{};
+	std::uint64_t m_casterVersion{};	// bumped whenever a mesh leaves or rejoins the static casters
+
+	// instances whose meshes are drawn into the CPU occlusion buffer
+	std::vector<unsigned int> m_occluderInstances{};
+	std::size_t m_occluderTriangles{};
 
 	// load model with supported Assimp extensions from files and store the
 	// resulting meshes in the mesh vector
 	void loadModel(const std::string& path);
 
+	// mark an instance as moving or not, moving its mesh between the static and
+	// the dynamic casters when it is the first or last moving instance of it
+	void setDynamic(unsigned int instance, bool dynamic);
+
 	// process a node in a recursive fashion. 
 	// process each individual mesh located at the node and repeat this proces on its children note (if any)
-	void processNode(aiNode* node, const aiScene* scene);
+	// parentTransform is the accumulated world transform of the node's parent
+	void processNode(aiNode* node, const aiScene* scene, const glm::mat4& parentTransform);
+
+	// upload every instance transform to the mesh it belongs to
+	void setupInstances();
+
+	// model space box of one instance
+	void instanceBounds(const MeshInstance& instance, glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+	// (re)build the BVH over every instance, on pool if there is one
+	void buildBvh(ThreadPool* pool);
+
+	// pick the meshes made of few, large triangles (walls, floors, pillars) as
+	// occluders, up to a triangle budget
+	void selectOccluders();
 
 	// process Assimp data to our Mesh class
 	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
@@ -38,25 +104,133 @@ private:
 		std::string typeName);
 
 public:
-	Model(const std::string& path)
+	// the instance BVH is built on pool when there is one
+	Model(const std::string& path, ThreadPool* pool = activeRenderPool)
 	{
 		loadModel(path);
+		buildBvh(pool);
+		selectOccluders();
 	}
 
-	// Draw the model (all of its meshes)
-	void Draw(Shader& shader)
+	// meshes and textures own their GL objects, a model is moved around by pointer
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	// drop uploads still queued for this model, their GL objects go away with it
+	~Model()
+	{
+		if (activeUploadQueue)
+			activeUploadQueue->cancel(m_assetId);
+	}
+
+	// Draw the model (all of its meshes). Every mesh is drawn once with all of
+	// its instances. The shader must be in use and have its samplers bound
+	// with bindMaterialSamplers()
+	void Draw() const
 	{
 		for (unsigned int i{ 0 }; i < m_meshes.size(); ++i)
 		{
-			m_meshes[i].Draw(shader);
+			m_meshes[i].Draw();
 		}
 	}
+
+	// same without binding any material texture, for the shadow pass
+	void DrawGeometry() const
+	{
+		for (const Mesh& mesh : m_meshes)
+			mesh.DrawGeometry();
+	}
+
+	// queue one draw per ready mesh. The sort depth is the nearest instance of the
+	// mesh along the view direction, divided by farPlane. Meshes are split across
+	// the pool, the depths and keys are computed in parallel.
+	// With a (world space) frustum, meshes with every instance outside it are not
+	// queued. stats.tested / visible count instances, not meshes, stats.bounds
+	// encloses the visible ones. Dynamic meshes submitted to RenderPass::Shadow
+	// go to RenderPass::DynamicShadow.
+	// With an occlusion buffer (drawn for this frame's camera), instances hidden
+	// behind its occluders are dropped as well, and so are the meshes flagged in
+	// hiddenMeshes (one entry per mesh, e.g. from occlusion queries).
+	// With a prepassShader every queued mesh is queued in RenderPass::DepthPrepass
+	// as well, from the same culling results
+	CullStats submit(RenderQueue& queue, ThreadPool& pool, RenderPass pass, const Shader& shader,
+		Uniform<glm::mat4> modelUniform, const glm::mat4& model, const glm::mat4& view, float farPlane,
+		const Frustum* frustum = nullptr, const OcclusionBuffer* occlusion = nullptr,
+		const std::vector<std::uint8_t>* hiddenMeshes = nullptr, const Shader* prepassShader = nullptr,
+		Uniform<glm::mat4> prepassModelUniform = {}) const;
+
+	// clear buffer and draw this model's occluders into it, split across pool
+	void rasterizeOccluders(OcclusionBuffer& buffer, ThreadPool& pool, const glm::mat4& viewProjection,
+		const glm::mat4& model) const;
+
+	// build the merged buffers the indirect path draws from, once every mesh has
+	// finished uploading. Cheap to call every frame, GL thread only
+	void prepareIndirect();
+
+	// move one instance. Its transform is overwritten in place in the mesh's
+	// instance buffer and in the merged indirect one, and the BVH is refit along
+	// the instance's path. The mesh is a dynamic shadow caster until setInstanceStatic()
+	void setInstanceTransform(unsigned int instance, const glm::mat4& transform);
+
+	// the instance stopped moving. Its mesh rejoins the static casters once no
+	// other instance of it moves, the cached shadow map is then redrawn once
+	void setInstanceStatic(unsigned int instance) { setDynamic(instance, false); }
+
+	// call f(meshIndex, instance) for every instance whose box overlaps the sphere,
+	// e.g. to find what a point light reaches. center is in world space
+	template <typename F>
+	void overlapSphere(const glm::mat4& model, const glm::vec3& center, float radius, F&& f) const;
+
+	// nearest instance box hit by a world space ray within distance. On a hit,
+	// distance becomes the hit distance (in units of direction) and mesh the mesh hit
+	bool raycast(const glm::mat4& model, const glm::vec3& origin, const glm::vec3& direction,
+		float& distance, unsigned int& mesh) const;
+
+	const Bvh& bvh() const { return m_bvh; }
+	unsigned int occluderCount() const { return static_cast<unsigned int>(m_occluderInstances.size()); }
+	std::size_t occluderTriangles() const { return m_occluderTriangles; }
+
+	AssetId assetId() const { return m_assetId; }
+	const Mesh& mesh(unsigned int index) const { return m_meshes[index]; }
+
+	// model space box around every instance of a mesh
+	void meshBounds(unsigned int mesh, glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+	// model space box around every instance
+	void bounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+	{
+		boundsMin = m_boundsMin;
+		boundsMax = m_boundsMax;
+	}
+
+	// changes whenever the set of static shadow casters does
+	std::uint64_t casterVersion() const { return m_casterVersion; }
+	unsigned int dynamicMeshCount() const { return m_dynamicMeshCount; }
+
+	// meshes whose data has finished streaming in
+	unsigned int readyMeshCount() const;
+
+	unsigned int meshCount() const { return static_cast<unsigned int>(m_meshes.size()); }
+	unsigned int instanceCount() const { return static_cast<unsigned int>(m_instances.size()); }
+	const glm::mat4& instanceTransform(unsigned int instance) const { return m_instances[instance].transform; }
 };
 
 
+// Assimp stores matrices row-major, glm is column-major
+inline glm::mat4 aiToGlm(const aiMatrix4x4& m)
+{
+	return glm::mat4(
+		glm::vec4(m.a1, m.b1, m.c1, m.d1),
+		glm::vec4(m.a2, m.b2, m.c2, m.d2),
+		glm::vec4(m.a3, m.b3, m.c3, m.d3),
+		glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+
 void Model::loadModel(const std::string& path)
 {
 	Assimp::Importer import{};
+	gpuMemory().nameAsset(m_assetId, path);
 
 	// flipUVs flip the y axis 
 	// (normally the (0,0) coordinate of texture is at the top left)
@@ -72,32 +246,374 @@ void Model::loadModel(const std::string& path)
 	// retrieve the directory path of a filepath
 	m_directory = path.substr(0, path.find_last_of('/'));
 
+	m_meshLookup.assign(scene->mNumMeshes, -1);
+
 	// process Assimp root node recursively
-	processNode(scene->mRootNode, scene);
+	processNode(scene->mRootNode, scene, glm::mat4(1.0f));
+
+	setupInstances();
 }
 
-unsigned int TextureFromFile(const char* path, const std::string& directory);
+GLTexture TextureFromFile(const char* path, const std::string& directory, AssetId owner = 0);
 
 
-void Model::processNode(aiNode* node, const aiScene* scene)
+void Model::processNode(aiNode* node, const aiScene* scene, const glm::mat4& parentTransform)
 {
+	glm::mat4 transform{ parentTransform * aiToGlm(node->mTransformation) };
+
 	// process all the nodes meshes (if any)
 	for (unsigned int i{ 0 }; i < node->mNumMeshes; ++i)
 	{
 		// node object only contains the indices to index the 
 		// actual object in the scene. 
 		// The scene contains all the data, node is just to keep things organized
-		aiMesh* mesh{ scene->mMeshes[node->mMeshes[i]] };
-		m_meshes.push_back(processMesh(mesh, scene));
+		unsigned int sceneIndex{ node->mMeshes[i] };
+
+		// only convert and upload an aiMesh the first time a node references it,
+		// every later reference just becomes another instance
+		if (m_meshLookup[sceneIndex] < 0)
+		{
+			aiMesh* mesh{ scene->mMeshes[sceneIndex] };
+			m_meshLookup[sceneIndex] = static_cast<int>(m_meshes.size());
+			m_meshes.push_back(processMesh(mesh, scene));
+		}
+
+		MeshInstance instance{};
+		instance.meshIndex = static_cast<unsigned int>(m_meshLookup[sceneIndex]);
+		instance.transform = transform;
+		m_instances.push_back(instance);
 	}
 
 	// Do the same for each children node
 	for (unsigned int i{ 0 }; i < node->mNumChildren; ++i)
 	{
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], scene, transform);
+	}
+}
+
+
+void Model::prepareIndirect()
+{
+	if (m_indirect || m_meshes.empty())
+		return;
+
+	for (const Mesh& mesh : m_meshes)
+	{
+		if (!mesh.isReady())
+			return;
+	}
+
+	m_indirect = std::make_unique<IndirectGeometry>(m_meshes, m_assetId);
+}
+
+
+CullStats Model::submit(RenderQueue& queue, ThreadPool& pool, RenderPass pass, const Shader& shader,
+	Uniform<glm::mat4> modelUniform, const glm::mat4& model, const glm::mat4& view, float farPlane,
+	const Frustum* frustum, const OcclusionBuffer* occlusion, const std::vector<std::uint8_t>* hiddenMeshes,
+	const Shader* prepassShader, Uniform<glm::mat4> prepassModelUniform) const
+{
+	// small enough to spread a few hundred meshes over the workers, big enough
+	// that a chunk outweighs handing it to a thread
+	constexpr std::size_t MIN_MESHES_PER_CHUNK{ 64 };
+
+	// test the planes in model space, the boxes never have to be transformed.
+	// A mesh is drawn (with all of its instances) once any instance is visible
+	std::vector<std::uint8_t> visible(m_meshes.size(), frustum ? 0 : 1);
+	CullStats stats{ instanceCount(), instanceCount() };
+	stats.boundsMin = m_boundsMin;
+	stats.boundsMax = m_boundsMax;
+	if (frustum)
+	{
+		stats.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		stats.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+		stats.visible = 0;
+		stats.nodes = m_bvh.cull(frustum->transformed(model), [&](std::uint32_t instance)
+			{
+				// the queries judged the whole mesh last frame, every instance goes with it
+				unsigned int mesh{ m_instances[instance].meshIndex };
+				if (hiddenMeshes && mesh < hiddenMeshes->size() && (*hiddenMeshes)[mesh])
+				{
+					++stats.occluded;
+					return;
+				}
+				glm::vec3 boundsMin{};
+				glm::vec3 boundsMax{};
+				instanceBounds(m_instances[instance], boundsMin, boundsMax);
+
+				// a mesh already drawn for another instance needs no occlusion test
+				if (occlusion && !visible[mesh] && occlusion->occluded(model, boundsMin, boundsMax))
+				{
+					++stats.occluded;
+					return;
+				}
+
+				visible[mesh] = 1;
+				++stats.visible;
+				stats.boundsMin = glm::min(stats.boundsMin, boundsMin);
+				stats.boundsMax = glm::max(stats.boundsMax, boundsMax);
+			});
+	}
+
+	unsigned int transform{ queue.addTransform(model) };
+	glm::mat4 modelView{ view * model };
+	std::size_t firstSlot{ queue.allocate(prepassShader ? 2 * m_meshes.size() : m_meshes.size()) };
+	std::size_t firstPrepassSlot{ firstSlot + m_meshes.size() };
+
+	parallelFor(pool, m_meshes.size(), MIN_MESHES_PER_CHUNK, [&](std::size_t begin, std::size_t end, std::size_t)
+		{
+			for (std::size_t i{ begin }; i < end; ++i)
+			{
+				const Mesh& mesh{ m_meshes[i] };
+				if (!visible[i] || !mesh.isReady())
+				{
+					queue.skip(firstSlot + i);
+					if (prepassShader)
+						queue.skip(firstPrepassSlot + i);
+					continue;
+				}
+
+				glm::vec4 center{ mesh.boundsCenter(), 1.0f };
+				float nearest{ farPlane };
+				for (const glm::mat4& instance : mesh.instanceTransforms())
+					nearest = std::min(nearest, -(modelView * instance * center).z);
+
+				bool dynamic{ pass == RenderPass::Shadow && !m_dynamicMeshes.empty() && m_dynamicMeshes[i] };
+				queue.submitAt(firstSlot + i, dynamic ? RenderPass::DynamicShadow : pass, shader, modelUniform,
+					transform, mesh, nearest / farPlane, m_indirect.get(), static_cast<unsigned int>(i));
+				if (prepassShader)
+					queue.submitAt(firstPrepassSlot + i, RenderPass::DepthPrepass, *prepassShader, prepassModelUniform,
+						transform, mesh, nearest / farPlane, m_indirect.get(), static_cast<unsigned int>(i));
+			}
+		});
+
+	return stats;
+}
+
+
+void Model::setupInstances()
+{
+	std::vector<std::vector<glm::mat4>> transforms(m_meshes.size());
+
+	for (MeshInstance& instance : m_instances)
+	{
+		instance.meshInstance = static_cast<unsigned int>(transforms[instance.meshIndex].size());
+		transforms[instance.meshIndex].push_back(instance.transform);
+	}
+
+	for (unsigned int i{ 0 }; i < m_meshes.size(); ++i)
+		m_meshes[i].setInstances(transforms[i]);
+}
+
+
+void Model::instanceBounds(const MeshInstance& instance, glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+	boundsMin = m_meshes[instance.meshIndex].boundsMin();
+	boundsMax = m_meshes[instance.meshIndex].boundsMax();
+	transformBounds(instance.transform, boundsMin, boundsMax);
+}
+
+
+
+unsigned int Model::readyMeshCount() const
+{
+	unsigned int count{};
+	for (const Mesh& mesh : m_meshes)
+		count += mesh.isReady() ? 1 : 0;
+	return count;
+}
+
+
+void Model::meshBounds(unsigned int mesh, glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (const glm::mat4& transform : m_meshes[mesh].instanceTransforms())
+	{
+		glm::vec3 instanceMin{ m_meshes[mesh].boundsMin() };
+		glm::vec3 instanceMax{ m_meshes[mesh].boundsMax() };
+		transformBounds(transform, instanceMin, instanceMax);
+		boundsMin = glm::min(boundsMin, instanceMin);
+		boundsMax = glm::max(boundsMax, instanceMax);
+	}
+}
+
+void Model::buildBvh(ThreadPool* pool)
+{
+	std::vector<glm::vec3> boundsMin(m_instances.size());
+	std::vector<glm::vec3> boundsMax(m_instances.size());
+	m_boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	m_boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (std::size_t i{ 0 }; i < m_instances.size(); ++i)
+	{
+		instanceBounds(m_instances[i], boundsMin[i], boundsMax[i]);
+		m_boundsMin = glm::min(m_boundsMin, boundsMin[i]);
+		m_boundsMax = glm::max(m_boundsMax, boundsMax[i]);
+	}
+
+	m_bvh.build(boundsMin, boundsMax, pool);
+}
+
+
+void Model::setDynamic(unsigned int instance, bool dynamic)
+{
+	m_dynamicInstances.resize(m_instances.size(), 0);
+	m_dynamicMeshes.resize(m_meshes.size(), 0);
+	if (m_dynamicInstances[instance] == (dynamic ? 1 : 0))
+		return;
+
+	m_dynamicInstances[instance] = dynamic ? 1 : 0;
+	unsigned int& moving{ m_dynamicMeshes[m_instances[instance].meshIndex] };
+
+	// the mesh leaves the static casters with its first moving instance and
+	// rejoins them with its last
+	if (dynamic ? moving++ == 0 : --moving == 0)
+	{
+		if (dynamic)
+			++m_dynamicMeshCount;
+		else
+			--m_dynamicMeshCount;
+		++m_casterVersion;
+	}
+}
+
+
+void Model::setInstanceTransform(unsigned int instance, const glm::mat4& transform)
+{
+	MeshInstance& moved{ m_instances[instance] };
+	moved.transform = transform;
+
+	setDynamic(instance, true);
+
+	// the instance count stays the same, only its one matrix changes
+	m_meshes[moved.meshIndex].setInstance(moved.meshInstance, transform);
+	if (m_indirect)
+		m_indirect->setInstance(moved.meshIndex, moved.meshInstance, transform);
+
+	glm::vec3 boundsMin{};
+	glm::vec3 boundsMax{};
+	instanceBounds(moved, boundsMin, boundsMax);
+	m_bvh.updateItem(instance, boundsMin, boundsMax);
+	m_boundsMin = glm::min(m_boundsMin, boundsMin);
+	m_boundsMax = glm::max(m_boundsMax, boundsMax);
+}
+
+
+void Model::selectOccluders()
+{
+	// average triangle edge of an occluder relative to the model size, and the most
+	// triangles the occluders may have between them (instances count separately)
+	constexpr float MIN_OCCLUDER_TRIANGLE_SIZE{ 0.01f };
+	constexpr std::size_t MAX_OCCLUDER_TRIANGLES{ 65536 };
+
+	m_occluderInstances.clear();
+	m_occluderTriangles = 0;
+	if (m_instances.empty())
+		return;
+
+	float minTriangleSize{ glm::length(m_boundsMax - m_boundsMin) * MIN_OCCLUDER_TRIANGLE_SIZE };
+	float minTriangleArea{ 0.5f * minTriangleSize * minTriangleSize };
+
+	// average triangle area in mesh space, detailed meshes (statues, plants,
+	// drapes) have many small triangles and hide little for what they cost
+	std::vector<std::pair<float, unsigned int>> candidates{};
+	for (unsigned int i{ 0 }; i < m_meshes.size(); ++i)
+	{
+		const Mesh& mesh{ m_meshes[i] };
+		std::size_t triangles{ mesh.indices.size() / 3 };
+		if (triangles == 0)
+			continue;
+
+		float area{};
+		for (std::size_t t{ 0 }; t < triangles; ++t)
+		{
+			glm::vec3 a{ mesh.vertices[mesh.indices[3 * t]].Position };
+			glm::vec3 b{ mesh.vertices[mesh.indices[3 * t + 1]].Position };
+			glm::vec3 c{ mesh.vertices[mesh.indices[3 * t + 2]].Position };
+			area += 0.5f * glm::length(glm::cross(b - a, c - a));
+		}
+
+		float averageArea{ area / triangles };
+		if (averageArea >= minTriangleArea)
+			candidates.push_back({ averageArea, i });
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b) { return a.first > b.first; });
+
+	std::vector<std::uint8_t> occluder(m_meshes.size(), 0);
+	for (const std::pair<float, unsigned int>& candidate : candidates)
+	{
+		const Mesh& mesh{ m_meshes[candidate.second] };
+		std::size_t triangles{ mesh.indices.size() / 3 * mesh.instanceTransforms().size() };
+		if (m_occluderTriangles + triangles > MAX_OCCLUDER_TRIANGLES)
+			continue;
+
+		occluder[candidate.second] = 1;
+		m_occluderTriangles += triangles;
+	}
+
+	for (unsigned int i{ 0 }; i < m_instances.size(); ++i)
+	{
+		if (occluder[m_instances[i].meshIndex])
+			m_occluderInstances.push_back(i);
 	}
 }
 
+
+void Model::rasterizeOccluders(OcclusionBuffer& buffer, ThreadPool& pool, const glm::mat4& viewProjection,
+	const glm::mat4& model) const
+{
+	constexpr std::size_t MIN_OCCLUDERS_PER_CHUNK{ 4 };
+
+	std::size_t count{ m_occluderInstances.size() };
+	buffer.begin(viewProjection, std::max<std::size_t>(1, chunkCount(pool, count, MIN_OCCLUDERS_PER_CHUNK)));
+
+	parallelFor(pool, count, MIN_OCCLUDERS_PER_CHUNK, [&](std::size_t begin, std::size_t end, std::size_t chunk)
+		{
+			for (std::size_t i{ begin }; i < end; ++i)
+			{
+				const MeshInstance& instance{ m_instances[m_occluderInstances[i]] };
+				const Mesh& mesh{ m_meshes[instance.meshIndex] };
+				buffer.addOccluder(chunk, model * instance.transform, mesh.vertices, mesh.indices);
+			}
+		});
+
+	buffer.rasterize(pool);
+}
+
+
+template <typename F>
+void Model::overlapSphere(const glm::mat4& model, const glm::vec3& center, float radius, F&& f) const
+{
+	// the sphere's box taken to model space, a little loose under rotation
+	glm::vec3 boundsMin{ center - glm::vec3(radius) };
+	glm::vec3 boundsMax{ center + glm::vec3(radius) };
+	transformBounds(glm::inverse(model), boundsMin, boundsMax);
+
+	m_bvh.overlap(boundsMin, boundsMax, [&](std::uint32_t instance)
+		{
+			f(m_instances[instance].meshIndex, instance);
+		});
+}
+
+
+bool Model::raycast(const glm::mat4& model, const glm::vec3& origin, const glm::vec3& direction,
+	float& distance, unsigned int& mesh) const
+{
+	// an affine transform keeps t the same along the ray, so the model space hit
+	// distance is the world space one
+	glm::mat4 toModel{ glm::inverse(model) };
+	glm::vec3 localOrigin{ toModel * glm::vec4(origin, 1.0f) };
+	glm::vec3 localDirection{ toModel * glm::vec4(direction, 0.0f) };
+
+	std::uint32_t instance{};
+	if (!m_bvh.raycast(localOrigin, localDirection, distance, instance))
+		return false;
+
+	mesh = m_instances[instance].meshIndex;
+	return true;
+}
+
 Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
 {
 	// general idea: Access each of the mesh's relevant properties and store 
@@ -174,7 +690,7 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
 
 	}
 
-	return Mesh(vertices, indices, textures);
+	return Mesh(vertices, indices, textures, m_materials, m_assetId);
 }
 
 
@@ -202,8 +718,10 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType
 
 		if (!skip)
 		{
+			m_textureObjects.push_back(TextureFromFile(str.C_Str(), m_directory, m_assetId));
+
 			Texture texture{};
-			texture.id = TextureFromFile(str.C_Str(), m_directory);
+			texture.id = m_textureObjects.back();
 			texture.type = typeName;
 			texture.path = str.C_Str();
 
@@ -217,13 +735,16 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType
 
 
 // read texture from file
-unsigned int TextureFromFile(const char* path, const std::string& directory)
+GLTexture TextureFromFile(const char* path, const std::string& directory, AssetId owner)
 {
 	std::string filename = std::string{ path };
 	filename = directory + '/' + filename;
 
-	unsigned int textureID{};
-	glGenTextures(1, &textureID);
+	// stream through the PBO uploader when one is running
+	if (activeTextureUploader)
+		return activeTextureUploader->request(filename, owner);
+
+	GLTexture textureID{ GLTexture::create() };
 
 	int width, height, nrComponents;
 	unsigned char* data{ stbi_load(filename.c_str(), &width, &height, &nrComponents, 0)};
@@ -240,12 +761,14 @@ unsigned int TextureFromFile(const char* path, const std::string& directory)
 		glBindTexture(GL_TEXTURE_2D, textureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		gpuMemory().track(GLObjectType::Texture, textureID, MemoryCategory::Textures, owner, filename,
+			textureBytes(width, height, format, true));
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 		stbi_image_free(data);
 	}
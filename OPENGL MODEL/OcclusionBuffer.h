@@ -0,0 +1,439 @@
+#pragma once
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+// Low resolution CPU depth buffer the large occluders of the scene are drawn
+// into, to skip meshes hidden behind them before they are queued.
+//
+// The screen is split into tiles of 8x4 pixels. Instead of a depth per pixel a
+// tile keeps two layers: zMax0, a depth no pixel of the tile is behind, and a
+// partly filled working layer (one coverage bit per pixel plus zMax1, the
+// farthest depth drawn into those bits). Once the working layer covers the
+// whole tile it is merged into zMax0. Depth is window depth, 0 near 1 far
+class OcclusionBuffer
+{
+public:
+	static constexpr int TILE_WIDTH{ 8 };
+	static constexpr int TILE_HEIGHT{ 4 };
+
+private:
+	static constexpr std::uint32_t FULL_TILE{ ~0u };
+
+	struct Tile
+	{
+		float zMax0{ 1.0f };
+		float zMax1{ 0.0f };
+		std::uint32_t mask{};
+	};
+
+	// a triangle in pixel space, ready to rasterize
+	struct ScreenTriangle
+	{
+		// edge i is inside where edgeA[i] * x + edgeB[i] * y + edgeC[i] >= 0
+		float edgeA[3]{};
+		float edgeB[3]{};
+		float edgeC[3]{};
+		float zMax{};		// farthest vertex, the triangle hides nothing behind it
+
+		int tileMinX{};
+		int tileMinY{};
+		int tileMaxX{};		// inclusive
+		int tileMaxY{};
+	};
+
+	int m_width{};
+	int m_height{};
+	int m_tilesX{};
+	int m_tilesY{};
+	std::vector<Tile> m_tiles{};
+
+	// max of zMax0 over 2x2 blocks of the level below, level 0 is one entry per tile
+	struct Level
+	{
+		int width{};
+		int height{};
+		std::vector<float> depth{};
+	};
+	std::vector<Level> m_levels{};
+
+	glm::mat4 m_viewProjection{ 1.0f };
+
+	// one list per addOccluder() chunk, so triangle setup needs no locking
+	std::vector<std::vector<ScreenTriangle>> m_triangles{};
+
+	// coverage of the pixels of tile (tileX, tileY) inside all three edges
+	std::uint32_t coverage(const ScreenTriangle& triangle, int tileX, int tileY) const;
+
+	static void updateTile(Tile& tile, std::uint32_t coverage, float z);
+
+	void rasterizeRows(int firstRow, int endRow);
+	void buildHierarchy();
+
+public:
+	// size is rounded up to whole tiles
+	OcclusionBuffer(int width, int height)
+		: m_width{ (width + TILE_WIDTH - 1) / TILE_WIDTH * TILE_WIDTH },
+		m_height{ (height + TILE_HEIGHT - 1) / TILE_HEIGHT * TILE_HEIGHT }
+	{
+		m_tilesX = m_width / TILE_WIDTH;
+		m_tilesY = m_height / TILE_HEIGHT;
+		m_tiles.resize(static_cast<std::size_t>(m_tilesX) * m_tilesY);
+	}
+
+	// clear to the far plane and get ready for chunks lists of occluders
+	void begin(const glm::mat4& viewProjection, std::size_t chunks);
+
+	// transform and set up the triangles of one occluder into list chunk. Calls with
+	// different chunks can run on different threads
+	void addOccluder(std::size_t chunk, const glm::mat4& toWorld, const std::vector<Vertex>& vertices,
+		const std::vector<unsigned int>& indices);
+
+	// draw every added triangle, split into bands of tile rows across the pool
+	void rasterize(ThreadPool& pool);
+
+	// true if the box (in the space toWorld maps from) is certainly behind the
+	// occluders. Boxes crossing the near plane are never occluded
+	bool occluded(const glm::mat4& toWorld, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+	std::size_t triangleCount() const;
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+};
+
+
+void OcclusionBuffer::begin(const glm::mat4& viewProjection, std::size_t chunks)
+{
+	m_viewProjection = viewProjection;
+	std::fill(m_tiles.begin(), m_tiles.end(), Tile{});
+
+	m_triangles.resize(chunks);
+	for (std::vector<ScreenTriangle>& list : m_triangles)
+		list.clear();
+}
+
+
+void OcclusionBuffer::addOccluder(std::size_t chunk, const glm::mat4& toWorld, const std::vector<Vertex>& vertices,
+	const std::vector<unsigned int>& indices)
+{
+	// near plane w, triangles reaching closer than this are dropped instead of clipped.
+	// Fewer occluders only means less is culled
+	constexpr float MIN_W{ 1e-3f };
+
+	glm::mat4 clip{ m_viewProjection * toWorld };
+
+	// window space x / y in pixels and z in [0, 1], w < 0 marks a vertex to drop
+	std::vector<glm::vec4> window(vertices.size());
+	for (std::size_t i{ 0 }; i < vertices.size(); ++i)
+	{
+		glm::vec4 position{ clip * glm::vec4(vertices[i].Position, 1.0f) };
+		if (position.w < MIN_W || position.z < -position.w)
+		{
+			window[i].w = -1.0f;
+			continue;
+		}
+
+		glm::vec3 ndc{ glm::vec3(position) / position.w };
+		window[i] = glm::vec4((ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height,
+			ndc.z * 0.5f + 0.5f, 1.0f);
+	}
+
+	std::vector<ScreenTriangle>& list{ m_triangles[chunk] };
+	for (std::size_t i{ 0 }; i + 2 < indices.size(); i += 3)
+	{
+		glm::vec4 v0{ window[indices[i]] };
+		glm::vec4 v1{ window[indices[i + 1]] };
+		glm::vec4 v2{ window[indices[i + 2]] };
+		if (v0.w < 0.0f || v1.w < 0.0f || v2.w < 0.0f)
+			continue;
+
+		// both windings are drawn, flip clockwise triangles so inside is positive
+		float area{ (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y) };
+		if (area == 0.0f)
+			continue;
+		if (area < 0.0f)
+			std::swap(v1, v2);
+
+		float minX{ std::min(v0.x, std::min(v1.x, v2.x)) };
+		float maxX{ std::max(v0.x, std::max(v1.x, v2.x)) };
+		float minY{ std::min(v0.y, std::min(v1.y, v2.y)) };
+		float maxY{ std::max(v0.y, std::max(v1.y, v2.y)) };
+		if (maxX < 0.0f || maxY < 0.0f || minX >= m_width || minY >= m_height)
+			continue;
+
+		ScreenTriangle triangle{};
+		const glm::vec4* corners[3]{ &v0, &v1, &v2 };
+		for (int edge{ 0 }; edge < 3; ++edge)
+		{
+			const glm::vec4& a{ *corners[edge] };
+			const glm::vec4& b{ *corners[(edge + 1) % 3] };
+			triangle.edgeA[edge] = a.y - b.y;
+			triangle.edgeB[edge] = b.x - a.x;
+			triangle.edgeC[edge] = a.x * b.y - a.y * b.x;
+		}
+		triangle.zMax = std::max(v0.z, std::max(v1.z, v2.z));
+
+		triangle.tileMinX = std::max(0, static_cast<int>(minX) / TILE_WIDTH);
+		triangle.tileMinY = std::max(0, static_cast<int>(minY) / TILE_HEIGHT);
+		triangle.tileMaxX = std::min(m_tilesX - 1, static_cast<int>(maxX) / TILE_WIDTH);
+		triangle.tileMaxY = std::min(m_tilesY - 1, static_cast<int>(maxY) / TILE_HEIGHT);
+		list.push_back(triangle);
+	}
+}
+
+
+std::uint32_t OcclusionBuffer::coverage(const ScreenTriangle& triangle, int tileX, int tileY) const
+{
+	// pixel centers, bit row * TILE_WIDTH + column
+	float x0{ tileX * TILE_WIDTH + 0.5f };
+	std::uint32_t mask{};
+
+	for (int row{ 0 }; row < TILE_HEIGHT; ++row)
+	{
+		float y{ tileY * TILE_HEIGHT + row + 0.5f };
+		std::uint32_t rowMask{ 0xFF };
+
+#if defined(CULLING_AVX)
+		__m256 x{ _mm256_add_ps(_mm256_set1_ps(x0), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)) };
+		for (int edge{ 0 }; edge < 3; ++edge)
+		{
+			__m256 value{ _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeA[edge]), x),
+				_mm256_set1_ps(triangle.edgeB[edge] * y + triangle.edgeC[edge])) };
+			rowMask &= static_cast<std::uint32_t>(_mm256_movemask_ps(
+				_mm256_cmp_ps(value, _mm256_setzero_ps(), _CMP_GE_OQ)));
+		}
+#elif defined(CULLING_SSE)
+		__m128 left{ _mm_add_ps(_mm_set1_ps(x0), _mm_setr_ps(0, 1, 2, 3)) };
+		__m128 right{ _mm_add_ps(left, _mm_set1_ps(4.0f)) };
+		for (int edge{ 0 }; edge < 3; ++edge)
+		{
+			__m128 a{ _mm_set1_ps(triangle.edgeA[edge]) };
+			__m128 rowValue{ _mm_set1_ps(triangle.edgeB[edge] * y + triangle.edgeC[edge]) };
+			int leftMask{ _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, left), rowValue), _mm_setzero_ps())) };
+			int rightMask{ _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, right), rowValue), _mm_setzero_ps())) };
+			rowMask &= static_cast<std::uint32_t>(leftMask | (rightMask << 4));
+		}
+#else
+		for (int edge{ 0 }; edge < 3; ++edge)
+		{
+			std::uint32_t edgeMask{};
+			for (int column{ 0 }; column < TILE_WIDTH; ++column)
+			{
+				float value{ triangle.edgeA[edge] * (x0 + column) + triangle.edgeB[edge] * y + triangle.edgeC[edge] };
+				edgeMask |= (value >= 0.0f ? 1u : 0u) << column;
+			}
+			rowMask &= edgeMask;
+		}
+#endif
+
+		mask |= rowMask << (row * TILE_WIDTH);
+	}
+
+	return mask;
+}
+
+
+void OcclusionBuffer::updateTile(Tile& tile, std::uint32_t coverage, float z)
+{
+	if (!coverage || z >= tile.zMax0)
+		return;
+
+	if (coverage == FULL_TILE)
+	{
+		tile.zMax0 = z;
+		if (tile.mask && tile.zMax1 >= tile.zMax0)
+			tile.mask = 0;
+		return;
+	}
+
+	// the working layer grows until it covers the tile, then it becomes the new zMax0
+	std::uint32_t mask{ tile.mask | coverage };
+	float zMax1{ tile.mask ? std::max(tile.zMax1, z) : z };
+	if (mask == FULL_TILE)
+	{
+		tile.zMax0 = zMax1;
+		tile.mask = 0;
+		return;
+	}
+
+	tile.mask = mask;
+	tile.zMax1 = zMax1;
+}
+
+
+void OcclusionBuffer::rasterizeRows(int firstRow, int endRow)
+{
+	for (const std::vector<ScreenTriangle>& list : m_triangles)
+	{
+		for (const ScreenTriangle& triangle : list)
+		{
+			int rowBegin{ std::max(firstRow, triangle.tileMinY) };
+			int rowEnd{ std::min(endRow, triangle.tileMaxY + 1) };
+
+			for (int tileY{ rowBegin }; tileY < rowEnd; ++tileY)
+			{
+				for (int tileX{ triangle.tileMinX }; tileX <= triangle.tileMaxX; ++tileX)
+				{
+					Tile& tile{ m_tiles[static_cast<std::size_t>(tileY) * m_tilesX + tileX] };
+					if (triangle.zMax < tile.zMax0)
+						updateTile(tile, coverage(triangle, tileX, tileY), triangle.zMax);
+				}
+			}
+		}
+	}
+}
+
+
+void OcclusionBuffer::rasterize(ThreadPool& pool)
+{
+	// every band owns its tile rows, so no two threads touch the same tile
+	constexpr std::size_t MIN_ROWS_PER_BAND{ 4 };
+
+	parallelFor(pool, static_cast<std::size_t>(m_tilesY), MIN_ROWS_PER_BAND,
+		[this](std::size_t begin, std::size_t end, std::size_t)
+		{
+			rasterizeRows(static_cast<int>(begin), static_cast<int>(end));
+		});
+
+	buildHierarchy();
+}
+
+
+void OcclusionBuffer::buildHierarchy()
+{
+	m_levels.resize(1);
+	Level& base{ m_levels[0] };
+	base.width = m_tilesX;
+	base.height = m_tilesY;
+	base.depth.resize(m_tiles.size());
+	for (std::size_t i{ 0 }; i < m_tiles.size(); ++i)
+		base.depth[i] = m_tiles[i].zMax0;
+
+	while (m_levels.back().width > 1 || m_levels.back().height > 1)
+	{
+		const Level& below{ m_levels.back() };
+		Level level{};
+		level.width = (below.width + 1) / 2;
+		level.height = (below.height + 1) / 2;
+		level.depth.resize(static_cast<std::size_t>(level.width) * level.height);
+
+		for (int y{ 0 }; y < level.height; ++y)
+		{
+			for (int x{ 0 }; x < level.width; ++x)
+			{
+				float depth{ 0.0f };
+				for (int dy{ 0 }; dy < 2; ++dy)
+				{
+					for (int dx{ 0 }; dx < 2; ++dx)
+					{
+						int belowX{ std::min(2 * x + dx, below.width - 1) };
+						int belowY{ std::min(2 * y + dy, below.height - 1) };
+						depth = std::max(depth, below.depth[static_cast<std::size_t>(belowY) * below.width + belowX]);
+					}
+				}
+				level.depth[static_cast<std::size_t>(y) * level.width + x] = depth;
+			}
+		}
+
+		m_levels.push_back(std::move(level));
+	}
+}
+
+
+bool OcclusionBuffer::occluded(const glm::mat4& toWorld, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+{
+	if (m_levels.empty())
+		return false;
+
+	glm::mat4 clip{ m_viewProjection * toWorld };
+
+	// screen rectangle and nearest depth of the eight corners
+	float minX{ std::numeric_limits<float>::max() };
+	float minY{ std::numeric_limits<float>::max() };
+	float maxX{ -std::numeric_limits<float>::max() };
+	float maxY{ -std::numeric_limits<float>::max() };
+	float minZ{ std::numeric_limits<float>::max() };
+
+	for (int corner{ 0 }; corner < 8; ++corner)
+	{
+		glm::vec4 position{ clip * glm::vec4(
+			(corner & 1) ? boundsMax.x : boundsMin.x,
+			(corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z, 1.0f) };
+
+		if (position.w <= 0.0f || position.z < -position.w)
+			return false;
+
+		glm::vec3 ndc{ glm::vec3(position) / position.w };
+		minX = std::min(minX, (ndc.x * 0.5f + 0.5f) * m_width);
+		maxX = std::max(maxX, (ndc.x * 0.5f + 0.5f) * m_width);
+		minY = std::min(minY, (ndc.y * 0.5f + 0.5f) * m_height);
+		maxY = std::max(maxY, (ndc.y * 0.5f + 0.5f) * m_height);
+		minZ = std::min(minZ, ndc.z * 0.5f + 0.5f);
+	}
+
+	// off screen is the frustum test's job
+	if (maxX < 0.0f || maxY < 0.0f || minX >= m_width || minY >= m_height)
+		return false;
+
+	int tileMinX{ std::max(0, static_cast<int>(minX) / TILE_WIDTH) };
+	int tileMinY{ std::max(0, static_cast<int>(minY) / TILE_HEIGHT) };
+	int tileMaxX{ std::min(m_tilesX - 1, static_cast<int>(maxX) / TILE_WIDTH) };
+	int tileMaxY{ std::min(m_tilesY - 1, static_cast<int>(maxY) / TILE_HEIGHT) };
+
+	// first the level where the rectangle spans at most 2x2 entries: behind all of
+	// them means behind every tile under them
+	std::size_t levelIndex{ 0 };
+	while (levelIndex + 1 < m_levels.size()
+		&& ((tileMaxX >> levelIndex) - (tileMinX >> levelIndex) > 1 || (tileMaxY >> levelIndex) - (tileMinY >> levelIndex) > 1))
+		++levelIndex;
+
+	const Level& level{ m_levels[levelIndex] };
+	bool coarseOccluded{ true };
+	for (int y{ tileMinY >> levelIndex }; y <= (tileMaxY >> levelIndex) && coarseOccluded; ++y)
+	{
+		for (int x{ tileMinX >> levelIndex }; x <= (tileMaxX >> levelIndex); ++x)
+		{
+			if (minZ <= level.depth[static_cast<std::size_t>(y) * level.width + x])
+			{
+				coarseOccluded = false;
+				break;
+			}
+		}
+	}
+	if (coarseOccluded || levelIndex == 0)
+		return coarseOccluded;
+
+	// the coarse level is too conservative, try the tiles themselves
+	const Level& tiles{ m_levels[0] };
+	for (int y{ tileMinY }; y <= tileMaxY; ++y)
+	{
+		for (int x{ tileMinX }; x <= tileMaxX; ++x)
+		{
+			if (minZ <= tiles.depth[static_cast<std::size_t>(y) * tiles.width + x])
+				return false;
+		}
+	}
+	return true;
+}
+
+
+std::size_t OcclusionBuffer::triangleCount() const
+{
+	std::size_t count{};
+	for (const std::vector<ScreenTriangle>& list : m_triangles)
+		count += list.size();
+	return count;
+}
+
+#endif // !OCCLUSION_BUFFER_H
@@ -0,0 +1,277 @@
+#pragma once
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+#include "Model.h"
+#include "Shader.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// GPU occlusion culling of a model's meshes with GL_ANY_SAMPLES_PASSED queries
+// on their bounding boxes, in the spirit of CHC++:
+//  - last frame's answer decides whether a mesh is queued (hidden()), so the
+//    CPU never waits for a result
+//  - after the main pass, the boxes of hidden meshes are queried against its
+//    depth every frame, those of visible meshes only every few frames
+//  - a hidden mesh with a query in flight is drawn under conditional rendering,
+//    so the GPU still draws it this frame if its box turns out visible and it
+//    does not pop in a frame late
+// GL thread only
+class OcclusionQueries
+{
+private:
+	// frames between two queries of a mesh that was visible, each mesh is offset
+	// by its index so the queries of a big visible set are spread out
+	static constexpr unsigned int VISIBLE_QUERY_INTERVAL{ 8 };
+
+	struct MeshState
+	{
+		GLQuery query{};
+		bool pending{ false };		// issued, result not read yet
+		bool visible{ true };
+		bool conditional{ false };	// drawn under conditional rendering this frame
+	};
+
+	std::vector<MeshState> m_states{};
+	std::vector<std::uint8_t> m_hidden{};
+	AssetId m_model{};
+	unsigned int m_frame{};
+
+	// model space boxes of this frame, per mesh
+	CullingBounds m_bounds{};
+	std::vector<glm::vec3> m_boundsMin{};
+	std::vector<glm::vec3> m_boundsMax{};
+	std::vector<std::uint8_t> m_inFrustum{};
+
+	// unit cube the boxes are drawn with
+	GLVertexArray m_boxVAO{};
+	GLBuffer m_boxVBO{};
+	GLBuffer m_boxEBO{};
+	const Shader& m_boxShader;
+	Uniform<glm::mat4> m_boxTransform{};
+
+	unsigned int m_issued{};
+	unsigned int m_conditional{};
+
+	void createBox();
+
+	// start over for a different model, everything counts as visible
+	void reset(const Model& model);
+
+public:
+	// boxShader draws the unit cube at location 0 through the Camera block and a
+	// "box" matrix. Its samples only count, nothing is written
+	explicit OcclusionQueries(const Shader& boxShader);
+
+	OcclusionQueries(const OcclusionQueries&) = delete;
+	OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+	// read back every finished query, before the frame's meshes are submitted
+	void collect(const Model& model);
+
+	// 1 for meshes hidden at the last answer, for Model::submit()
+	const std::vector<std::uint8_t>& hidden() const { return m_hidden; }
+
+	// issue this frame's queries against the depth of the finished main pass
+	// and draw the queried hidden meshes conditionally with shader, whose samplers
+	// and blocks are set up like for the main pass. camera is in world space
+	void issue(const Model& model, const glm::mat4& modelMatrix, const Frustum& frustum,
+		const glm::vec3& camera, const Shader& shader, Uniform<glm::mat4> modelUniform);
+
+	unsigned int issuedCount() const { return m_issued; }
+	unsigned int conditionalCount() const { return m_conditional; }
+	unsigned int hiddenCount() const;
+};
+
+
+OcclusionQueries::OcclusionQueries(const Shader& boxShader)
+	: m_boxShader{ boxShader }
+{
+	m_boxTransform = m_boxShader.uniform<glm::mat4>("box");
+	createBox();
+}
+
+
+void OcclusionQueries::createBox()
+{
+	float corners[]{
+		0.0f, 0.0f, 0.0f,	1.0f, 0.0f, 0.0f,	1.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,	1.0f, 0.0f, 1.0f,	1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 1.0f,
+	};
+	unsigned int faces[]{
+		0, 2, 1,	0, 3, 2,	// z = 0
+		4, 5, 6,	4, 6, 7,	// z = 1
+		0, 1, 5,	0, 5, 4,	// y = 0
+		3, 7, 6,	3, 6, 2,	// y = 1
+		0, 4, 7,	0, 7, 3,	// x = 0
+		1, 2, 6,	1, 6, 5,	// x = 1
+	};
+
+	m_boxVAO = GLVertexArray::create();
+	m_boxVBO = GLBuffer::create();
+	m_boxEBO = GLBuffer::create();
+
+	glState().bindVertexArray(m_boxVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_boxVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_boxEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+	glState().bindVertexArray(0);
+
+	gpuMemory().track(GLObjectType::Buffer, m_boxVBO, MemoryCategory::SceneGeometry, 0, "occlusion box",
+		sizeof(corners));
+	gpuMemory().track(GLObjectType::Buffer, m_boxEBO, MemoryCategory::SceneGeometry, 0, "occlusion box indices",
+		sizeof(faces));
+}
+
+
+void OcclusionQueries::reset(const Model& model)
+{
+	m_model = model.assetId();
+	m_states.clear();
+	m_states.resize(model.meshCount());
+	m_hidden.assign(model.meshCount(), 0);
+}
+
+
+void OcclusionQueries::collect(const Model& model)
+{
+	if (model.assetId() != m_model || m_states.size() != model.meshCount())
+		reset(model);
+
+	for (std::size_t i{ 0 }; i < m_states.size(); ++i)
+	{
+		MeshState& state{ m_states[i] };
+		if (!state.pending)
+			continue;
+
+		GLuint available{};
+		glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		GLuint samples{};
+		glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samples);
+		state.pending = false;
+		state.visible = samples != 0;
+		m_hidden[i] = state.visible ? 0 : 1;
+	}
+}
+
+
+void OcclusionQueries::issue(const Model& model, const glm::mat4& modelMatrix, const Frustum& frustum,
+	const glm::vec3& camera, const Shader& shader, Uniform<glm::mat4> modelUniform)
+{
+	++m_frame;
+	m_issued = 0;
+	m_conditional = 0;
+	if (m_states.size() != model.meshCount())
+		return;
+
+	// boxes in model space, tested against the frustum in model space as well
+	m_bounds.clear();
+	m_boundsMin.resize(m_states.size());
+	m_boundsMax.resize(m_states.size());
+	for (unsigned int i{ 0 }; i < m_states.size(); ++i)
+	{
+		model.meshBounds(i, m_boundsMin[i], m_boundsMax[i]);
+		m_bounds.add(m_boundsMin[i], m_boundsMax[i]);
+	}
+	m_bounds.cull(frustum.transformed(modelMatrix), m_inFrustum);
+
+	// a box the camera is in (or nearly, the near plane would cut it open) can't
+	// answer anything, it just counts as visible
+	constexpr float NEAR_MARGIN{ 0.2f };
+	glm::vec3 localCamera{ glm::inverse(modelMatrix) * glm::vec4(camera, 1.0f) };
+	glm::vec3 margin{ glm::inverse(glm::mat3(modelMatrix)) * glm::vec3(NEAR_MARGIN) };
+	margin = glm::abs(margin);
+
+	glState().colorMask(false, false, false, false);
+	glState().depthMask(false);
+	m_boxShader.use();
+	glState().bindVertexArray(m_boxVAO);
+
+	for (unsigned int i{ 0 }; i < m_states.size(); ++i)
+	{
+		MeshState& state{ m_states[i] };
+		state.conditional = false;
+		if (!m_inFrustum[i] || !model.mesh(i).isReady())
+			continue;
+
+		// still waiting for an older answer: a hidden mesh is drawn on that one
+		if (state.pending)
+		{
+			state.conditional = !state.visible;
+			continue;
+		}
+
+		glm::vec3 nearMin{ m_boundsMin[i] - margin };
+		glm::vec3 nearMax{ m_boundsMax[i] + margin };
+		if (localCamera.x >= nearMin.x && localCamera.y >= nearMin.y && localCamera.z >= nearMin.z
+			&& localCamera.x <= nearMax.x && localCamera.y <= nearMax.y && localCamera.z <= nearMax.z)
+		{
+			state.visible = true;
+			m_hidden[i] = 0;
+			continue;
+		}
+
+		if (state.visible && (m_frame + i) % VISIBLE_QUERY_INTERVAL != 0)
+			continue;
+
+		// the unit cube stretched over the box
+		glm::vec3 size{ m_boundsMax[i] - m_boundsMin[i] };
+		glm::mat4 box{ glm::vec4(size.x, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, size.y, 0.0f, 0.0f),
+			glm::vec4(0.0f, 0.0f, size.z, 0.0f), glm::vec4(m_boundsMin[i], 1.0f) };
+		m_boxShader.set(m_boxTransform, modelMatrix * box);
+
+		if (!state.query)
+			state.query = GLQuery::create();
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, state.query);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+		state.pending = true;
+		state.conditional = !state.visible;
+		++m_issued;
+	}
+
+	glState().colorMask(true, true, true, true);
+	glState().depthMask(true);
+
+	// hidden meshes with a query in flight: the GPU draws them only if their box
+	// passed, without the CPU ever waiting for the answer
+	shader.use();
+	shader.set(modelUniform, modelMatrix);
+	for (unsigned int i{ 0 }; i < m_states.size(); ++i)
+	{
+		if (!m_states[i].conditional)
+			continue;
+
+		glBeginConditionalRender(m_states[i].query, GL_QUERY_NO_WAIT);
+		model.mesh(i).Draw();
+		glEndConditionalRender();
+		++m_conditional;
+	}
+}
+
+
+unsigned int OcclusionQueries::hiddenCount() const
+{
+	unsigned int count{};
+	for (std::uint8_t hidden : m_hidden)
+		count += hidden;
+	return count;
+}
+
+#endif // !OCCLUSION_QUERIES_H
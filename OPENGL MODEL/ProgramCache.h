@@ -0,0 +1,276 @@
+#pragma once
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+
+// ARB_get_program_binary, core in 4.1. glad is generated for 3.3
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+using GetProgramBinaryProc = void (APIENTRY*)(GLuint program, GLsizei bufSize, GLsizei* length,
+	GLenum* binaryFormat, void* binary);
+using ProgramBinaryProc = void (APIENTRY*)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+using ProgramParameteriProc = void (APIENTRY*)(GLuint program, GLenum pname, GLint value);
+
+
+// Linked programs saved to disk between runs, so a warm start loads them instead
+// of compiling. A program's key hashes its final sources (includes expanded,
+// defines added) together with the vendor, renderer and version strings, so an
+// edited shader or a driver update simply misses. The driver may still reject
+// a binary, e.g. after an update that kept the version string; the file is then
+// deleted and the caller compiles as usual.
+// Does nothing until open() found program binary support. GL thread only
+class ProgramCache
+{
+private:
+	static constexpr std::uint32_t MAGIC{ 0x31425047 };		// "GPB1"
+
+	// in front of every binary, the driver string follows it
+	struct FileHeader
+	{
+		std::uint32_t magic{ MAGIC };
+		std::uint32_t format{};
+		std::uint64_t key{};
+		std::uint32_t driverLength{};
+		std::uint32_t binaryLength{};
+	};
+
+	GetProgramBinaryProc m_getProgramBinary{ nullptr };
+	ProgramBinaryProc m_programBinary{ nullptr };
+	ProgramParameteriProc m_programParameteri{ nullptr };
+
+	std::filesystem::path m_directory{};
+	std::string m_driver{};
+	bool m_enabled{ false };
+
+	unsigned int m_loaded{};
+	unsigned int m_compiled{};
+	unsigned int m_rejected{};
+
+	std::filesystem::path file(std::uint64_t key) const;
+
+	// FNV-1a, stable across runs and platforms unlike std::hash
+	static std::uint64_t hash(std::uint64_t seed, const std::string& text);
+
+public:
+	// use directory for the binaries, created if missing. False when the
+	// context cannot hand out program binaries
+	bool open(GLADloadproc load, const std::string& directory);
+
+	bool enabled() const { return m_enabled; }
+
+	std::uint64_t key(const std::string& vertexSource, const std::string& fragmentSource) const;
+
+	// link program from the binary stored under key. False on a miss or a
+	// rejected binary, program is then still unlinked
+	bool load(unsigned int program, std::uint64_t key);
+
+	// before linking a program that is going to be stored
+	void prepare(unsigned int program) const;
+
+	// save the binary of a freshly linked program under key
+	void store(unsigned int program, std::uint64_t key);
+
+	unsigned int loadedCount() const { return m_loaded; }
+	unsigned int compiledCount() const { return m_compiled; }
+	unsigned int rejectedCount() const { return m_rejected; }
+};
+
+inline ProgramCache& programCache()
+{
+	static ProgramCache cache{};
+	return cache;
+}
+
+
+bool ProgramCache::open(GLADloadproc load, const std::string& directory)
+{
+	GLint major{};
+	GLint minor{};
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	bool supported{ major > 4 || (major == 4 && minor >= 1) };
+	GLint count{};
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i{ 0 }; i < count && !supported; ++i)
+	{
+		const char* name{ reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)) };
+		supported = std::strcmp(name, "GL_ARB_get_program_binary") == 0;
+	}
+
+	// some drivers expose the entry points but no format to save in
+	GLint formats{};
+	if (supported)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats > 0)
+	{
+		m_getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+		m_programBinary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+		m_programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+	}
+
+	std::error_code error{};
+	m_directory = directory;
+	std::filesystem::create_directories(m_directory, error);
+
+	m_enabled = m_getProgramBinary && m_programBinary && m_programParameteri && !error;
+	if (!m_enabled)
+	{
+		std::cout << "Program cache disabled: " << (error ? error.message() : "no program binary support") << "\n";
+		return false;
+	}
+
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		m_driver += reinterpret_cast<const char*>(glGetString(name));
+		m_driver += '\n';
+	}
+	return true;
+}
+
+
+std::uint64_t ProgramCache::hash(std::uint64_t seed, const std::string& text)
+{
+	std::uint64_t value{ seed };
+	for (unsigned char c : text)
+	{
+		value ^= c;
+		value *= 0x100000001B3ull;
+	}
+	return value;
+}
+
+
+std::uint64_t ProgramCache::key(const std::string& vertexSource, const std::string& fragmentSource) const
+{
+	// the lengths keep "ab" + "c" apart from "a" + "bc"
+	std::uint64_t value{ 0xCBF29CE484222325ull };
+	value = hash(value, m_driver);
+	value = hash(value, std::to_string(vertexSource.size()) + ':' + vertexSource);
+	value = hash(value, std::to_string(fragmentSource.size()) + ':' + fragmentSource);
+	return value;
+}
+
+
+std::filesystem::path ProgramCache::file(std::uint64_t key) const
+{
+	char name[32]{};
+	std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+	return m_directory / name;
+}
+
+
+bool ProgramCache::load(unsigned int program, std::uint64_t key)
+{
+	if (!m_enabled)
+		return false;
+
+	std::ifstream stream{ file(key), std::ios::binary };
+	if (!stream)
+		return false;
+
+	FileHeader header{};
+	std::string driver{};
+	std::vector<char> binary{};
+	if (stream.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == MAGIC && header.key == key
+		&& header.driverLength == m_driver.size())
+	{
+		driver.resize(header.driverLength);
+		binary.resize(header.binaryLength);
+		stream.read(driver.data(), driver.size());
+		stream.read(binary.data(), binary.size());
+		if (!stream)
+			binary.clear();
+	}
+	stream.close();
+
+	// a short or foreign file counts as rejected, like a binary the driver refuses
+	GLint linked{ GL_FALSE };
+	if (!binary.empty() && driver == m_driver)
+	{
+		m_programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	}
+
+	if (!linked)
+	{
+		std::error_code error{};
+		std::filesystem::remove(file(key), error);
+		++m_rejected;
+		return false;
+	}
+
+	++m_loaded;
+	return true;
+}
+
+
+void ProgramCache::prepare(unsigned int program) const
+{
+	if (m_enabled)
+		m_programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+
+void ProgramCache::store(unsigned int program, std::uint64_t key)
+{
+	++m_compiled;
+	if (!m_enabled)
+		return;
+
+	GLint length{};
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	FileHeader header{};
+	header.key = key;
+	header.driverLength = static_cast<std::uint32_t>(m_driver.size());
+	std::vector<char> binary(length);
+	GLsizei written{};
+	GLenum format{};
+	m_getProgramBinary(program, length, &written, &format, binary.data());
+	header.format = format;
+	header.binaryLength = static_cast<std::uint32_t>(written);
+
+	// written under a temporary name and renamed, a crash never leaves half a binary
+	std::filesystem::path target{ file(key) };
+	std::filesystem::path temporary{ target };
+	temporary += ".tmp";
+	bool complete{ false };
+	{
+		std::ofstream stream{ temporary, std::ios::binary | std::ios::trunc };
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(m_driver.data(), m_driver.size());
+		stream.write(binary.data(), written);
+		complete = static_cast<bool>(stream);
+	}
+
+	std::error_code error{};
+	if (complete)
+		std::filesystem::rename(temporary, target, error);
+	if (!complete || error)
+		std::filesystem::remove(temporary, error);
+}
+
+#endif // !PROGRAM_CACHE_H
@@ -0,0 +1,325 @@
+#pragma once
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glm/glm.hpp>
+#include "CommandList.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+// passes in execution order, the pass is the most significant part of the key
+enum class RenderPass : std::uint8_t
+{
+	Shadow,			// depth only, no material textures
+	DynamicShadow,	// the same for casters that move, drawn over the cached static shadow map
+	DepthPrepass,	// camera depth only, the opaque pass then shades each pixel once
+	Opaque,
+
+	Skipped = 0xF,	// reserved slot left empty, sorts behind every pass and is dropped
+};
+
+// passes drawn with positions only and without material textures
+inline bool isDepthOnly(RenderPass pass)
+{
+	return pass == RenderPass::Shadow || pass == RenderPass::DynamicShadow || pass == RenderPass::DepthPrepass;
+}
+
+
+// 64-bit sort key, most significant first:
+//   pass (4) | shader (8) | material (16) | vertex array (12) | depth (24)
+// so draws are grouped by the most expensive state change first and go
+// front-to-back inside a group (inside a shader for depth only passes). Shader
+// and VAO use the low bits of the GL name, a collision only costs a state
+// switch, never a wrong draw
+namespace SortKey
+{
+	constexpr int DEPTH_BITS{ 24 };
+	constexpr int VAO_SHIFT{ 24 };
+	constexpr int MATERIAL_SHIFT{ 36 };
+	constexpr int SHADER_SHIFT{ 52 };
+	constexpr int PASS_SHIFT{ 60 };
+
+	static_assert(sizeof(MaterialId) * 8 == SHADER_SHIFT - MATERIAL_SHIFT, "MaterialId must fill the material field");
+
+	inline std::uint64_t make(RenderPass pass, unsigned int program, MaterialId material,
+		unsigned int vertexArray, float depth01)
+	{
+		// depth only passes bind no material, and each mesh has a vertex array of its
+		// own anyway: sort them purely front-to-back, which early depth rejection likes
+		if (isDepthOnly(pass))
+		{
+			material = 0;
+			vertexArray = 0;
+		}
+
+		const std::uint64_t maxDepth{ (1ull << DEPTH_BITS) - 1 };
+		std::uint64_t depth{ static_cast<std::uint64_t>(std::clamp(depth01, 0.0f, 1.0f) * maxDepth) };
+
+		return (static_cast<std::uint64_t>(pass) & 0xF) << PASS_SHIFT
+			| (static_cast<std::uint64_t>(program) & 0xFF) << SHADER_SHIFT
+			| static_cast<std::uint64_t>(material) << MATERIAL_SHIFT
+			| (static_cast<std::uint64_t>(vertexArray) & 0xFFF) << VAO_SHIFT
+			| depth;
+	}
+
+	inline RenderPass pass(std::uint64_t key) { return static_cast<RenderPass>(key >> PASS_SHIFT); }
+}
+
+
+class IndirectGeometry;
+
+
+// what a queued draw needs at execution time
+struct DrawItem
+{
+	const Shader* shader{};
+	Uniform<glm::mat4> modelUniform{};
+	unsigned int transform{};		// index into the queue's transforms
+	const Mesh* mesh{};
+
+	// where the mesh sits in its model's merged buffers, null if it has none (yet)
+	const IndirectGeometry* geometry{};
+	unsigned int meshIndex{};
+};
+
+
+// Collects the draws of a frame, sorts them by key with an LSD radix sort and
+// executes them pass by pass, skipping shader and model matrix changes that
+// are not needed
+class RenderQueue
+{
+private:
+	std::vector<glm::mat4> m_transforms{};
+	std::vector<DrawItem> m_items{};
+
+	// key / item index pairs, sorted in place
+	struct Entry
+	{
+		std::uint64_t key{};
+		unsigned int item{};
+	};
+	std::vector<Entry> m_entries{};
+	std::vector<Entry> m_scratch{};
+
+	void radixSort();
+
+	// first / one past last entry of a pass, entries must be sorted
+	std::pair<std::size_t, std::size_t> passRange(RenderPass pass) const;
+
+	// record the sorted entries [begin, end) as if they were executed
+	void recordRange(CommandList& list, std::size_t begin, std::size_t end) const;
+
+public:
+	void clear()
+	{
+		m_transforms.clear();
+		m_items.clear();
+		m_entries.clear();
+	}
+
+	// model matrices are shared by every draw of the object they belong to
+	unsigned int addTransform(const glm::mat4& transform)
+	{
+		m_transforms.push_back(transform);
+		return static_cast<unsigned int>(m_transforms.size() - 1);
+	}
+
+	// depth01 is the distance of the draw to the viewer, 0 near ... 1 far
+	void submit(RenderPass pass, const Shader& shader, Uniform<glm::mat4> modelUniform, unsigned int transform,
+		const Mesh& mesh, float depth01)
+	{
+		m_entries.push_back({ SortKey::make(pass, shader.ID, mesh.materialId(), mesh.vertexArray(), depth01),
+			static_cast<unsigned int>(m_items.size()) });
+		m_items.push_back({ &shader, modelUniform, transform, &mesh });
+	}
+
+	// reserve count slots that several threads then fill through submitAt() / skip(),
+	// returns the first slot. Every slot must be filled before sort()
+	std::size_t allocate(std::size_t count)
+	{
+		std::size_t first{ m_entries.size() };
+		m_entries.resize(first + count);
+		m_items.resize(first + count);
+		return first;
+	}
+
+	// fill a reserved slot. Different slots may be written from different threads
+	void submitAt(std::size_t slot, RenderPass pass, const Shader& shader, Uniform<glm::mat4> modelUniform,
+		unsigned int transform, const Mesh& mesh, float depth01, const IndirectGeometry* geometry = nullptr,
+		unsigned int meshIndex = 0)
+	{
+		m_entries[slot] = { SortKey::make(pass, shader.ID, mesh.materialId(), mesh.vertexArray(), depth01),
+			static_cast<unsigned int>(slot) };
+		m_items[slot] = { &shader, modelUniform, transform, &mesh, geometry, meshIndex };
+	}
+
+	// leave a reserved slot without a draw
+	void skip(std::size_t slot)
+	{
+		m_entries[slot] = { ~0ull, static_cast<unsigned int>(slot) };
+	}
+
+	// sort by key, skipped slots end up last and are dropped
+	void sort()
+	{
+		radixSort();
+		while (!m_entries.empty() && SortKey::pass(m_entries.back().key) == RenderPass::Skipped)
+			m_entries.pop_back();
+	}
+
+	// issue every draw of one pass, in key order
+	void execute(RenderPass pass) const;
+
+	// record one pass into lists instead, split into chunks of at least minChunk draws
+	// that are recorded on the pool in parallel. Replaying the lists in order
+	// (replayAll) issues the same calls execute() would
+	void record(ThreadPool& pool, RenderPass pass, std::vector<CommandList>& lists, std::size_t minChunk) const;
+
+	// call f(const DrawItem&) for every draw of one pass, in key order
+	template <typename F>
+	void forEach(RenderPass pass, F&& f) const
+	{
+		std::pair<std::size_t, std::size_t> range{ passRange(pass) };
+		for (std::size_t i{ range.first }; i < range.second; ++i)
+			f(m_items[m_entries[i].item]);
+	}
+
+	const std::vector<glm::mat4>& transforms() const { return m_transforms; }
+
+	std::size_t size() const { return m_entries.size(); }
+};
+
+
+void RenderQueue::radixSort()
+{
+	m_scratch.resize(m_entries.size());
+
+	// 8 passes of 8 bits, least significant byte first. A byte every key
+	// shares (unused shader bits, a single pass, ...) is skipped
+	for (int shift{ 0 }; shift < 64; shift += 8)
+	{
+		std::size_t counts[256]{};
+		for (const Entry& entry : m_entries)
+			++counts[(entry.key >> shift) & 0xFF];
+
+		if (!m_entries.empty() && counts[(m_entries[0].key >> shift) & 0xFF] == m_entries.size())
+			continue;
+
+		std::size_t offset{};
+		for (std::size_t& count : counts)
+		{
+			std::size_t bucket{ count };
+			count = offset;
+			offset += bucket;
+		}
+
+		for (const Entry& entry : m_entries)
+			m_scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+
+		m_entries.swap(m_scratch);
+	}
+}
+
+
+std::pair<std::size_t, std::size_t> RenderQueue::passRange(RenderPass pass) const
+{
+	// entries are sorted, so the pass is one contiguous range
+	auto byKey{ [](const Entry& entry, std::uint64_t key) { return entry.key < key; } };
+	const std::uint64_t passStart{ static_cast<std::uint64_t>(pass) << SortKey::PASS_SHIFT };
+	const std::uint64_t passEnd{ (static_cast<std::uint64_t>(pass) + 1) << SortKey::PASS_SHIFT };
+
+	auto first{ std::lower_bound(m_entries.begin(), m_entries.end(), passStart, byKey) };
+	auto last{ std::lower_bound(first, m_entries.end(), passEnd, byKey) };
+
+	return { static_cast<std::size_t>(first - m_entries.begin()), static_cast<std::size_t>(last - m_entries.begin()) };
+}
+
+
+void RenderQueue::execute(RenderPass pass) const
+{
+	const Shader* shader{ nullptr };
+	unsigned int transform{ ~0u };
+
+	auto [first, last] { passRange(pass) };
+	for (std::size_t i{ first }; i < last; ++i)
+	{
+		const Entry& entry{ m_entries[i] };
+		const DrawItem& item{ m_items[entry.item] };
+
+		if (item.shader != shader)
+		{
+			shader = item.shader;
+			shader->use();
+			transform = ~0u;	// uniforms are per program
+		}
+
+		if (item.transform != transform)
+		{
+			transform = item.transform;
+			shader->set(item.modelUniform, m_transforms[transform]);
+		}
+
+		if (isDepthOnly(pass))
+			item.mesh->DrawGeometry();
+		else
+			item.mesh->Draw();
+	}
+}
+
+
+void RenderQueue::recordRange(CommandList& list, std::size_t begin, std::size_t end) const
+{
+	// every list starts from unknown state, the state cache drops the
+	// binds that repeat the end of the previous list on replay
+	const Shader* shader{ nullptr };
+	unsigned int transform{ ~0u };
+
+	for (std::size_t i{ begin }; i < end; ++i)
+	{
+		const Entry& entry{ m_entries[i] };
+		const DrawItem& item{ m_items[entry.item] };
+
+		if (item.shader != shader)
+		{
+			shader = item.shader;
+			list.useProgram(shader->ID);
+			transform = ~0u;
+		}
+
+		if (item.transform != transform)
+		{
+			transform = item.transform;
+			list.setUniform(item.modelUniform, m_transforms[transform]);
+		}
+
+		item.mesh->record(list, !isDepthOnly(SortKey::pass(entry.key)));
+	}
+}
+
+
+void RenderQueue::record(ThreadPool& pool, RenderPass pass, std::vector<CommandList>& lists,
+	std::size_t minChunk) const
+{
+	std::pair<std::size_t, std::size_t> range{ passRange(pass) };
+	std::size_t first{ range.first };
+	std::size_t count{ range.second - range.first };
+
+	// one list per chunk, kept between frames so their buffers are reused
+	lists.resize(std::max<std::size_t>(1, chunkCount(pool, count, minChunk)));
+	for (CommandList& list : lists)
+		list.clear();
+
+	parallelFor(pool, count, minChunk, [&](std::size_t begin, std::size_t end, std::size_t chunk)
+		{
+			recordRange(lists[chunk], first + begin, first + end);
+		});
+}
+
+#endif // !RENDER_QUEUE_H
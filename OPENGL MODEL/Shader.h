@@ -4,143 +4,475 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "ProgramCache.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+
+// KHR_parallel_shader_compile (ARB_ before that). glad is generated for 3.3
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+using MaxShaderCompilerThreadsProc = void (APIENTRY*)(GLuint count);
+
+// what the context offers, filled once by loadParallelShaderCompile()
+struct ParallelShaderCompileSupport
+{
+    bool supported{ false };
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads{ nullptr };
+};
+
+inline ParallelShaderCompileSupport& parallelShaderCompile()
+{
+    static ParallelShaderCompileSupport support{};
+    return support;
+}
+
+// let the driver compile on as many threads as it likes. Without the extension
+// compiles may still run in the background, there is just no way to ask
+// whether one is done without waiting for it
+bool loadParallelShaderCompile(GLADloadproc load);
+
+// uniform location resolved once after linking. T is the type the setter takes,
+// so a handle cannot be fed the wrong kind of value
+template <typename T>
+struct Uniform
+{
+    GLint location{ -1 };
+
+    explicit operator bool() const { return location >= 0; }
+};
+
+// one active uniform of a linked program
+struct UniformInfo
+{
+    std::string name{};
+    GLint location{ -1 };
+    GLenum type{};
+    GLint size{};
+};
+
+// a #define added to both sources of a shader, right after their #version line
+struct ShaderDefine
+{
+    std::string name{};
+    std::string value{ "1" };
+};
+
+using ShaderDefines = std::vector<ShaderDefine>;
 
 class Shader
 {
 public:
-    unsigned int ID;
-    // constructor generates the shader on the fly
+    // the program is deleted with the shader, so shaders are move-only
+    GLProgram ID;
+    // constructor generates the shader on the fly. The sources may #include
+    // other files, see preprocess(). A program linked from the same sources in an
+    // earlier run is loaded from programCache() instead.
+    // Compiling and linking are only issued here, the results are checked the
+    // first time the program is used. Constructing every shader up front lets
+    // the driver work on all of them while the CPU does something else
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
-    {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines = {})
+    {
+        // 1. retrieve the vertex/fragment source code from filePath, includes resolved
+        std::vector<std::string> vertexFiles;
+        std::vector<std::string> fragmentFiles;
+        std::string vertexCode{ preprocess(vertexPath, defines, vertexFiles) };
+        std::string fragmentCode{ preprocess(fragmentPath, defines, fragmentFiles) };
+        // 2. a binary of the same sources saved by an earlier run skips compiling
+        ID = GLProgram::create();
+        ProgramCache& cache{ programCache() };
+        std::uint64_t key{ cache.key(vertexCode, fragmentCode) };
+        if (cache.load(ID, key))
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            reflectUniforms();
         }
-        catch (std::ifstream::failure& e)
+        else
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            const char* vShaderCode = vertexCode.c_str();
+            const char* fShaderCode = fragmentCode.c_str();
+            // 3. compile shaders, the status is asked for in finish()
+            m_pending = std::make_unique<PendingBuild>();
+            m_pending->key = key;
+            m_pending->vertexFiles = std::move(vertexFiles);
+            m_pending->fragmentFiles = std::move(fragmentFiles);
+            // vertex shader
+            m_pending->vertex = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(m_pending->vertex, 1, &vShaderCode, NULL);
+            glCompileShader(m_pending->vertex);
+            // fragment Shader
+            m_pending->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(m_pending->fragment, 1, &fShaderCode, NULL);
+            glCompileShader(m_pending->fragment);
+            // shader Program
+            glAttachShader(ID, m_pending->vertex);
+            glAttachShader(ID, m_pending->fragment);
+            cache.prepare(ID);
+            glLinkProgram(ID);
+            // flag the shaders for deletion, they live on while attached to the
+            // program, long enough for finish() to read their logs
+            glDeleteShader(m_pending->vertex);
+            glDeleteShader(m_pending->fragment);
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+    }
+
+    // the driver is still compiling or linking. Only known with parallel shader
+    // compile support, otherwise false: asking would mean waiting
+    bool compiling() const
+    {
+        if (!m_pending || !parallelShaderCompile().supported)
+            return false;
 
+        GLint complete{};
+        glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+        return !complete;
+    }
+
+    // wait for the compile and link issued by the constructor, report errors and
+    // read the uniforms. Every use of the program does this first
+    void finish() const
+    {
+        if (!m_pending)
+            return;
+
+        std::unique_ptr<PendingBuild> build{ std::move(m_pending) };
+        checkCompileErrors(build->vertex, "VERTEX", build->vertexFiles);
+        checkCompileErrors(build->fragment, "FRAGMENT", build->fragmentFiles);
+        if (checkCompileErrors(ID, "PROGRAM"))
+            programCache().store(ID, build->key);
+        reflectUniforms();
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     {
-        glUseProgram(ID);
+        finish();
+        glState().useProgram(ID);
     }
-    // utility uniform functions
+    // connect a uniform block to a binding point, does nothing if the block is not active
+    void bindUniformBlock(const char* name, unsigned int binding) const
+    {
+        finish();
+        GLuint index{ glGetUniformBlockIndex(ID, name) };
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+
+    // every active uniform, sorted by name
+    const std::vector<UniformInfo>& uniforms() const
+    {
+        finish();
+        return m_uniforms;
+    }
+
+    // look a uniform up in the reflection table, location -1 if it is not active
+    template <typename T>
+    Uniform<T> findUniform(const std::string& name) const
+    {
+        Uniform<T> handle{};
+        if (const UniformInfo* info{ lookup(name) })
+            handle.location = info->location;
+        return handle;
+    }
+
+    // same, but debug builds complain about unknown names and mismatched types.
+    // resolve handles once at setup, the setters below take them without any lookup
+    template <typename T>
+    Uniform<T> uniform(const std::string& name) const
+    {
+#ifndef NDEBUG
+        const UniformInfo* info{ lookup(name) };
+        if (!info)
+            std::cout << "WARNING::SHADER::UNKNOWN_UNIFORM: " << name << std::endl;
+        else if (!typeMatches<T>(info->type))
+            std::cout << "WARNING::SHADER::UNIFORM_TYPE_MISMATCH: " << name << std::endl;
+#endif
+        return findUniform<T>(name);
+    }
+
+    // setters by handle, the program has to be in use
+    // ------------------------------------------------------------------------
+    void set(Uniform<bool> uniform, bool value) const { glUniform1i(uniform.location, (int)value); }
+    void set(Uniform<int> uniform, int value) const { glUniform1i(uniform.location, value); }
+    void set(Uniform<float> uniform, float value) const { glUniform1f(uniform.location, value); }
+    void set(Uniform<glm::vec2> uniform, const glm::vec2& value) const { glUniform2fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec3> uniform, const glm::vec3& value) const { glUniform3fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec4> uniform, const glm::vec4& value) const { glUniform4fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::mat2> uniform, const glm::mat2& mat) const
+    {
+        glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void set(Uniform<glm::mat3> uniform, const glm::mat3& mat) const
+    {
+        glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4& mat) const
+    {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // utility uniform functions by name, for setup code. These go through the
+    // reflection table instead of asking the driver
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
 
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
-    // utility function for checking shader compilation/linking errors.
+    // a compile and link in flight, see finish()
+    struct PendingBuild
+    {
+        GLuint vertex{};
+        GLuint fragment{};
+        std::uint64_t key{};
+        std::vector<std::string> vertexFiles{};
+        std::vector<std::string> fragmentFiles{};
+    };
+
+    // both filled on first use, hence mutable
+    mutable std::unique_ptr<PendingBuild> m_pending{};
+    mutable std::vector<UniformInfo> m_uniforms{};
+
+    // the source of path ready for glShaderSource: includes expanded, then a
+    // #define line per define after #version, which has to stay the first
+    // directive. files receives the paths read, see expandIncludes()
+    static std::string preprocess(const std::string& path, const ShaderDefines& defines,
+        std::vector<std::string>& files)
+    {
+        std::string source;
+        expandIncludes(path, source, files);
+        if (defines.empty())
+            return source;
+
+        std::size_t insert{ 0 };
+        std::size_t version{ source.find("#version") };
+        if (version != std::string::npos)
+        {
+            insert = source.find('\n', version);
+            if (insert == std::string::npos)
+            {
+                source += '\n';
+                insert = source.size() - 1;
+            }
+            ++insert;
+        }
+
+        // the lines after the defines keep their numbers
+        int line{ static_cast<int>(std::count(source.begin(), source.begin() + insert, '\n')) + 1 };
+        std::string prologue;
+        for (const ShaderDefine& define : defines)
+            prologue += "#define " + define.name + ' ' + define.value + '\n';
+        prologue += "#line " + std::to_string(line) + " 0\n";
+
+        source.insert(insert, prologue);
+        return source;
+    }
+
+    // append path to out with each #include "file" line replaced by that file,
+    // relative to the including one. A file goes in once however often it is
+    // included, so include files need no guards. #if is left to the GLSL compiler,
+    // an #include inside a disabled block is still pasted in.
+    // #line directives keep the compiler's line numbers pointing into the right
+    // file, the source string number of a file is its index in files
+    static void expandIncludes(const std::string& path, std::string& out, std::vector<std::string>& files)
+    {
+        if (std::find(files.begin(), files.end(), path) != files.end())
+            return;
+
+        std::ifstream file{ path };
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return;
+        }
+
+        const std::string number{ std::to_string(files.size()) };
+        if (!files.empty())
+            out += "#line 1 " + number + '\n';
+        files.push_back(path);
+
+        const std::string directory{ path.substr(0, path.find_last_of("/\\") + 1) };
+        std::string line;
+        int lineNumber{ 0 };
+        while (std::getline(file, line))
+        {
+            ++lineNumber;
+            std::string included{ includePath(line) };
+            if (included.empty())
+            {
+                out += line;
+                out += '\n';
+                continue;
+            }
+
+            expandIncludes(directory + included, out, files);
+            out += "#line " + std::to_string(lineNumber + 1) + ' ' + number + '\n';
+        }
+    }
+
+    // the file of an #include "file" line, empty for any other line
+    static std::string includePath(const std::string& line)
+    {
+        std::size_t start{ line.find_first_not_of(" \t") };
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            return {};
+
+        std::size_t open{ line.find('"', start + 8) };
+        std::size_t close{ open == std::string::npos ? open : line.find('"', open + 1) };
+        return close == std::string::npos ? std::string{} : line.substr(open + 1, close - open - 1);
+    }
+
+    const UniformInfo* lookup(const std::string& name) const
+    {
+        finish();
+        auto it{ std::lower_bound(m_uniforms.begin(), m_uniforms.end(), name,
+            [](const UniformInfo& info, const std::string& key) { return info.name < key; }) };
+        return (it != m_uniforms.end() && it->name == name) ? &*it : nullptr;
+    }
+
+    GLint location(const std::string& name) const
+    {
+        const UniformInfo* info{ lookup(name) };
+        return info ? info->location : -1;
+    }
+
+    // enumerate the active uniforms of the linked program into m_uniforms
+    // ------------------------------------------------------------------------
+    void reflectUniforms() const
+    {
+        GLint count{}, maxLength{};
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(std::max(maxLength, 1));
+
+        for (GLint i{ 0 }; i < count; ++i)
+        {
+            GLsizei length{};
+            UniformInfo info{};
+            glGetActiveUniform(ID, i, maxLength, &length, &info.size, &info.type, buffer.data());
+            info.name.assign(buffer.data(), length);
+            info.location = glGetUniformLocation(ID, info.name.c_str());
+
+            // members of uniform blocks have no location
+            if (info.location < 0)
+                continue;
+
+            m_uniforms.push_back(info);
+
+            // arrays of plain types are reported once as "name[0]". Register the bare
+            // name and every element too, element locations are not guaranteed to be contiguous
+            const std::string suffix{ "[0]" };
+            if (info.name.size() > suffix.size()
+                && info.name.compare(info.name.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                std::string base{ info.name.substr(0, info.name.size() - suffix.size()) };
+                m_uniforms.push_back(UniformInfo{ base, info.location, info.type, info.size });
+
+                for (GLint element{ 1 }; element < info.size; ++element)
+                {
+                    std::string name{ base + '[' + std::to_string(element) + ']' };
+                    GLint location{ glGetUniformLocation(ID, name.c_str()) };
+                    m_uniforms.push_back(UniformInfo{ name, location, info.type, 1 });
+                }
+            }
+        }
+
+        std::sort(m_uniforms.begin(), m_uniforms.end(),
+            [](const UniformInfo& a, const UniformInfo& b) { return a.name < b.name; });
+    }
+
+#ifndef NDEBUG
+    // does a GLSL uniform type accept values of the C++ type T
+    template <typename T>
+    static bool typeMatches(GLenum type)
+    {
+        if constexpr (std::is_same_v<T, float>) return type == GL_FLOAT;
+        else if constexpr (std::is_same_v<T, glm::vec2>) return type == GL_FLOAT_VEC2;
+        else if constexpr (std::is_same_v<T, glm::vec3>) return type == GL_FLOAT_VEC3;
+        else if constexpr (std::is_same_v<T, glm::vec4>) return type == GL_FLOAT_VEC4;
+        else if constexpr (std::is_same_v<T, glm::mat2>) return type == GL_FLOAT_MAT2;
+        else if constexpr (std::is_same_v<T, glm::mat3>) return type == GL_FLOAT_MAT3;
+        else if constexpr (std::is_same_v<T, glm::mat4>) return type == GL_FLOAT_MAT4;
+        else if constexpr (std::is_same_v<T, bool>) return type == GL_BOOL || type == GL_INT;
+        else
+        {
+            // ints also set bools and sampler units
+            return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D
+                || type == GL_SAMPLER_CUBE || type == GL_SAMPLER_2D_SHADOW || type == GL_SAMPLER_3D;
+        }
+    }
+#endif
+
+    // utility function for checking shader compilation/linking errors, true if there
+    // were none. files names the source strings the log's line numbers refer to
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type, const std::vector<std::string>& files = {})
     {
         GLint success;
         GLchar infoLog[1024];
@@ -150,7 +482,10 @@ private:
             if (!success)
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog;
+                for (std::size_t i{ 0 }; i < files.size(); ++i)
+                    std::cout << "source " << i << ": " << files[i] << "\n";
+                std::cout << " -- --------------------------------------------------- -- " << std::endl;
             }
         }
         else
@@ -162,6 +497,61 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
+
+
+// Shaders constructed together, so their compiles run side by side in the
+// driver. Each one finishes on its own the first time it is used, finish()
+// waits for the rest at a point of the caller's choosing, e.g. once the assets
+// are loaded
+class ShaderBatch
+{
+private:
+    std::vector<const Shader*> m_shaders{};
+
+public:
+    ShaderBatch() = default;
+    ShaderBatch(std::initializer_list<const Shader*> shaders) : m_shaders{ shaders } {}
+
+    void add(const Shader& shader) { m_shaders.push_back(&shader); }
+
+    // still being compiled, 0 without parallel shader compile support
+    std::size_t compilingCount() const
+    {
+        return std::count_if(m_shaders.begin(), m_shaders.end(), [](const Shader* shader) { return shader->compiling(); });
+    }
+
+    void finish() const
+    {
+        for (const Shader* shader : m_shaders)
+            shader->finish();
+    }
+};
+
+
+bool loadParallelShaderCompile(GLADloadproc load)
+{
+    ParallelShaderCompileSupport& support{ parallelShaderCompile() };
+
+    GLint count{};
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i{ 0 }; i < count && !support.maxShaderCompilerThreads; ++i)
+    {
+        const char* name{ reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)) };
+        if (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0)
+            support.maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(
+                load("glMaxShaderCompilerThreadsKHR"));
+        else if (std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+            support.maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(
+                load("glMaxShaderCompilerThreadsARB"));
+    }
+
+    // 0xFFFFFFFF: as many threads as the implementation wants
+    support.supported = support.maxShaderCompilerThreads != nullptr;
+    if (support.supported)
+        support.maxShaderCompilerThreads(0xFFFFFFFF);
+    return support.supported;
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// The compiled permutations of one vertex / fragment pair. Every feature is a
+// #define the sources test with #if, bit i of a key switches features[i]: the
+// variant is compiled with it defined to 1, or to 0 with the bit clear. A
+// configuration then runs only its own code instead of branching on uniforms.
+// A variant is compiled the first time it is asked for and kept, setup runs
+// once on each new one (sampler units, uniform blocks, constant uniforms) and
+// its "model" matrix uniform is looked up then, draws never search by name.
+// prepare() only issues the compile, so the driver can work on it meanwhile.
+// GL thread only
+class ShaderVariants
+{
+public:
+	using Key = std::uint32_t;
+	using Setup = std::function<void(const Shader&, Key)>;
+
+	// a set up variant and its model matrix uniform
+	struct Program
+	{
+		const Shader& shader;
+		Uniform<glm::mat4> model{};
+	};
+
+private:
+	std::string m_vertexPath{};
+	std::string m_fragmentPath{};
+	std::vector<std::string> m_features{};
+	Setup m_setup{};
+
+	struct Variant
+	{
+		// the render queue and IndirectRenderer keep Shader pointers, it must not move
+		std::unique_ptr<Shader> shader{};
+		Uniform<glm::mat4> model{};
+		bool setUp{ false };
+	};
+
+	std::unordered_map<Key, Variant> m_variants{};
+
+	// the variant get() returned last, a frame asks for the same one again and again.
+	// Map nodes never move, the pointer stays valid
+	Key m_lastKey{};
+	const Variant* m_last{ nullptr };
+
+	Variant& variant(Key key);
+
+public:
+	ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath,
+		std::vector<std::string> features, Setup setup = {})
+		: m_vertexPath{ vertexPath }, m_fragmentPath{ fragmentPath }, m_features{ std::move(features) },
+		m_setup{ std::move(setup) }
+	{
+	}
+
+	ShaderVariants(const ShaderVariants&) = delete;
+	ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+	// the variant of key, compiled now if it is new. Bits past the features are ignored
+	Program get(Key key);
+
+	// start compiling the variant of key without waiting for it or running setup
+	void prepare(Key key) { variant(key); }
+
+	// every feature as a define, 0 or 1 as key says
+	ShaderDefines defines(Key key) const;
+
+	bool compiled(Key key) const { return m_variants.count(key & mask()) != 0; }
+	std::size_t compiledCount() const { return m_variants.size(); }
+	const std::vector<std::string>& features() const { return m_features; }
+
+	Key mask() const { return m_features.size() >= 32 ? ~Key{} : (Key{ 1 } << m_features.size()) - 1; }
+};
+
+
+ShaderVariants::Variant& ShaderVariants::variant(Key key)
+{
+	Variant& entry{ m_variants[key & mask()] };
+	if (!entry.shader)
+		entry.shader = std::make_unique<Shader>(m_vertexPath.c_str(), m_fragmentPath.c_str(), defines(key));
+	return entry;
+}
+
+
+ShaderVariants::Program ShaderVariants::get(Key key)
+{
+	key &= mask();
+	if (m_last && key == m_lastKey)
+		return { *m_last->shader, m_last->model };
+
+	Variant& found{ variant(key) };
+	if (!found.setUp)
+	{
+		found.setUp = true;
+		if (m_setup)
+			m_setup(*found.shader, key);
+		found.model = found.shader->findUniform<glm::mat4>("model");
+	}
+
+	m_lastKey = key;
+	m_last = &found;
+	return { *found.shader, found.model };
+}
+
+
+ShaderDefines ShaderVariants::defines(Key key) const
+{
+	ShaderDefines defines{};
+	defines.reserve(m_features.size());
+	for (std::size_t i{ 0 }; i < m_features.size(); ++i)
+		defines.push_back({ m_features[i], (key >> i) & 1 ? "1" : "0" });
+	return defines;
+}
+
+#endif // !SHADER_VARIANTS_H
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "GLHandle.h"
+#include "GLState.h"
+#include "GpuMemory.h"
+
+#include <cstdint>
+
+
+// everything the static part of the shadow map depends on. The cache is only
+// reused while all of it stays the same
+struct ShadowCacheKey
+{
+	glm::mat4 lightSpace{ 1.0f };		// light direction, distance and projection
+	glm::mat4 model{ 1.0f };			// model placement and scale
+	AssetId modelId{};					// a reloaded model is a new asset
+	std::uint64_t casterVersion{};		// Model::casterVersion()
+	unsigned int readyMeshes{};			// meshes still streaming in appear in the map later
+
+	bool operator==(const ShadowCacheKey& other) const
+	{
+		return lightSpace == other.lightSpace && model == other.model && modelId == other.modelId
+			&& casterVersion == other.casterVersion && readyMeshes == other.readyMeshes;
+	}
+
+	bool operator!=(const ShadowCacheKey& other) const { return !(*this == other); }
+};
+
+
+// Depth of the static shadow casters, kept from frame to frame. While the key
+// stays the same the shadow pass only has to copy it into the shadow map and
+// draw the dynamic casters on top, or nothing at all when there are none.
+// GL thread only
+class ShadowCache
+{
+private:
+	GLTexture m_depth{};
+	GLFramebuffer m_framebuffer{};
+	int m_width{};
+	int m_height{};
+
+	ShadowCacheKey m_key{};
+	bool m_valid{ false };
+
+	unsigned int m_redraws{};
+	unsigned int m_reuses{};
+
+public:
+	// same size and format as the shadow map it is copied into
+	ShadowCache(int width, int height);
+
+	bool valid(const ShadowCacheKey& key) const { return m_valid && m_key == key; }
+
+	// valid(), counted as a reuse when it is
+	bool lookup(const ShadowCacheKey& key)
+	{
+		bool hit{ valid(key) };
+		m_reuses += hit ? 1 : 0;
+		return hit;
+	}
+
+	void invalidate() { m_valid = false; }
+
+	// draw the static casters into this after a clear, then call store()
+	unsigned int framebuffer() const { return m_framebuffer; }
+
+	void store(const ShadowCacheKey& key)
+	{
+		m_key = key;
+		m_valid = true;
+		++m_redraws;
+	}
+
+	// copy the cached depth into the depth attachment of target, which stays bound
+	void copyTo(unsigned int target) const;
+
+	unsigned int redrawCount() const { return m_redraws; }
+	unsigned int reuseCount() const { return m_reuses; }
+};
+
+
+ShadowCache::ShadowCache(int width, int height)
+	: m_depth{ GLTexture::create() }, m_framebuffer{ GLFramebuffer::create() }, m_width{ width }, m_height{ height }
+{
+	glBindTexture(GL_TEXTURE_2D, m_depth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, m_width, m_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuMemory().track(GLObjectType::Texture, m_depth, MemoryCategory::ShadowMap, 0, "static shadow cache",
+		textureBytes(m_width, m_height, GL_DEPTH_COMPONENT, false));
+
+	glState().bindFramebuffer(m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glState().bindFramebuffer(0);
+}
+
+
+void ShadowCache::copyTo(unsigned int target) const
+{
+	// both bindings go to target through the cache, then only the read side moves
+	glState().bindFramebuffer(target);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+}
+
+#endif // !SHADOW_CACHE_H
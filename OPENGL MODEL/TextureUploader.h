@@ -0,0 +1,288 @@
+#pragma once
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <glad/glad.h>
+#include "GLHandle.h"
+#include "GpuMemory.h"
+#include "stb_image.h"
+#include "ThreadPool.h"
+#include "UploadQueue.h"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// one level of a decoded image, tightly packed rows
+struct ImageLevel
+{
+	std::shared_ptr<const unsigned char> pixels{};
+	int width{};
+	int height{};
+};
+
+// pixels decoded by stb_image on a worker thread, plus the mip chain built from them
+struct DecodedImage
+{
+	std::vector<ImageLevel> levels{};
+	int components{};
+
+	GLenum format() const
+	{
+		if (components == 1)
+			return GL_RED;
+		else if (components == 4)
+			return GL_RGBA;
+		return GL_RGB;
+	}
+};
+
+
+// halve an image with a 2x2 box filter (odd edges reuse the last row / column)
+inline ImageLevel downsample(const ImageLevel& source, int components)
+{
+	ImageLevel level{};
+	level.width = std::max(1, source.width / 2);
+	level.height = std::max(1, source.height / 2);
+
+	unsigned char* out{ new unsigned char[static_cast<std::size_t>(level.width) * level.height * components] };
+	const unsigned char* in{ source.pixels.get() };
+
+	for (int y{ 0 }; y < level.height; ++y)
+	{
+		int y0{ std::min(y * 2, source.height - 1) };
+		int y1{ std::min(y * 2 + 1, source.height - 1) };
+
+		for (int x{ 0 }; x < level.width; ++x)
+		{
+			int x0{ std::min(x * 2, source.width - 1) };
+			int x1{ std::min(x * 2 + 1, source.width - 1) };
+
+			for (int c{ 0 }; c < components; ++c)
+			{
+				int sum{ in[(y0 * source.width + x0) * components + c]
+					+ in[(y0 * source.width + x1) * components + c]
+					+ in[(y1 * source.width + x0) * components + c]
+					+ in[(y1 * source.width + x1) * components + c] };
+
+				out[(y * level.width + x) * components + c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+
+	level.pixels = std::shared_ptr<const unsigned char>(out, std::default_delete<unsigned char[]>());
+	return level;
+}
+
+
+// decode a file and optionally build its full mip chain. Worker thread safe
+inline DecodedImage decodeImage(const std::string& filename, bool flipVertically, bool buildMips)
+{
+	stbi_set_flip_vertically_on_load_thread(flipVertically);
+
+	DecodedImage image{};
+	ImageLevel base{};
+	unsigned char* data{ stbi_load(filename.c_str(), &base.width, &base.height, &image.components, 0) };
+
+	if (!data)
+		return image;
+
+	base.pixels = std::shared_ptr<const unsigned char>(data, stbi_image_free);
+	image.levels.push_back(base);
+
+	while (buildMips && (image.levels.back().width > 1 || image.levels.back().height > 1))
+		image.levels.push_back(downsample(image.levels.back(), image.components));
+
+	return image;
+}
+
+
+// Streams textures to the GPU.
+//
+// request() hands back a texture name right away (with a 1x1 placeholder image) and
+// decodes the file plus its mip chain on the thread pool. The worker then feeds an
+// UploadQueue job that uploads one mip per group of steps, smallest mip first, each
+// mip in bands of rows through the PBO ring. GL_TEXTURE_BASE_LEVEL follows the
+// uploaded mips so the texture sharpens while it streams in
+class TextureUploader
+{
+private:
+	ThreadPool& m_pool;
+	UploadQueue& m_queue;
+
+	std::atomic<int> m_decoding{ 0 };
+
+public:
+	TextureUploader(ThreadPool& pool, UploadQueue& queue)
+		: m_pool{ pool }, m_queue{ queue }
+	{
+	}
+
+	TextureUploader(const TextureUploader&) = delete;
+	TextureUploader& operator=(const TextureUploader&) = delete;
+
+	// create the texture object and start decoding the file in the background
+	GLTexture request(const std::string& filename, AssetId owner);
+
+	// same for the six faces of a cube map (+X, -X, +Y, -Y, +Z, -Z)
+	GLTexture requestCubeMap(const std::vector<std::string>& faces, AssetId owner);
+
+	// block until every requested texture is on the GPU
+	void finish();
+
+	// block until no worker is decoding anymore (and so none will touch the queue)
+	void waitForDecodes();
+
+	int decodingCount() const { return m_decoding; }
+};
+
+
+GLTexture TextureUploader::request(const std::string& filename, AssetId owner)
+{
+	GLTexture texture{ GLTexture::create() };
+	unsigned int textureID{ texture };
+
+	// mid-grey placeholder so meshes can draw before their texture arrives
+	const unsigned char placeholder[4]{ 128, 128, 128, 255 };
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	gpuMemory().track(GLObjectType::Texture, textureID, MemoryCategory::Textures, owner, filename, 4);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	++m_decoding;
+	m_pool.submit([this, filename, owner, textureID]()
+		{
+			// model UVs are already flipped by aiProcess_FlipUVs
+			DecodedImage image{ decodeImage(filename, false, true) };
+
+			if (image.levels.empty())
+			{
+				std::cout << "Failed to load at path: " << filename << '\n';
+				--m_decoding;
+				return;
+			}
+
+			UploadJob job{};
+			job.owner = owner;
+			job.name = filename;
+
+			// the full chain is allocated level by level below, account for all of it up front
+			const ImageLevel& base{ image.levels[0] };
+			std::size_t bytes{ textureBytes(base.width, base.height, image.format(), true) };
+			UploadStep track{};
+			track.run = [textureID, owner, filename, bytes]()
+				{
+					gpuMemory().track(GLObjectType::Texture, textureID, MemoryCategory::Textures, owner,
+						filename, bytes);
+					return true;
+				};
+			job.steps.push_back(std::move(track));
+
+			const int lastLevel{ static_cast<int>(image.levels.size()) - 1 };
+			for (int level{ lastLevel }; level >= 0; --level)
+			{
+				const ImageLevel& mip{ image.levels[level] };
+				appendTextureLevelSteps(job, m_queue, textureID, GL_TEXTURE_2D, GL_TEXTURE_2D, level,
+					mip.width, mip.height, image.format(), image.components, mip.pixels);
+
+				// levels base..max are all real now, sample from them
+				UploadStep complete{};
+				complete.run = [textureID, level, lastLevel]()
+					{
+						glBindTexture(GL_TEXTURE_2D, textureID);
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, lastLevel);
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+						return true;
+					};
+				job.steps.push_back(std::move(complete));
+			}
+
+			m_queue.enqueue(std::move(job));
+			--m_decoding;
+		});
+
+	return texture;
+}
+
+
+GLTexture TextureUploader::requestCubeMap(const std::vector<std::string>& faces, AssetId owner)
+{
+	GLTexture texture{ GLTexture::create() };
+	unsigned int textureID{ texture };
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	++m_decoding;
+	m_pool.submit([this, faces, owner, textureID]()
+		{
+			UploadJob job{};
+			job.owner = owner;
+			job.name = "cubemap";
+
+			std::size_t bytes{};
+			for (unsigned int i{ 0 }; i < faces.size(); ++i)
+			{
+				// cube map faces are not flipped
+				DecodedImage image{ decodeImage(faces[i], false, false) };
+				if (image.levels.empty())
+				{
+					std::cout << "Texture failed to load at path: " << faces[i] << '\n';
+					continue;
+				}
+
+				const ImageLevel& face{ image.levels[0] };
+				bytes += textureBytes(face.width, face.height, image.format(), false);
+				appendTextureLevelSteps(job, m_queue, textureID, GL_TEXTURE_CUBE_MAP,
+					GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, face.width, face.height, image.format(),
+					image.components, face.pixels);
+			}
+
+			UploadStep track{};
+			track.run = [textureID, owner, bytes]()
+				{
+					gpuMemory().track(GLObjectType::Texture, textureID, MemoryCategory::Cubemap, owner,
+						"cubemap", bytes);
+					return true;
+				};
+			job.steps.push_front(std::move(track));
+
+			m_queue.enqueue(std::move(job));
+			--m_decoding;
+		});
+
+	return texture;
+}
+
+
+void TextureUploader::waitForDecodes()
+{
+	while (m_decoding > 0)
+		std::this_thread::yield();
+}
+
+
+void TextureUploader::finish()
+{
+	// jobs are enqueued before the counter drops, so the queue sees all of them
+	waitForDecodes();
+	m_queue.finish();
+}
+
+
+// set by main() once the GL context exists. When null, textures load synchronously
+inline TextureUploader* activeTextureUploader{ nullptr };
+
+#endif // !TEXTURE_UPLOADER_H
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads that run jobs in submission order.
+// Jobs must not touch OpenGL: the context is only current on the main thread
+class ThreadPool
+{
+private:
+	std::vector<std::thread> m_workers{};
+	std::queue<std::function<void()>> m_jobs{};
+
+	std::mutex m_mutex{};
+	std::condition_variable m_condition{};
+	bool m_stop{ false };
+
+	void workerLoop();
+
+public:
+	// leave one core for the GL thread by default. hardware_concurrency() may be 0
+	explicit ThreadPool(unsigned int threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1)
+	{
+		for (unsigned int i{ 0 }; i < threadCount; ++i)
+			m_workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+
+	// finishes every queued job before joining
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_stop = true;
+		}
+		m_condition.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int size() const { return static_cast<unsigned int>(m_workers.size()); }
+
+	// queue a job and get a future for its result
+	template <typename F>
+	auto submit(F&& job) -> std::future<decltype(job())>
+	{
+		using Result = decltype(job());
+
+		// std::function needs a copyable target, packaged_task is move-only
+		auto task{ std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job)) };
+		std::future<Result> result{ task->get_future() };
+
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_jobs.emplace([task]() { (*task)(); });
+		}
+		m_condition.notify_one();
+
+		return result;
+	}
+};
+
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job{};
+		{
+			std::unique_lock<std::mutex> lock{ m_mutex };
+			m_condition.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+
+			if (m_stop && m_jobs.empty())
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop();
+		}
+		job();
+	}
+}
+
+
+// workers for short parallel bursts the GL thread waits on (frame preparation,
+// BVH builds), set while run() is active
+inline ThreadPool* activeRenderPool{ nullptr };
+
+
+// true once a future has its value, without blocking
+template <typename T>
+bool isReady(const std::future<T>& future)
+{
+	return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+
+// how many chunks parallelFor() splits count items into: one per worker plus the
+// calling thread, but none smaller than minChunk
+inline std::size_t chunkCount(const ThreadPool& pool, std::size_t count, std::size_t minChunk)
+{
+	std::size_t wanted{ (count + minChunk - 1) / std::max<std::size_t>(minChunk, 1) };
+	return std::min<std::size_t>(pool.size() + 1, wanted);
+}
+
+
+// run body(begin, end, chunk) over [0, count) in chunkCount() contiguous chunks.
+// The calling thread takes the last chunk itself and returns once every chunk is done
+template <typename Body>
+void parallelFor(ThreadPool& pool, std::size_t count, std::size_t minChunk, Body&& body)
+{
+	std::size_t chunks{ chunkCount(pool, count, minChunk) };
+	if (chunks <= 1)
+	{
+		if (count)
+			body(std::size_t{ 0 }, count, std::size_t{ 0 });
+		return;
+	}
+
+	std::size_t chunkSize{ (count + chunks - 1) / chunks };
+	std::vector<std::future<void>> pending{};
+	pending.reserve(chunks - 1);
+
+	for (std::size_t chunk{ 0 }; chunk + 1 < chunks; ++chunk)
+	{
+		std::size_t begin{ chunk * chunkSize };
+		std::size_t end{ std::min(count, begin + chunkSize) };
+		pending.push_back(pool.submit([&body, begin, end, chunk]() { body(begin, end, chunk); }));
+	}
+
+	body(std::min(count, (chunks - 1) * chunkSize), count, chunks - 1);
+
+	for (std::future<void>& future : pending)
+		future.get();
+}
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,141 @@
+#pragma once
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "CommandList.h"
+#include "GLHandle.h"
+#include "GpuMemory.h"
+#include "Shader.h"
+
+#include <string>
+
+
+// fixed binding points, every shader maps its blocks to these after linking
+constexpr unsigned int CAMERA_BLOCK_BINDING{ 0 };
+constexpr unsigned int FRAME_BLOCK_BINDING{ 1 };
+constexpr unsigned int LIGHTS_BLOCK_BINDING{ 2 };
+constexpr unsigned int CLUSTERS_BLOCK_BINDING{ 3 };
+
+
+// C++ mirrors of the std140 blocks in the shaders. vec3 is aligned to 16 bytes
+// in std140, so a float is packed into the last 4 bytes wherever one fits
+
+// layout (std140) uniform Camera
+struct CameraBlock
+{
+	glm::mat4 view{ 1.0f };
+	glm::mat4 projection{ 1.0f };
+	glm::vec4 viewPos{};		// xyz, w unused
+};
+
+// layout (std140) uniform Frame
+struct FrameBlock
+{
+	glm::mat4 lightSpaceMatrix{ 1.0f };
+	float time{};
+	float deltaTime{};
+	float padding[2]{};
+};
+
+struct DirLightStd140
+{
+	glm::vec3 direction{};
+	float padding0{};
+	glm::vec3 ambient{};
+	float padding1{};
+	glm::vec3 diffuse{};
+	float padding2{};
+	glm::vec3 specular{};
+	float padding3{};
+};
+
+struct SpotLightStd140
+{
+	glm::vec3 position{};
+	float cutOff{};			// cosine of the inner cone angle
+	glm::vec3 direction{};
+	float outerCutOff{};
+	glm::vec3 ambient{};
+	float constant{};
+	glm::vec3 diffuse{};
+	float linear{};
+	glm::vec3 specular{};
+	float quadratic{};
+};
+
+// layout (std140) uniform Lights. The point lights live in the light grid, only
+// their ambient terms are summed up here since those reach everywhere
+struct LightsBlock
+{
+	DirLightStd140 dirLight{};
+	SpotLightStd140 spotLight{};
+	glm::vec3 pointAmbient{};
+	float padding{};
+};
+
+// layout (std140) uniform Clusters, how model.fs finds its cluster in the light grid
+struct ClustersBlock
+{
+	glm::uvec4 count{};		// tiles across, tiles up, depth slices, unused
+	glm::vec4 scale{};		// slice = log(view depth) * x + y, tile = pixel * zw
+};
+
+static_assert(sizeof(CameraBlock) == 144, "Camera block does not match std140");
+static_assert(sizeof(FrameBlock) == 80, "Frame block does not match std140");
+static_assert(sizeof(LightsBlock) == 64 + 80 + 16, "Lights block does not match std140");
+static_assert(sizeof(ClustersBlock) == 32, "Clusters block does not match std140");
+
+
+// One uniform buffer holding a block struct, bound to a fixed binding point.
+// update() rewrites the whole block, orphaning the old storage so the driver
+// does not have to wait for draws still reading last frame's data
+template <typename Block>
+class UniformBlockBuffer
+{
+private:
+	GLBuffer m_buffer{};
+	unsigned int m_binding{};
+
+public:
+	UniformBlockBuffer(unsigned int binding, const std::string& label)
+		: m_buffer{ GLBuffer::create() }, m_binding{ binding }
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+
+		gpuMemory().track(GLObjectType::Buffer, m_buffer, MemoryCategory::UniformBuffers, 0, label,
+			sizeof(Block));
+	}
+
+	void update(const Block& block)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// same as update(), but recorded into a command list, the block is copied
+	void record(CommandList& list, const Block& block) const
+	{
+		list.updateBuffer(GL_UNIFORM_BUFFER, m_buffer, &block, sizeof(Block));
+	}
+
+	unsigned int binding() const { return m_binding; }
+};
+
+
+// map the standard blocks of a shader to their binding points. Blocks the
+// shader does not declare are skipped
+inline void bindUniformBlocks(const Shader& shader)
+{
+	shader.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+	shader.bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+	shader.bindUniformBlock("Lights", LIGHTS_BLOCK_BINDING);
+	shader.bindUniformBlock("Clusters", CLUSTERS_BLOCK_BINDING);
+}
+
+#endif // !UNIFORM_BLOCKS_H
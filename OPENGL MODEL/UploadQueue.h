@@ -0,0 +1,454 @@
+#pragma once
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <glad/glad.h>
+#include "GLHandle.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+
+// one bounded piece of GL work (a buffer range, a band of texture rows, ...).
+// run() returns false when it could not make progress yet (e.g. no free PBO)
+struct UploadStep
+{
+	std::size_t bytes{};
+	std::function<bool()> run{};
+};
+
+struct UploadJob
+{
+	AssetId owner{};
+	std::string name{};
+	std::deque<UploadStep> steps{};
+	std::function<void()> onComplete{};		// runs on the GL thread after the last step
+};
+
+
+struct UploadStats
+{
+	std::size_t jobsQueued{};
+	std::size_t stepsQueued{};
+	std::size_t bytesQueued{};
+
+	std::size_t bytesThisFrame{};
+	std::size_t stepsThisFrame{};
+	double msThisFrame{};
+
+	std::size_t totalBytes{};
+};
+
+
+enum class PixelBufferMap
+{
+	Mapped,
+	Busy,		// the GPU still reads the next slot, retry later
+	Failed,		// the driver refused the mapping, upload from client memory instead
+};
+
+
+// Ring of pixel unpack buffers. Each slot is fenced after the GPU command that
+// reads it, and we only ever map the next slot once its fence has signaled
+class PixelBufferRing
+{
+private:
+	struct Slot
+	{
+		GLBuffer pbo{};
+		GLsync fence{};
+	};
+
+	std::vector<Slot> m_slots{};
+	std::size_t m_slotSize{};
+	unsigned int m_next{};
+
+public:
+	PixelBufferRing(unsigned int slotCount, std::size_t slotSize)
+		: m_slots(slotCount), m_slotSize{ slotSize }
+	{
+	}
+
+	std::size_t slotSize() const { return m_slotSize; }
+
+	// map the next slot for writing, at most slotSize() bytes. mappedOut and
+	// slotOut are only set when Mapped is returned
+	PixelBufferMap map(std::size_t size, unsigned int& slotOut, void*& mappedOut);
+
+	// unmap the slot and leave it bound to GL_PIXEL_UNPACK_BUFFER for the upload
+	bool unmapAndBind(unsigned int slot);
+
+	// fence the upload that was just issued from the slot and unbind it
+	void fence(unsigned int slot);
+
+	void release();
+};
+
+
+PixelBufferMap PixelBufferRing::map(std::size_t size, unsigned int& slotOut, void*& mappedOut)
+{
+	Slot& slot{ m_slots[m_next] };
+
+	if (slot.fence)
+	{
+		// timeout 0: only poll, never wait on the GPU here
+		GLenum status{ glClientWaitSync(slot.fence, 0, 0) };
+		if (status == GL_TIMEOUT_EXPIRED)
+			return PixelBufferMap::Busy;
+
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+	if (!slot.pbo)
+	{
+		slot.pbo = GLBuffer::create();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, m_slotSize, nullptr, GL_STREAM_DRAW);
+		gpuMemory().track(GLObjectType::Buffer, slot.pbo, MemoryCategory::UploadStaging, 0,
+			"PBO slot " + std::to_string(m_next), m_slotSize);
+	}
+
+	// the fence already told us the GPU is done with it, no need to synchronize again
+	void* mapped{ glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, std::min(size, m_slotSize),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT) };
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// a failed map leaves the slot unmapped and unfenced, the next call can try it again
+	if (!mapped)
+		return PixelBufferMap::Failed;
+
+	slotOut = m_next;
+	mappedOut = mapped;
+	m_next = (m_next + 1) % m_slots.size();
+	return PixelBufferMap::Mapped;
+}
+
+
+bool PixelBufferRing::unmapAndBind(unsigned int slot)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_slots[slot].pbo);
+	return glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+}
+
+
+void PixelBufferRing::fence(unsigned int slot)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	m_slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+
+void PixelBufferRing::release()
+{
+	for (Slot& slot : m_slots)
+	{
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		slot.pbo.reset();
+	}
+}
+
+
+// Central queue for every GL-side creation upload.
+//
+// Any thread may enqueue() jobs. The GL thread calls drain() once per frame, which
+// runs steps until the millisecond budget is used up. Large uploads are expected to
+// be split into steps no bigger than maxStepBytes() so a single step cannot blow
+// the frame. The cost of the next step is predicted from the measured throughput
+class UploadQueue
+{
+private:
+	std::mutex m_mutex{};
+	std::deque<UploadJob> m_incoming{};			// guarded by m_mutex
+	std::unordered_set<AssetId> m_cancelled{};	// guarded by m_mutex
+
+	std::deque<UploadJob> m_jobs{};				// GL thread only
+	PixelBufferRing m_pixelBuffers;
+
+	UploadStats m_stats{};
+	float m_budgetMs{ 2.0f };
+	double m_msPerByte{ 1.0 / (1024.0 * 1024.0) };	// start by assuming 1 GB/s
+
+	void collectIncoming();
+	void updateQueuedStats();
+
+public:
+	UploadQueue(unsigned int pixelBufferCount = 8, std::size_t maxStepBytes = 1024 * 1024)
+		: m_pixelBuffers{ pixelBufferCount, maxStepBytes }
+	{
+	}
+
+	UploadQueue(const UploadQueue&) = delete;
+	UploadQueue& operator=(const UploadQueue&) = delete;
+
+	// thread safe
+	void enqueue(UploadJob job);
+
+	// drop every queued and future job of an asset, GL thread only.
+	// jobs a worker enqueues for it afterwards are dropped as well
+	void cancel(AssetId owner);
+
+	// run queued steps until the frame budget is spent, GL thread only
+	void drain();
+
+	// run everything that is queued right now, ignoring the budget
+	void finish();
+
+	// delete the pixel buffers, must be called while the context is still current
+	void release();
+
+	bool empty();
+
+	PixelBufferRing& pixelBuffers() { return m_pixelBuffers; }
+	std::size_t maxStepBytes() const { return m_pixelBuffers.slotSize(); }
+
+	float& budgetMs() { return m_budgetMs; }
+	const UploadStats& stats() const { return m_stats; }
+};
+
+
+void UploadQueue::enqueue(UploadJob job)
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	if (m_cancelled.count(job.owner))
+		return;
+
+	m_incoming.push_back(std::move(job));
+}
+
+
+void UploadQueue::cancel(AssetId owner)
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	m_cancelled.insert(owner);
+
+	auto ownedBy{ [owner](const UploadJob& job) { return job.owner == owner; } };
+	m_incoming.erase(std::remove_if(m_incoming.begin(), m_incoming.end(), ownedBy), m_incoming.end());
+	m_jobs.erase(std::remove_if(m_jobs.begin(), m_jobs.end(), ownedBy), m_jobs.end());
+}
+
+
+bool UploadQueue::empty()
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	return m_jobs.empty() && m_incoming.empty();
+}
+
+
+void UploadQueue::collectIncoming()
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	while (!m_incoming.empty())
+	{
+		m_jobs.push_back(std::move(m_incoming.front()));
+		m_incoming.pop_front();
+	}
+}
+
+
+void UploadQueue::updateQueuedStats()
+{
+	m_stats.jobsQueued = m_jobs.size();
+	m_stats.stepsQueued = 0;
+	m_stats.bytesQueued = 0;
+
+	for (const UploadJob& job : m_jobs)
+	{
+		m_stats.stepsQueued += job.steps.size();
+		for (const UploadStep& step : job.steps)
+			m_stats.bytesQueued += step.bytes;
+	}
+}
+
+
+void UploadQueue::drain()
+{
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point start{ Clock::now() };
+
+	collectIncoming();
+
+	m_stats.bytesThisFrame = 0;
+	m_stats.stepsThisFrame = 0;
+
+	while (!m_jobs.empty())
+	{
+		UploadJob& job{ m_jobs.front() };
+
+		if (!job.steps.empty())
+		{
+			UploadStep& step{ job.steps.front() };
+
+			double elapsed{ std::chrono::duration<double, std::milli>(Clock::now() - start).count() };
+			double predicted{ step.bytes * m_msPerByte };
+
+			// always allow one step per frame so the queue cannot starve
+			if (m_stats.stepsThisFrame > 0 && elapsed + predicted > m_budgetMs)
+				break;
+
+			const Clock::time_point stepStart{ Clock::now() };
+			if (!step.run())
+				break;	// waiting on the GPU (PBO still in flight), retry next frame
+
+			double stepMs{ std::chrono::duration<double, std::milli>(Clock::now() - stepStart).count() };
+			if (step.bytes > 0)
+			{
+				// running average of the upload cost, biased towards recent steps
+				m_msPerByte = 0.8 * m_msPerByte + 0.2 * (stepMs / step.bytes);
+			}
+
+			m_stats.bytesThisFrame += step.bytes;
+			m_stats.totalBytes += step.bytes;
+			++m_stats.stepsThisFrame;
+
+			job.steps.pop_front();
+		}
+
+		if (job.steps.empty())
+		{
+			if (job.onComplete)
+				job.onComplete();
+			m_jobs.pop_front();
+		}
+	}
+
+	m_stats.msThisFrame = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	updateQueuedStats();
+}
+
+
+void UploadQueue::finish()
+{
+	float budget{ m_budgetMs };
+	m_budgetMs = 1e9f;
+
+	while (!empty())
+	{
+		drain();
+		// fences only signal once their commands reach the GPU
+		glFlush();
+	}
+
+	m_budgetMs = budget;
+}
+
+
+void UploadQueue::release()
+{
+	m_pixelBuffers.release();
+}
+
+
+// append steps that upload data into an already allocated buffer object, at most
+// maxStepBytes per step. GL_COPY_WRITE_BUFFER is used so no VAO state is touched
+template <typename T>
+void appendBufferSteps(UploadJob& job, unsigned int buffer, std::shared_ptr<const std::vector<T>> data,
+	std::size_t maxStepBytes)
+{
+	const std::size_t total{ data->size() * sizeof(T) };
+
+	for (std::size_t offset{ 0 }; offset < total; offset += maxStepBytes)
+	{
+		std::size_t size{ std::min(maxStepBytes, total - offset) };
+
+		UploadStep step{};
+		step.bytes = size;
+		step.run = [buffer, data, offset, size]()
+			{
+				glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+				glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size,
+					reinterpret_cast<const char*>(data->data()) + offset);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+				return true;
+			};
+		job.steps.push_back(std::move(step));
+	}
+}
+
+
+// append steps that upload one image level of a texture in bands of rows through
+// the PBO ring. pixels must stay alive until the job completes (keep it in the lambda)
+inline void appendTextureLevelSteps(UploadJob& job, UploadQueue& queue, unsigned int texture,
+	GLenum bindTarget, GLenum imageTarget, int level, int width, int height, GLenum format,
+	int components, std::shared_ptr<const unsigned char> pixels)
+{
+	const std::size_t rowBytes{ static_cast<std::size_t>(width) * components };
+	const int rowsPerStep{ std::max(1, static_cast<int>(queue.maxStepBytes() / rowBytes)) };
+
+	// allocate the level first so every band can be a glTexSubImage2D
+	UploadStep allocate{};
+	allocate.run = [texture, bindTarget, imageTarget, level, width, height, format]()
+		{
+			glBindTexture(bindTarget, texture);
+			glTexImage2D(imageTarget, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			return true;
+		};
+	job.steps.push_back(std::move(allocate));
+
+	for (int y{ 0 }; y < height; y += rowsPerStep)
+	{
+		int rows{ std::min(rowsPerStep, height - y) };
+
+		UploadStep band{};
+		band.bytes = rows * rowBytes;
+		band.run = [&queue, texture, bindTarget, imageTarget, level, width, y, rows, rowBytes, format, pixels]()
+			{
+				PixelBufferRing& ring{ queue.pixelBuffers() };
+				const unsigned char* source{ pixels.get() + y * rowBytes };
+				std::size_t size{ rows * rowBytes };
+
+				// a single row wider than a slot cannot go through the ring at all
+				unsigned int slot{};
+				void* mapped{ nullptr };
+				PixelBufferMap result{ size <= ring.slotSize() ? ring.map(size, slot, mapped) : PixelBufferMap::Failed };
+				if (result == PixelBufferMap::Busy)
+					return false;
+
+				bool ok{ false };
+				if (result == PixelBufferMap::Mapped)
+				{
+					std::memcpy(mapped, source, std::min(size, ring.slotSize()));
+					ok = ring.unmapAndBind(slot);
+				}
+
+				// decoded rows are tightly packed, RGB widths are not always a multiple of 4
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glBindTexture(bindTarget, texture);
+				if (ok)
+				{
+					// with a PBO bound the data pointer is an offset into the buffer
+					glTexSubImage2D(imageTarget, level, 0, y, width, rows, format, GL_UNSIGNED_BYTE, (void*)0);
+					ring.fence(slot);
+				}
+				else
+				{
+					// no mapping or its contents were lost, upload from client memory instead
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					glTexSubImage2D(imageTarget, level, 0, y, width, rows, format, GL_UNSIGNED_BYTE, source);
+				}
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				return true;
+			};
+		job.steps.push_back(std::move(band));
+	}
+}
+
+
+// set by main() once the GL context exists. When null, uploads run immediately
+inline UploadQueue* activeUploadQueue{ nullptr };
+
+#endif // !UPLOAD_QUEUE_H
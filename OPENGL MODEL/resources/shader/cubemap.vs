@@ -4,12 +4,18 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoord;
 
-uniform mat4 view;
-uniform mat4 projection;
+// see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
 
 void main()
 {
 	TexCoord = aPos;	// use aPos as direction vector to sample skybox texture
-	vec4 pos = projection * view * vec4 (aPos, 1.0);
+	// remove translation so the box stays around the camera
+	vec4 pos = projection * mat4(mat3(view)) * vec4 (aPos, 1.0);
 	gl_Position = pos.xyww;
 }
\ No newline at end of file
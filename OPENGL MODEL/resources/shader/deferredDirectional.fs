@@ -0,0 +1,91 @@
+#version 330 core
+out vec4 FragColor;
+
+// variant switch, ShaderVariants defines it to 0 or 1 like in model.fs
+#ifndef BLINN
+#define BLINN 0			// Blinn-Phong instead of Phong specular
+#endif
+
+in vec2 TexCoord;
+
+// directional light, its shadow and the ambient terms of the deferred path,
+// the same lighting as CalcDirLight in model.fs
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform sampler2D shadowMap;
+
+uniform mat4 inverseViewProjection;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
+
+#include "lights.glsl"
+
+
+vec3 decodeNormal(vec2 f)
+{
+	vec3 n = vec3 (f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp (-n.z, 0.0, 1.0);
+	n.xy += vec2 (n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize (n);
+}
+
+
+float shadowCalculation (vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+{
+	vec3 projCoord = fragPosLightSpace.xyz / fragPosLightSpace.w;
+	projCoord = projCoord * 0.5 + 0.5;
+
+	float closestDepth = texture (shadowMap, projCoord.xy).r;
+	float currentDepth = projCoord.z;
+
+	float bias  = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+	float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+
+	if (projCoord.z > 1.0)
+		shadow = 0.0;
+
+	return shadow;
+}
+
+
+void main()
+{
+	float depth = texture (gDepth, TexCoord).r;
+	if (depth >= 1.0)
+		discard;		// background, the skybox fills it later
+
+	vec4 clip = inverseViewProjection * vec4 (vec3 (TexCoord, depth) * 2.0 - 1.0, 1.0);
+	vec3 fragPos = clip.xyz / clip.w;
+
+	vec4 albedo = texture (gAlbedo, TexCoord);
+	vec3 normal = decodeNormal (texture (gNormal, TexCoord).rg);
+	vec3 viewDir = normalize (viewPos.xyz - fragPos);
+	vec3 lightDir = normalize (-dirLight.direction);
+
+	float diff = max (dot (lightDir, normal), 0.0);
+#if BLINN
+	float spec = pow (max (dot (normal, normalize (lightDir + viewDir)), 0.0), 32.0);
+#else
+	float spec = pow (max (dot (reflect (-lightDir, normal), viewDir), 0.0), albedo.a * 256.0);
+#endif
+
+	float shadow = shadowCalculation (lightSpaceMatrix * vec4 (fragPos, 1.0), normal, lightDir);
+
+	vec3 result = (dirLight.ambient + pointAmbient) * albedo.rgb
+		+ (dirLight.diffuse * diff + dirLight.specular * spec) * albedo.rgb * (1.0 - shadow);
+	FragColor = vec4 (result, 1.0);
+}
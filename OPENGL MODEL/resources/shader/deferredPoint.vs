@@ -0,0 +1,27 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;					// unit sphere
+layout (location = 3) in vec4 aPositionRange;		// see GpuPointLight in Lights.h
+layout (location = 4) in vec4 aDiffuseLinear;
+layout (location = 5) in vec4 aSpecularQuadratic;
+
+flat out vec4 PositionRange;
+flat out vec4 DiffuseLinear;
+flat out vec4 SpecularQuadratic;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+void main()
+{
+	PositionRange = aPositionRange;
+	DiffuseLinear = aDiffuseLinear;
+	SpecularQuadratic = aSpecularQuadratic;
+
+	vec3 world = aPositionRange.xyz + aPos * aPositionRange.w;
+	gl_Position = projection * view * vec4 (world, 1.0);
+}
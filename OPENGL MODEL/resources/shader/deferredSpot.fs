@@ -0,0 +1,76 @@
+#version 330 core
+out vec4 FragColor;
+
+// variant switch, ShaderVariants defines it to 0 or 1 like in model.fs
+#ifndef BLINN
+#define BLINN 0			// Blinn-Phong instead of Phong specular
+#endif
+
+// the spot light of the deferred path, added on top. The same lighting as
+// CalcSpotLight in model.fs
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
+
+#include "lights.glsl"
+
+
+vec3 decodeNormal(vec2 f)
+{
+	vec3 n = vec3 (f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp (-n.z, 0.0, 1.0);
+	n.xy += vec2 (n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize (n);
+}
+
+
+void main()
+{
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	float depth = texture (gDepth, uv).r;
+
+	vec4 clip = inverseViewProjection * vec4 (vec3 (uv, depth) * 2.0 - 1.0, 1.0);
+	vec3 fragPos = clip.xyz / clip.w;
+
+	vec4 albedo = texture (gAlbedo, uv);
+	vec3 normal = decodeNormal (texture (gNormal, uv).rg);
+	vec3 viewDir = normalize (viewPos.xyz - fragPos);
+	vec3 lightDir = normalize (spotLight.position - fragPos);
+
+	float diff = max (dot (lightDir, normal), 0.0);
+#if BLINN
+	float spec = pow (max (dot (normal, normalize (lightDir + viewDir)), 0.0), 32.0);
+#else
+	float spec = pow (max (dot (reflect (-lightDir, normal), viewDir), 0.0), albedo.a * 256.0);
+#endif
+
+	float theta = dot (lightDir, normalize (-spotLight.direction));
+	float epsilon = spotLight.cutOff - spotLight.outerCutOff;
+	float intensity = clamp ((theta - spotLight.outerCutOff) / epsilon, 0.0, 1.0);
+
+	float distance = length (spotLight.position - fragPos);
+	float attenuation = 1.0 / (spotLight.constant + spotLight.linear * distance
+		+ spotLight.quadratic * (distance * distance));
+
+	vec3 result = intensity * attenuation
+		* (spotLight.ambient + spotLight.diffuse * diff + spotLight.specular * spec) * albedo.rgb;
+	FragColor = vec4 (result, 1.0);
+}
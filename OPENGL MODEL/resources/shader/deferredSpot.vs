@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;		// unit cone
+
+uniform mat4 volume;		// unit cone -> the spot light's cone in world space
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+void main()
+{
+	gl_Position = projection * view * volume * vec4 (aPos, 1.0);
+}
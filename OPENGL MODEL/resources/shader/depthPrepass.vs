@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aInstanceMatrix;
+
+// depth of the main pass only. gl_Position is computed exactly like model.vs so
+// the colour pass can test against it with GL_EQUAL
+invariant gl_Position;
+
+uniform mat4 model;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+void main()
+{
+	mat4 world = model * aInstanceMatrix;
+
+	vec3 fragPos = vec3 (world * vec4(aPos, 1.0f));
+	gl_Position = projection * view * vec4(fragPos, 1.0f);
+}
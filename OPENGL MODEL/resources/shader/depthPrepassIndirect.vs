@@ -0,0 +1,34 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+
+// multi-draw indirect version of depthPrepass.vs, positioned like modelIndirect.vs
+invariant gl_Position;
+
+struct DrawData
+{
+	uint firstInstance;
+	uint transform;
+};
+
+layout (std430, binding = 0) readonly buffer Draws { DrawData draws[]; };
+layout (std430, binding = 1) readonly buffer Transforms { mat4 transforms[]; };
+layout (std430, binding = 2) readonly buffer Instances { mat4 instances[]; };
+
+uniform int drawOffset;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+void main()
+{
+	DrawData draw = draws[drawOffset + gl_DrawID];
+	mat4 world = transforms[draw.transform] * instances[draw.firstInstance + gl_InstanceID];
+
+	vec3 fragPos = vec3 (world * vec4(aPos, 1.0f));
+	gl_Position = projection * view * vec4(fragPos, 1.0f);
+}
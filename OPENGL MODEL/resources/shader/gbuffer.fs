@@ -0,0 +1,41 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedo;		// rgb albedo, a shininess / 256
+layout (location = 1) out vec2 gNormal;		// octahedral world space normal
+
+in VS_OUT
+{
+	vec2 TexCoord;
+	vec3 Normal;
+	vec3 FragPos;
+	vec4 FragPosLightSpace;
+} fs_in;
+
+// geometry pass of the deferred path, model.vs positions the vertices.
+// Only the inputs of the lighting in model.fs are stored, see DeferredRenderer.h
+#include "material.glsl"
+
+
+// unit vector -> [-1, 1]^2 on the octahedron folded flat, 2 channels instead of 3
+vec2 octWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	return n.z >= 0.0 ? n.xy : octWrap(n.xy);
+}
+
+
+void main()
+{
+	vec4 textureColor = texture (material.texture_diffuse1, fs_in.TexCoord);
+#if ALPHA_TEST
+	if (textureColor.a < ALPHA_CUTOFF)
+		discard;
+#endif
+
+	gAlbedo = vec4 (textureColor.rgb, material.shininess / 256.0);
+	gNormal = encodeNormal (normalize (fs_in.Normal));
+}
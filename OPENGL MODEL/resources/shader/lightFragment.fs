@@ -1,11 +1,11 @@
 #version 330 core
 out vec4 FragColor;
 
-uniform vec3 lightColor;
+flat in vec3 LightColor;
 
 
 void main()
 {
 	// set all 4 vector values to 1.0f
-	FragColor = vec4(lightColor, 1.0f);
+	FragColor = vec4(LightColor, 1.0f);
 }
\ No newline at end of file
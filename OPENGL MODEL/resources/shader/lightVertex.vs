@@ -1,12 +1,22 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-// for transformation
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance data, see InstanceBuffer.h
+layout (location = 3) in mat4 aInstanceMatrix;
+layout (location = 7) in vec4 aInstanceColor;
+
+flat out vec3 LightColor;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
 
 void main()
 {
-	gl_Position = projection * view * model * vec4 (aPos, 1.0f);
+	LightColor = aInstanceColor.rgb;
+	gl_Position = projection * view * aInstanceMatrix * vec4 (aPos, 1.0f);
 }
\ No newline at end of file
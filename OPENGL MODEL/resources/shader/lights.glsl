@@ -0,0 +1,34 @@
+// the lights every fragment sees, uploaded once per frame. Must match LightsBlock
+// in UniformBlocks.h
+
+// light structs are laid out for std140, floats fill the padding after a vec3
+struct DirLight
+{
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+struct SpotLight
+{
+	vec3 position;
+	float cutOff;		// for inner cone
+	vec3 direction;
+	float outerCutOff;	// for outer cone
+
+	vec3 ambient;
+	float constant;
+	vec3 diffuse;
+	float linear;
+	vec3 specular;
+	float quadratic;
+};
+
+layout (std140) uniform Lights
+{
+	DirLight dirLight;
+	SpotLight spotLight;	// the flashlight, model.fs finds it in the light grid
+	vec3 pointAmbient;		// every point light's ambient, it is not attenuated
+};
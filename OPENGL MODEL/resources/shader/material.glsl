@@ -0,0 +1,26 @@
+// the textures of a mesh, see bindMaterialSamplers() in Mesh.h
+// dont instantiate this as sampler2D is an opaque type that cannot be instantiated
+struct Material
+{
+	sampler2D texture_diffuse1;
+	sampler2D texture_diffuse2;
+	sampler2D texture_diffuse3;
+
+	sampler2D texture_specular1;
+	sampler2D texture_specular2;
+	sampler2D texture_specular3;
+
+	sampler2D emission;
+	float shininess;
+};
+
+uniform Material material;
+
+// cut-out surfaces: texels below ALPHA_CUTOFF are discarded. Only the variant
+// with ALPHA_TEST 1 contains a discard, on some hardware a shader that may
+// discard loses early depth testing
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+
+#define ALPHA_CUTOFF 0.5
@@ -9,67 +9,55 @@ in VS_OUT
 	vec4 FragPosLightSpace;
 } fs_in;
 
+// variant switches, ShaderVariants defines each to 0 or 1. A plain Shader gets
+// these defaults
+#ifndef BLINN
+#define BLINN 0			// Blinn-Phong instead of Phong specular
+#endif
+#ifndef SHADOWS
+#define SHADOWS 1		// the directional light's shadow map
+#endif
+#ifndef LOCAL_LIGHTS
+#define LOCAL_LIGHTS 1	// the point and spot lights of the light grid
+#endif
+
 uniform sampler2D shadowMap;
 
 uniform vec3 objectColor;
 uniform vec3 lightColor;
 uniform vec3 lightPos;		// needed for shadow
-uniform bool blinn;
 
 
 //uniform sampler2D texture_diffuse1;
 
 // for specular lighting in world space. If in viewspace the camera is always at (0,0,0)
 
-uniform vec3 viewPos;		// needed for shadow
-
-
-
-
-// For material
-// dont instantiate this as sampler2D is an opaque type that cannot be instantiated
-
-struct Material
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
 {
-	//vec3 ambient;
-	//vec3 diffuse;		// removed in place for texture
-
-	sampler2D texture_diffuse1;
-	sampler2D texture_diffuse2;
-	sampler2D texture_diffuse3;
-
-	sampler2D texture_specular1;
-	sampler2D texture_specular2;
-	sampler2D texture_specular3;
-
-	sampler2D emission;
-	float shininess;
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz, needed for shadow
 };
 
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
 
 
-uniform Material material;
-
-
-
-
-// Directional light function
 
-struct DirLight
-{
-	vec3 direction;
-	
-	vec3 ambient;
-	vec3 diffuse;	
-	vec3 specular;
-};
 
-uniform DirLight dirLight;
+#include "material.glsl"
+#include "lights.glsl"
 
 
 float shadow = 0.0;
 
 
+#if SHADOWS
 float shadowCalculation (vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
 {
 	vec3 projCoord = fragPosLightSpace.xyz / fragPosLightSpace.w;
@@ -87,6 +75,7 @@ float shadowCalculation (vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
 
 	return shadow;
 }
+#endif
 
 
 // 1/12/2025
@@ -104,15 +93,12 @@ vec3 CalcDirLight(DirLight dirLight, vec3 normal, vec3 viewDir)
 	vec3 reflectDir = reflect(-lightDir, normal);
 	float spec = 0.0;
 
-	if (blinn)
-	{
-		vec3 halfwayDir = normalize (lightDir + viewDir);
-		spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
-	}
-	else
-	{
-		spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
-	}
+#if BLINN
+	vec3 halfwayDir = normalize (lightDir + viewDir);
+	spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
+#else
+	spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
+#endif
 
 	// combine result
 	vec3 ambient = dirLight.ambient * vec3 (textureColor);
@@ -120,7 +106,9 @@ vec3 CalcDirLight(DirLight dirLight, vec3 normal, vec3 viewDir)
 	vec3 specular = dirLight.specular * spec * vec3 (textureColor);
 
 	// calculating shadow
+#if SHADOWS
 	shadow = shadowCalculation(fs_in.FragPosLightSpace, normal, lightDir);
+#endif
 	return ambient + (diffuse + specular) * (1.0 - shadow);
 }
 
@@ -128,24 +116,39 @@ vec3 CalcDirLight(DirLight dirLight, vec3 normal, vec3 viewDir)
 
 // Point light function
 
+// the light grid, see LightGrid.h. Every light is a few texels of a buffer
+// texture, every cluster lists its point lights and then its spot lights
+uniform samplerBuffer pointLightBuffer;		// three texels a light
+uniform samplerBuffer spotLightBuffer;		// five texels a light
+uniform usamplerBuffer clusterBuffer;		// x first index, y point count | spot count << 16
+uniform usamplerBuffer lightIndexBuffer;
+
+layout (std140) uniform Clusters
+{
+	uvec4 clusterCount;		// tiles across, tiles up, depth slices
+	vec4 clusterScale;		// slice = log(view depth) * x + y, tile = pixel * zw
+};
+
+// the constant attenuation term is always 1, the ambient terms are summed up
+// in pointAmbient
 struct PointLight
 {
 	vec3 position;
-
-	// attenuation
-	float constant;
-	float linear;
-	float quadratic;
-	
-	vec3 ambient;
+	float range;
 	vec3 diffuse;
+	float linear;
 	vec3 specular;
+	float quadratic;
 };
 
-// number of point lights we want
-#define NR_POINT_LIGHTS 4
-
-uniform PointLight pointLights[NR_POINT_LIGHTS];
+PointLight fetchPointLight (int index)
+{
+	vec4 positionRange = texelFetch (pointLightBuffer, index * 3);
+	vec4 diffuseLinear = texelFetch (pointLightBuffer, index * 3 + 1);
+	vec4 specularQuadratic = texelFetch (pointLightBuffer, index * 3 + 2);
+	return PointLight (positionRange.xyz, positionRange.w, diffuseLinear.rgb, diffuseLinear.w,
+		specularQuadratic.rgb, specularQuadratic.w);
+}
 
 
 // added blinn phong
@@ -162,50 +165,38 @@ vec3 CalcPointLight (PointLight pointLight, vec3 normal, vec3 fragPos, vec3 view
 	vec3 reflectDir = reflect(-lightDir, normal);
 	float spec = 0.0;
 
-	if (blinn)
-	{
-		vec3 halfwayDir = normalize (lightDir + viewDir);
-		spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
-	}
-	else
-	{
-		spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
-	}
+#if BLINN
+	vec3 halfwayDir = normalize (lightDir + viewDir);
+	spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
+#else
+	spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
+#endif
 
 	// attenuation - light drop off
 	float distance = length (pointLight.position - fragPos);
-	float attenuation = 1.0 / (pointLight.constant + pointLight.linear * distance + pointLight.quadratic * (distance * distance));
+	float attenuation = 1.0 / (1.0 + pointLight.linear * distance + pointLight.quadratic * (distance * distance));
 
 	// combine result
-	vec3 ambient = pointLight.ambient * vec3 (textureColor);
 	vec3 diffuse = attenuation * pointLight.diffuse * diff * vec3 (textureColor);
 	vec3 specular = attenuation * pointLight.specular * spec * vec3 (textureColor);
 
-	return (ambient + diffuse + specular);	
+	return (diffuse + specular);	
 }
 
 
 
 // Spotlight function (flashlight)
 
-struct SpotLight
+SpotLight fetchSpotLight (int index)
 {
-	vec3 position;
-	vec3 direction;
-
-	float cutOff;		// for inner cone
-	float outerCutOff;	// for outer cone
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-
-	float constant;
-	float linear;
-	float quadratic;
-};
-
-uniform SpotLight spotLight;
+	vec4 positionRange = texelFetch (spotLightBuffer, index * 5);
+	vec4 directionCutOff = texelFetch (spotLightBuffer, index * 5 + 1);
+	vec4 diffuseLinear = texelFetch (spotLightBuffer, index * 5 + 2);
+	vec4 specularQuadratic = texelFetch (spotLightBuffer, index * 5 + 3);
+	vec4 ambientOuterCutOff = texelFetch (spotLightBuffer, index * 5 + 4);
+	return SpotLight (positionRange.xyz, directionCutOff.w, directionCutOff.xyz, ambientOuterCutOff.w,
+		ambientOuterCutOff.rgb, 1.0, diffuseLinear.rgb, diffuseLinear.w, specularQuadratic.rgb, specularQuadratic.w);
+}
 
 
 vec3 CalcSpotLight (SpotLight spotLight, vec3 normal, vec3 fragPos, vec3 viewDir)
@@ -221,15 +212,12 @@ vec3 CalcSpotLight (SpotLight spotLight, vec3 normal, vec3 fragPos, vec3 viewDir
 	vec3 reflectDir = reflect(-lightDir, normal);
 	float spec = 0.0;
 
-	if (blinn)
-	{
-		vec3 halfwayDir = normalize (lightDir + viewDir);
-		spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
-	}
-	else
-	{
-		spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
-	}
+#if BLINN
+	vec3 halfwayDir = normalize (lightDir + viewDir);
+	spec = pow (max (dot (normal, halfwayDir), 0.0), 32.0f);
+#else
+	spec = pow (max (dot (reflectDir, viewDir), 0.0), material.shininess);
+#endif
 	
 	// theta angle
 	float theta = dot (lightDir, normalize (-spotLight.direction));
@@ -271,23 +259,41 @@ float LinearizeDepth(float depth)
 void main()
 {
 	vec4 textureColor = texture (material.texture_diffuse1, fs_in.TexCoord);
+#if ALPHA_TEST
+	if (textureColor.a < ALPHA_CUTOFF)
+		discard;
+#endif
 
 	vec3 norm = normalize (fs_in.Normal);
-	vec3 viewDir = normalize (viewPos - fs_in.FragPos);
+	vec3 viewDir = normalize (viewPos.xyz - fs_in.FragPos);
 	// phase 1: Directional lighting
 	vec3 result = CalcDirLight (dirLight, norm, viewDir);
 
-	// phase 2: Point lihgts
-	for (int i = 0; i < NR_POINT_LIGHTS; ++i)
+#if LOCAL_LIGHTS
+	// find this fragment's cluster, gl_FragCoord.w is 1 / view depth
+	uvec2 tile = min (uvec2 (gl_FragCoord.xy * clusterScale.zw), clusterCount.xy - 1u);
+	float slice = clamp (log (1.0 / gl_FragCoord.w) * clusterScale.x + clusterScale.y, 0.0, float (clusterCount.z - 1u));
+	int cluster = int ((uint (slice) * clusterCount.y + tile.y) * clusterCount.x + tile.x);
+	uvec2 lights = texelFetch (clusterBuffer, cluster).xy;
+	int first = int (lights.x);
+	int pointCount = int (lights.y & 0xFFFFu);
+	int spotCount = int (lights.y >> 16);
+
+	// phase 2: Point lihgts, only the ones reaching this cluster
+	result += pointAmbient * vec3 (textureColor);
+	for (int i = 0; i < pointCount; ++i)
 	{
-		result += CalcPointLight(pointLights[i], norm, fs_in.FragPos, viewDir);
+		int light = int (texelFetch (lightIndexBuffer, first + i).r);
+		result += CalcPointLight (fetchPointLight (light), norm, fs_in.FragPos, viewDir);
 	}
 
-	// phase 3: Spot light
-	result += CalcSpotLight (spotLight, norm, fs_in.FragPos, viewDir);
-	
-	if (textureColor.a < 0.0)
-		discard;
+	// phase 3: Spot lights, the flashlight among them
+	for (int i = 0; i < spotCount; ++i)
+	{
+		int light = int (texelFetch (lightIndexBuffer, first + pointCount + i).r);
+		result += CalcSpotLight (fetchSpotLight (light), norm, fs_in.FragPos, viewDir);
+	}
+#endif
 
 	//float depth = LinearizeDepth(gl_FragCoord.z) / far;
 
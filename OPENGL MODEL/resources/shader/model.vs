@@ -2,6 +2,7 @@
 layout (location =0) in vec3 aPos;
 layout (location =1) in vec3 aNormal;
 layout (location =2) in vec2 aTexCoord;
+layout (location =3) in mat4 aInstanceMatrix;	// node transform, one per instance
 
 out VS_OUT
 {	
@@ -11,18 +12,34 @@ out VS_OUT
 	vec4 FragPosLightSpace;
 } vs_out;
 
+// must match depthPrepass.vs bit for bit, the colour pass can test depth with GL_EQUAL
+invariant gl_Position;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
-uniform mat4 lightSpaceMatrix;
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
 
 void main()
 {
 	vs_out.TexCoord = aTexCoord;
 
-	vs_out.FragPos = vec3 (model * vec4(aPos, 1.0f));
-	vs_out.Normal = mat3 (transpose (inverse(model))) * aNormal;
+	mat4 world = model * aInstanceMatrix;
+
+	vs_out.FragPos = vec3 (world * vec4(aPos, 1.0f));
+	vs_out.Normal = mat3 (transpose (inverse(world))) * aNormal;
 	vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
 	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0f);
 
@@ -0,0 +1,60 @@
+#version 460 core
+layout (location =0) in vec3 aPos;
+layout (location =1) in vec3 aNormal;
+layout (location =2) in vec2 aTexCoord;
+
+out VS_OUT
+{	
+	vec2 TexCoord;
+	vec3 Normal;
+	vec3 FragPos;
+	vec4 FragPosLightSpace;
+} vs_out;
+
+// must match depthPrepassIndirect.vs bit for bit, the colour pass can test depth with GL_EQUAL
+invariant gl_Position;
+
+// multi-draw indirect version of model.vs, see IndirectDraw.h.
+// gl_DrawID counts from 0 in every glMultiDrawElementsIndirect, drawOffset is
+// the first command of the call
+struct DrawData
+{
+	uint firstInstance;
+	uint transform;
+};
+
+layout (std430, binding = 0) readonly buffer Draws { DrawData draws[]; };
+layout (std430, binding = 1) readonly buffer Transforms { mat4 transforms[]; };
+layout (std430, binding = 2) readonly buffer Instances { mat4 instances[]; };
+
+uniform int drawOffset;
+
+// per-frame data shared by every shader, see UniformBlocks.h
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;		// xyz
+};
+
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
+
+void main()
+{
+	DrawData draw = draws[drawOffset + gl_DrawID];
+
+	vs_out.TexCoord = aTexCoord;
+
+	mat4 world = transforms[draw.transform] * instances[draw.firstInstance + gl_InstanceID];
+
+	vs_out.FragPos = vec3 (world * vec4(aPos, 1.0f));
+	vs_out.Normal = mat3 (transpose (inverse(world))) * aNormal;
+	vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
+	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0f);
+
+}
\ No newline at end of file
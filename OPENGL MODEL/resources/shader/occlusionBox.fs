@@ -0,0 +1,6 @@
+#version 330 core
+
+// occlusion query boxes only count samples, color and depth writes are off
+void main()
+{
+}
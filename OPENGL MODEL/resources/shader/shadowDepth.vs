@@ -1,10 +1,18 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aInstanceMatrix;
 
-uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// see UniformBlocks.h
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
+
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * model * aInstanceMatrix * vec4(aPos, 1.0);
 }
\ No newline at end of file
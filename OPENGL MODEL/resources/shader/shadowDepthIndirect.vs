@@ -0,0 +1,31 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+
+// multi-draw indirect version of shadowDepth.vs, see modelIndirect.vs
+struct DrawData
+{
+	uint firstInstance;
+	uint transform;
+};
+
+layout (std430, binding = 0) readonly buffer Draws { DrawData draws[]; };
+layout (std430, binding = 1) readonly buffer Transforms { mat4 transforms[]; };
+layout (std430, binding = 2) readonly buffer Instances { mat4 instances[]; };
+
+uniform int drawOffset;
+
+// see UniformBlocks.h
+layout (std140) uniform Frame
+{
+	mat4 lightSpaceMatrix;
+	float time;
+	float deltaTime;
+};
+
+void main()
+{
+	DrawData draw = draws[drawOffset + gl_DrawID];
+	mat4 world = transforms[draw.transform] * instances[draw.firstInstance + gl_InstanceID];
+
+    gl_Position = lightSpaceMatrix * world * vec4(aPos, 1.0);
+}
\ No newline at end of file